@@ -26,6 +26,7 @@ QT += sql
 
 CONFIG -= app_bundle
 CONFIG += console
+CONFIG += c++17
 
 win32 {
 
@@ -63,6 +64,10 @@ SOURCES += src/main.cpp \
            src/db.cpp \
            src/make_cert.cpp \
            src/tcp_server.cpp \
+           src/host_metrics.cpp \
+           src/fs_cache.cpp \
+           src/chunk_store.cpp \
+           src/timing_wheel.cpp \
            src/unix_signal.cpp \
            src/common.cpp \
            src/shell.cpp \
@@ -74,11 +79,16 @@ SOURCES += src/main.cpp \
            src/commands/auth.cpp \
            src/commands/acct_recovery.cpp \
            src/commands/table_viewer.cpp \
-           src/commands/fs.cpp
+           src/commands/fs.cpp \
+           src/commands/fs_archive.cpp \
+           src/commands/fs_hash.cpp \
+           src/commands/fs_sync.cpp \
+           src/commands/fs_dedup.cpp
 
 HEADERS += \
            src/cmd_object.h \
            src/cmd_proc.h \
+           src/cmd_registry.h \
            src/commands/channels.h \
            src/commands/cmd_ranks.h \
            src/commands/p2p.h \
@@ -88,6 +98,10 @@ HEADERS += \
            src/db.h \
            src/make_cert.h \
            src/tcp_server.h \
+           src/host_metrics.h \
+           src/fs_cache.h \
+           src/chunk_store.h \
+           src/timing_wheel.h \
            src/unix_signal.h \
            src/common.h \
            src/shell.h \
@@ -99,7 +113,36 @@ HEADERS += \
            src/commands/auth.h \
            src/commands/acct_recovery.h \
            src/commands/table_viewer.h \
-           src/commands/fs.h
+           src/commands/fs.h \
+           src/commands/fs_archive.h \
+           src/commands/fs_hash.h \
+           src/commands/fs_sync.h \
+           src/commands/fs_dedup.h
 
 RESOURCES += \
              cmd_docs.qrc
+
+# the internal command docs are pre-extracted into a constexpr table at build
+# time by gen_cmd_docs.py. cmd_docs.qrc is still kept as the run time fallback.
+
+win32 {
+
+  DOCS_PYTHON = python
+
+} else {
+
+  DOCS_PYTHON = python3
+
+}
+
+CMD_DOCS = $$files($$PWD/docs/intern_commands/*.md)
+
+cmddocs.input         = CMD_DOCS
+cmddocs.output        = $$OBJECTS_DIR/cmd_docs_index.h
+cmddocs.commands      = $$DOCS_PYTHON $$PWD/gen_cmd_docs.py ${QMAKE_FILE_OUT} ${QMAKE_FILE_IN}
+cmddocs.depends       = $$PWD/gen_cmd_docs.py
+cmddocs.CONFIG       += combine target_predeps no_link
+cmddocs.variable_out  = GENERATED_FILES
+
+QMAKE_EXTRA_COMPILERS += cmddocs
+INCLUDEPATH           += $$OBJECTS_DIR
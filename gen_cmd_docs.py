@@ -0,0 +1,123 @@
+#!/usr/bin/python3
+
+# this script is called by qmake at build time to pre-extract the summary,
+# io and description sections of every internal command document into a
+# constexpr table so the listing processes don't need to parse markdown at
+# run time.
+
+# usage: gen_cmd_docs.py <output_header> <md_file> <md_file> ...
+
+import os
+import sys
+
+def parse_md(data, offset):
+    # this mirrors parseMd() in src/shell.cpp; it must produce the exact same
+    # text for every section.
+
+    target_tags = offset * 6
+    tags = 0
+    pos = -1
+    length = 0
+
+    for i in range(0, len(data)):
+        if data[i] == ord('#'):
+            tags += 1
+
+            if pos != -1:
+                break
+
+        elif tags == target_tags:
+            length += 1
+
+            if pos == -1:
+                pos = i
+
+    if pos == -1:
+        return b""
+
+    ret = data[pos:pos + length].strip()
+
+    if offset == 2:
+        ret = ret[:-3] if len(ret) >= 3 else b""
+        ret = ret[3:]
+
+    return ret
+
+def to_c_str(data):
+    ret = "\""
+
+    for byte in data:
+        chr_str = chr(byte)
+
+        if chr_str == "\\":
+            ret += "\\\\"
+
+        elif chr_str == "\"":
+            ret += "\\\""
+
+        elif chr_str == "?":
+            ret += "\\?"
+
+        elif chr_str == "\n":
+            ret += "\\n\"\n        \""
+
+        elif chr_str == "\r":
+            ret += "\\r"
+
+        elif chr_str == "\t":
+            ret += "\\t"
+
+        elif (byte < 0x20) or (byte >= 0x7F):
+            ret += "\\%03o" % byte
+
+        else:
+            ret += chr_str
+
+    return ret + "\""
+
+def main():
+    if len(sys.argv) < 3:
+        print("usage: gen_cmd_docs.py <output_header> <md_file> <md_file> ...")
+
+        exit(1)
+
+    docs = []
+
+    for path in sys.argv[2:]:
+        with open(path, "rb") as file:
+            data = file.read()
+            name = os.path.splitext(os.path.basename(path))[0]
+
+            docs.append((name, parse_md(data, 1), parse_md(data, 2), parse_md(data, 3)))
+
+    # findCmdDoc() does a binary search so the table must be sorted by name.
+
+    docs.sort(key=lambda doc: doc[0].encode())
+
+    with open(sys.argv[1], "w", newline="\n") as out:
+        out.write("#ifndef CMD_DOCS_INDEX_H\n")
+        out.write("#define CMD_DOCS_INDEX_H\n\n")
+        out.write("// generated by gen_cmd_docs.py from docs/intern_commands, do not edit.\n\n")
+        out.write("#include \"src/cmd_registry.h\"\n\n")
+        out.write("static constexpr CmdDoc cmdDocs[] =\n")
+        out.write("{\n")
+
+        for i, doc in enumerate(docs):
+            out.write("    {\n")
+
+            out.write("        " + to_c_str(doc[0].encode()) + ",\n")
+            out.write("        " + to_c_str(doc[1]) + ",\n")
+            out.write("        " + to_c_str(doc[2]) + ",\n")
+            out.write("        " + to_c_str(doc[3]) + "\n")
+
+            if i == len(docs) - 1:
+                out.write("    }\n")
+
+            else:
+                out.write("    },\n")
+
+        out.write("};\n\n")
+        out.write("#endif // CMD_DOCS_INDEX_H\n")
+
+if __name__ == "__main__":
+    main()
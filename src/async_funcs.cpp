@@ -74,21 +74,6 @@ void Session::acctDispChanged(const QByteArray &data)
     }
 }
 
-void Session::castCatch(const QByteArray &data)
-{
-    // format: [54bytes(chIds)][1byte(typeId)][rest-of-bytes(payload)]
-
-    if (matchAnyCh(openSubChs, data.data()))
-    {
-        auto payloadOffs = (MAX_OPEN_SUB_CHANNELS * BLKSIZE_SUB_CHANNEL) + 1;
-        auto typeId      = static_cast<quint8>(data[payloadOffs - 1]);
-        auto len         = static_cast<quint32>(data.size() - payloadOffs);
-        auto *payload    = data.data() + payloadOffs;
-
-        asyncToClient(ASYNC_CAST, rdFromBlock(payload, len), typeId);
-    }
-}
-
 void Session::directDataFromPeer(const QByteArray &data)
 {
     // format: [28bytes(sessionId)][1byte(typeId)][rest-of-bytes(payload)]
@@ -330,6 +315,11 @@ void Session::addModule(const QByteArray &data)
     if (!modCmdNames.contains(modApp))
     {
         startModProc(modApp);
+
+        if (activeMods == 0)
+        {
+            syncCatalog();
+        }
     }
 }
 
@@ -349,9 +339,16 @@ void Session::rmModule(const QByteArray &data)
             cmdUniqueNames.remove(cmdId16);
             cmdAppById.remove(cmdId16);
             cmdIds.removeOne(cmdId16);
+
+            dataToClient(toCmdId32(ASYNC_RM_CMD, 0), wrInt(cmdId16, 16), CMD_ID);
         }
 
         modCmdNames.remove(modApp);
+
+        if (activeMods == 0)
+        {
+            syncCatalog();
+        }
     }
 }
 
@@ -0,0 +1,216 @@
+#include "chunk_store.h"
+
+//    This file is part of MRCI.
+
+//    MRCI is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+
+//    MRCI is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+
+//    You should have received a copy of the GNU General Public License
+//    along with MRCI under the LICENSE.md file. If not, see
+//    <http://www.gnu.org/licenses/>.
+
+ChunkStore::ChunkStore(const QString &space)
+{
+    spacePath = rootPath() + "/" + space;
+}
+
+QString ChunkStore::rootPath()
+{
+    return getLocalFilePath(CHUNK_DIRNAME, true);
+}
+
+QString ChunkStore::spaceName(const QByteArray &userId, bool shared)
+{
+    if (shared)
+    {
+        return CHUNK_SHARED_SPACE;
+    }
+    else
+    {
+        return QString::fromLatin1(userId.toHex());
+    }
+}
+
+QString ChunkStore::path()
+{
+    return spacePath;
+}
+
+QString ChunkStore::chunkPath(const QByteArray &hash)
+{
+    // the first byte of the hash picks a sub-directory so no single
+    // directory ends up with millions of entries.
+
+    auto hex = QString::fromLatin1(hash.toHex());
+
+    return spacePath + "/" + hex.left(2) + "/" + hex;
+}
+
+bool ChunkStore::has(const QByteArray &hash, qint64 len)
+{
+    QFile file(chunkPath(hash));
+
+    auto ret = false;
+
+    if (file.open(QFile::ReadOnly) && (file.size() == len))
+    {
+        // chunks are aged by when an upload last used them so this also
+        // keeps purgeStale() off of it until the upload is done with it.
+
+        file.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+
+        ret = true;
+    }
+
+    return ret;
+}
+
+bool ChunkStore::insert(const QString &tmpPath, const QByteArray &hash, qint64 len)
+{
+    // QFile::rename() never replaces an existing file so when two uploads
+    // race to store the same chunk, the loser just drops its copy.
+
+    auto dst = chunkPath(hash);
+    auto ret = false;
+
+    mkPath(QFileInfo(dst).path());
+
+    if (QFile::rename(tmpPath, dst))
+    {
+        addStats(1, len, 0, 0);
+
+        ret = true;
+    }
+    else if (QFile::exists(dst))
+    {
+        QFile::remove(tmpPath);
+
+        ret = true;
+    }
+
+    return ret;
+}
+
+void ChunkStore::addUpload(qint64 logical, qint64 received)
+{
+    addStats(0, 0, logical, received);
+
+    if (QRandomGenerator::global()->bounded(CHUNK_PURGE_ODDS) == 0)
+    {
+        purgeStale();
+    }
+}
+
+void ChunkStore::addStats(qint64 chunks, qint64 bytes, qint64 logical, qint64 received)
+{
+    auto path = rootPath() + "/" + CHUNK_STATS_FILE;
+
+    mkPath(rootPath());
+
+    QLockFile lock(path + ".lock");
+
+    if (lock.tryLock(CHUNK_LOCK_MSEC))
+    {
+        QFile       inFile(path);
+        QJsonObject obj;
+
+        if (inFile.open(QFile::ReadOnly))
+        {
+            obj = QJsonDocument::fromJson(inFile.readAll()).object();
+
+            inFile.close();
+        }
+
+        obj.insert("chunks", static_cast<double>(static_cast<qint64>(obj.value("chunks").toDouble()) + chunks));
+        obj.insert("bytes", static_cast<double>(static_cast<qint64>(obj.value("bytes").toDouble()) + bytes));
+        obj.insert("logical_bytes", static_cast<double>(static_cast<qint64>(obj.value("logical_bytes").toDouble()) + logical));
+        obj.insert("received_bytes", static_cast<double>(static_cast<qint64>(obj.value("received_bytes").toDouble()) + received));
+
+        // QSaveFile swaps the file in with a rename so publishMetrics() can
+        // read it without the lock.
+
+        QSaveFile outFile(path);
+
+        if (outFile.open(QFile::WriteOnly))
+        {
+            outFile.write(QJsonDocument(obj).toJson(QJsonDocument::Compact));
+            outFile.commit();
+        }
+    }
+}
+
+void ChunkStore::purgeStale()
+{
+    // left over .part files are from uploads that were cancelled or crashed
+    // part way through a chunk. a day is far longer than any chunk takes.
+
+    auto limit   = QDateTime::currentDateTime().addDays(-CHUNK_MAX_AGE_DAYS);
+    auto partLim = QDateTime::currentDateTime().addDays(-1);
+
+    qint64 chunks = 0;
+    qint64 bytes  = 0;
+
+    QDirIterator it(rootPath(), QDir::Files, QDirIterator::Subdirectories);
+
+    while (it.hasNext())
+    {
+        it.next();
+
+        auto info = it.fileInfo();
+
+        if (info.path() == rootPath())
+        {
+            continue;
+        }
+        else if (info.fileName().endsWith(".part"))
+        {
+            if (info.lastModified() < partLim) QFile::remove(info.filePath());
+        }
+        else
+        {
+            // stat again right before the delete so a chunk an upload just
+            // found in has() isn't taken out from under it.
+
+            info.refresh();
+
+            if ((info.lastModified() < limit) && QFile::remove(info.filePath()))
+            {
+                chunks += 1;
+                bytes  += info.size();
+            }
+        }
+    }
+
+    if (chunks > 0)
+    {
+        addStats(-chunks, -bytes, 0, 0);
+    }
+}
+
+void ChunkStore::publishMetrics()
+{
+    // the host doesn't touch the store itself; it just copies the totals the
+    // command processes keep into HostMetrics whenever the status is shown.
+
+    QFile file(rootPath() + "/" + CHUNK_STATS_FILE);
+
+    if (file.open(QFile::ReadOnly))
+    {
+        auto obj      = QJsonDocument::fromJson(file.readAll()).object();
+        auto logical  = static_cast<qint64>(obj.value("logical_bytes").toDouble());
+        auto received = static_cast<qint64>(obj.value("received_bytes").toDouble());
+
+        HostMetrics::set("chunk_store.chunks", static_cast<qint64>(obj.value("chunks").toDouble()));
+        HostMetrics::set("chunk_store.bytes", static_cast<qint64>(obj.value("bytes").toDouble()));
+        HostMetrics::set("chunk_store.logical_bytes", logical);
+        HostMetrics::set("chunk_store.received_bytes", received);
+        HostMetrics::set("chunk_store.dedup_ratio_pct", (received > 0) ? ((logical * 100) / received) : 0);
+    }
+}
@@ -0,0 +1,65 @@
+#ifndef CHUNK_STORE_H
+#define CHUNK_STORE_H
+
+//    This file is part of MRCI.
+
+//    MRCI is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+
+//    MRCI is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+
+//    You should have received a copy of the GNU General Public License
+//    along with MRCI under the LICENSE.md file. If not, see
+//    <http://www.gnu.org/licenses/>.
+
+#include "common.h"
+
+#include <QDirIterator>
+#include <QLockFile>
+#include <QSaveFile>
+
+#define CHUNK_DIRNAME      "chunks"
+#define CHUNK_SHARED_SPACE "shared"
+#define CHUNK_STATS_FILE   "stats.json"
+#define CHUNK_LOCK_MSEC    5000
+#define CHUNK_MAX_AGE_DAYS 30 // chunks not used by an upload within this many days are deleted.
+#define CHUNK_PURGE_ODDS   64 // one in this many uploads also purges the stale chunks.
+
+class ChunkStore
+{
+    // content addressed store of the chunks that came in through fs_dedup_up.
+    // each chunk is a file named by the sha256 of its data under a space
+    // directory, one per user unless the host is set to share a single
+    // space between everyone (chunk_store_shared). a shared space lets one
+    // user find out if another already uploaded a given chunk so it is off
+    // by default. the running totals live in a json file under a lock file
+    // since the command processes update them and the host reads them.
+
+private:
+
+    QString spacePath;
+
+    static QString rootPath();
+    static void    addStats(qint64 chunks, qint64 bytes, qint64 logical, qint64 received);
+
+public:
+
+    static QString spaceName(const QByteArray &userId, bool shared);
+    static void    purgeStale();
+    static void    publishMetrics();
+
+    explicit ChunkStore(const QString &space);
+
+    QString path();
+    QString chunkPath(const QByteArray &hash);
+    bool    has(const QByteArray &hash, qint64 len);
+    bool    insert(const QString &tmpPath, const QByteArray &hash, qint64 len);
+    void    addUpload(qint64 logical, qint64 received);
+};
+
+#endif // CHUNK_STORE_H
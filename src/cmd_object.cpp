@@ -20,19 +20,78 @@ IPCWorker::IPCWorker(const QString &pipe, QObject *parent) : QObject(parent)
 {
     pipeName  = pipe;
     ipcSocket = new QLocalSocket(this);
+    sndBuf    = 0;
     flags     = 0;
 
+    backlog.storeRelaxed(0);
+
+    // big enough for the largest frame. anything past that is left in the
+    // pipe so a command that falls behind pushes back on the host instead
+    // of piling the input up in memory here.
+
+    ipcSocket->setReadBufferSize(LOCAL_BUFFSIZE + FRAME_HEADER_SIZE);
+
     connect(ipcSocket, &QLocalSocket::readyRead, this, &IPCWorker::rdFromIPC);
     connect(ipcSocket, &QLocalSocket::disconnected, this, &IPCWorker::ipcClosed);
-    connect(ipcSocket, &QLocalSocket::connected, this, &IPCWorker::ipcOpened);
+    connect(ipcSocket, &QLocalSocket::connected, this, &IPCWorker::onConnected);
+}
+
+void IPCWorker::onConnected()
+{
+#ifdef Q_OS_LINUX
+
+    socklen_t len = sizeof(sndBuf);
+
+    if (getsockopt(static_cast<int>(ipcSocket->socketDescriptor()), SOL_SOCKET, SO_SNDBUF, &sndBuf, &len) != 0)
+    {
+        sndBuf = 0;
+    }
+
+#endif
+
+    // an empty CREDIT tells the host this process spends output credit (see
+    // CmdObject::bufferOut()) so it should hand the spent credit back.
+
+    ipcSocket->write(wrInt(CREDIT, 8) + wrInt(0, MAX_FRAME_BITS));
+
+    emit ipcOpened();
+}
+
+int IPCWorker::sendWindow() const
+{
+    // size of the IPC socket's kernel send buffer or 0 if unknown. this is
+    // set before ipcOpened() so it is safe to read from the command thread
+    // from then on.
+
+    return sndBuf;
+}
+
+void IPCWorker::consumed(qint64 bytes)
+{
+    // called from the command thread once it is done with a frame. reading
+    // picks back up once the command catches up on what was handed over.
+
+    auto before = backlog.fetchAndAddOrdered(-bytes);
+
+    if ((before >= FLOW_INBOUND_MAX) && ((before - bytes) < FLOW_INBOUND_MAX))
+    {
+        QMetaObject::invokeMethod(this, "rdFromIPC", Qt::QueuedConnection);
+    }
 }
 
 void IPCWorker::rdFromIPC()
 {
+    if (backlog.loadAcquire() >= FLOW_INBOUND_MAX)
+    {
+        return;
+    }
+
     if (flags & FRAME_RDY)
     {
         if (ipcSocket->bytesAvailable() >= ipcDataSize)
         {
+            backlog.fetchAndAddOrdered(ipcDataSize);
+
             emit dataOut(ipcSocket->read(ipcDataSize), ipcTypeId);
 
             flags ^= FRAME_RDY;
@@ -52,11 +111,30 @@ void IPCWorker::rdFromIPC()
     }
 }
 
-void IPCWorker::dataIn(const QByteArray &data, quint8 typeId)
+void IPCWorker::dataIn(const QByteArray &frames)
+{
+    // frames are already formatted by CmdObject::bufferOut() and there can
+    // be any number of them back to back.
+
+    ipcSocket->write(frames);
+}
+
+void IPCWorker::flushIPC()
 {
-    // format: [typeId][payload_len][payload]
+    // blocks until everything written so far is out of the socket so the
+    // process can exit without losing it. see CmdObject::preProc().
 
-    ipcSocket->write(wrInt(typeId, 8) + wrInt(data.size(), MAX_FRAME_BITS) + data);
+    QElapsedTimer timer;
+
+    timer.start();
+
+    while ((ipcSocket->bytesToWrite() > 0) && (timer.elapsed() < IPC_FLUSH_MSEC))
+    {
+        if (!ipcSocket->waitForBytesWritten(static_cast<int>(IPC_FLUSH_MSEC - timer.elapsed())))
+        {
+            break;
+        }
+    }
 }
 
 void IPCWorker::connectIPC()
@@ -66,8 +144,14 @@ void IPCWorker::connectIPC()
 
 CmdObject::CmdObject(QObject *parent) : MemShare(parent)
 {
-    flags   = 0;
-    retCode = NO_ERRORS;
+    flags         = 0;
+    retCode       = NO_ERRORS;
+    stepMsec      = STEP_MSEC;
+    stepBytes     = STEP_BYTES;
+    stepBytesUsed = 0;
+    stepQueued    = false;
+    outType       = 0;
+    credit        = FLOW_WINDOW;
 
     auto args    = QCoreApplication::instance()->arguments();
     auto pipe    = getParam("-pipe_name", args);
@@ -77,8 +161,9 @@ CmdObject::CmdObject(QObject *parent) : MemShare(parent)
     if (attachSharedMem(sMemKey, hMemKey))
     {
         ipcWorker      = new IPCWorker(pipe, nullptr);
-        keepAliveTimer = new QTimer(this);
-        progTimer      = new QTimer(this);
+        keepAliveTimer = new WheelTimer(this);
+        progTimer      = new WheelTimer(this);
+        outTimer       = new QTimer(this);
         dProc          = new QProcess(this);
         progCurrent    = 0;
         progMax        = 0;
@@ -91,10 +176,13 @@ CmdObject::CmdObject(QObject *parent) : MemShare(parent)
         connect(thr, &QThread::started, ipcWorker, &IPCWorker::connectIPC);
 
         connect(this, &CmdObject::destroyed, thr, &QThread::deleteLater);
-        connect(this, &CmdObject::procOut, ipcWorker, &IPCWorker::dataIn);
+        connect(this, &CmdObject::procOut, this, &CmdObject::bufferOut);
+        connect(this, &CmdObject::ipcOut, ipcWorker, &IPCWorker::dataIn);
+        connect(outTimer, &QTimer::timeout, this, &CmdObject::flushOut);
 
-        connect(keepAliveTimer, &QTimer::timeout, this, &CmdObject::keepAlive);
-        connect(progTimer, &QTimer::timeout, this, &CmdObject::sendProg);
+        connect(this, &CmdObject::procOut, keepAliveTimer, &WheelTimer::touch);
+        connect(keepAliveTimer, &WheelTimer::timeout, this, &CmdObject::keepAlive);
+        connect(progTimer, &WheelTimer::timeout, this, &CmdObject::sendProg);
 
         connect(ipcWorker, &IPCWorker::dataOut, this, &CmdObject::preProc);
         connect(ipcWorker, &IPCWorker::termProc, this, &CmdObject::kill);
@@ -102,9 +190,11 @@ CmdObject::CmdObject(QObject *parent) : MemShare(parent)
         connect(ipcWorker, &IPCWorker::ipcOpened, this, &CmdObject::onIPCConnected);
 
         keepAliveTimer->setSingleShot(false);
-        keepAliveTimer->setInterval(30000); //30sec keep alive
+        keepAliveTimer->setInterval(30000); //30sec keep alive, pushed back by any output from the command
         progTimer->setSingleShot(false);
         progTimer->setInterval(1000); // 1sec progress updater
+        outTimer->setSingleShot(true);
+        outTimer->setInterval(OUT_FLUSH_MSEC);
         ipcWorker->moveToThread(thr);
         thr->start();
     }
@@ -134,10 +224,56 @@ void CmdObject::term()
 void CmdObject::kill()
 {
     term();
+    flushOut();
 
     QCoreApplication::instance()->exit();
 }
 
+QByteArray CmdObject::procUsage()
+{
+    // the host's QProcess reaps this process without keeping its rusage so
+    // the final numbers are reported from here as it exits. see
+    // ModProcess::recordUsage().
+
+    QByteArray ret;
+
+#ifdef Q_OS_LINUX
+
+    struct rusage ru;
+
+    quint64 cpuMsec = 0;
+    quint64 peakRss = 0;
+    quint64 rdBytes = 0;
+    quint64 wrBytes = 0;
+
+    if (getrusage(RUSAGE_SELF, &ru) == 0)
+    {
+        cpuMsec = (static_cast<quint64>(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000) +
+                  (static_cast<quint64>(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1000);
+        peakRss = static_cast<quint64>(ru.ru_maxrss);
+    }
+
+    QFile io("/proc/self/io");
+
+    if (io.open(QFile::ReadOnly))
+    {
+        for (auto&& line : io.readAll().split('\n'))
+        {
+            if      (line.startsWith("rchar:")) rdBytes = line.mid(6).trimmed().toULongLong();
+            else if (line.startsWith("wchar:")) wrBytes = line.mid(6).trimmed().toULongLong();
+        }
+    }
+
+    ret.append(wrInt(cpuMsec, 64));
+    ret.append(wrInt(peakRss, 64));
+    ret.append(wrInt(rdBytes, 64));
+    ret.append(wrInt(wrBytes, 64));
+
+#endif
+
+    return ret;
+}
+
 bool CmdObject::runDetachedProc(const QStringList &args)
 {
     auto ret = false;
@@ -164,12 +300,39 @@ bool CmdObject::runDetachedProc(const QStringList &args)
 
 void CmdObject::preProc(const QByteArray &data, quint8 typeId)
 {
-    if (typeId == TERM_CMD)
+    ipcWorker->consumed(data.size());
+
+    if (typeId == CREDIT)
+    {
+        credit += static_cast<qint64>(rdInt(data));
+
+        if (flags & LOOPING)
+        {
+            postProc();
+        }
+    }
+    else if (typeId == TERM_CMD)
     {
         term();
     }
     else if (typeId == KILL_CMD)
     {
+        auto usage = procUsage();
+
+        term();
+
+        if (!usage.isEmpty())
+        {
+            // the usage has to make it out before exit() or the host never
+            // sees it; the IPC thread writes it and waits for the socket to
+            // drain while this thread blocks.
+
+            async(ASYNC_PROC_USAGE, usage);
+            flushOut();
+
+            QMetaObject::invokeMethod(ipcWorker, "flushIPC", Qt::BlockingQueuedConnection);
+        }
+
         kill();
     }
     else if (typeId == YIELD_CMD)
@@ -178,6 +341,8 @@ void CmdObject::preProc(const QByteArray &data, quint8 typeId)
         {
             flags |=  YIELD_STATE;
             flags &= ~LOOPING;
+
+            postProc();
         }
     }
     else if (typeId == RESUME_CMD)
@@ -186,6 +351,8 @@ void CmdObject::preProc(const QByteArray &data, quint8 typeId)
         {
             flags |=  LOOPING;
             flags &= ~YIELD_STATE;
+
+            postProc();
         }
     }
     else
@@ -200,15 +367,99 @@ void CmdObject::preProc(const QByteArray &data, quint8 typeId)
     }
 }
 
+void CmdObject::setStepBudget(int msec, qint64 bytes)
+{
+    stepMsec  = msec;
+    stepBytes = bytes;
+}
+
+void CmdObject::stepIo(qint64 bytes)
+{
+    stepBytesUsed += bytes;
+}
+
+void CmdObject::holdInput(qint64 bytes)
+{
+    // input a command keeps queued past procIn() still counts toward the
+    // IPC worker's read limit so the worker stops reading, and the host
+    // pauses the client, once FLOW_INBOUND_MAX of it piles up. each held
+    // byte must be handed back with releaseInput() once it is used.
+
+    if (bytes != 0)
+    {
+        ipcWorker->consumed(-bytes);
+    }
+}
+
+void CmdObject::releaseInput(qint64 bytes)
+{
+    if (bytes != 0)
+    {
+        ipcWorker->consumed(bytes);
+    }
+}
+
+int CmdObject::ipcSendWindow()
+{
+    return ipcWorker->sendWindow();
+}
+
+void CmdObject::runSteps()
+{
+    // each pass of the event loop gets to run the command's loop body for as
+    // long as the step budget allows. anything that came in over the IPC in
+    // the mean time (YIELD_CMD, TERM_CMD, etc...) is handled before the next
+    // step so a yield or terminate takes effect right away.
+
+    stepQueued = false;
+
+    if (flags & LOOPING)
+    {
+        QElapsedTimer stepTime;
+
+        stepTime.start();
+
+        stepBytesUsed = 0;
+
+        do
+        {
+            sharedMem->lock();
+
+            procIn(QByteArray(), TEXT);
+
+            sharedMem->unlock();
+        }
+        while ((flags & LOOPING) && (credit > 0) && (stepTime.elapsed() < stepMsec) && (stepBytesUsed < stepBytes));
+
+        postProc();
+    }
+}
+
 void CmdObject::postProc()
 {
     if (flags & LOOPING)
     {
-        preProc(QByteArray(), TEXT);
+        // out of credit, the steps wait for the host to hand some back once
+        // the client has taken in enough of the output. see preProc().
+
+        if (!stepQueued && (credit > 0))
+        {
+            stepQueued = true;
+
+            QMetaObject::invokeMethod(this, "runSteps", Qt::QueuedConnection);
+        }
+
+        if (!keepAliveTimer->isActive())
+        {
+            keepAliveTimer->start();
+        }
     }
     else if (flags & (MORE_INPUT | YIELD_STATE))
     {
-        keepAliveTimer->start();
+        if (!keepAliveTimer->isActive())
+        {
+            keepAliveTimer->start();
+        }
     }
     else
     {
@@ -225,6 +476,116 @@ void CmdObject::postProc()
     }
 }
 
+void CmdObject::closeOutFrame()
+{
+    if (!outPayload.isEmpty())
+    {
+        // format: [typeId][payload_len][payload]
+
+        auto typeId = outType;
+
+        packOut(&outPayload, &typeId);
+
+        outFrames.append(wrInt(typeId, 8) + wrInt(outPayload.size(), MAX_FRAME_BITS) + outPayload);
+        outPayload.clear();
+    }
+}
+
+void CmdObject::bufferOut(const QByteArray &data, quint8 typeId)
+{
+    // TEXT and ERR output of the same type is merged into a single frame and
+    // FILE_INFO frames are held so they can be sent to the IPC thread
+    // together instead of one queued event and socket write per call. this
+    // only saves on the IPC side; FILE_INFO frames are not merged so the
+    // client still gets one frame per object, a client that wants fewer
+    // frames asks the command for INFO_BATCH instead.
+    // anything else (IDLE, prompts, GEN_FILE, etc...) flushes the buffer and
+    // goes out right away so the output order is kept. every payload byte
+    // spends a byte of credit; the host hands it back as its socket to the
+    // client drains.
+
+    credit -= data.size();
+
+    if (((typeId == TEXT) || (typeId == ERR)) && (typeId == outType) && ((outPayload.size() + data.size()) < (1 << MAX_FRAME_BITS)))
+    {
+        outPayload.append(data);
+    }
+    else
+    {
+        closeOutFrame();
+
+        outType = typeId;
+
+        if ((typeId == TEXT) || (typeId == ERR))
+        {
+            outPayload = data;
+        }
+        else if (typeId == FILE_INFO)
+        {
+            outFrames.append(wrInt(typeId, 8) + wrInt(data.size(), MAX_FRAME_BITS) + data);
+        }
+        else
+        {
+            // the header and payload are handed over separately so large
+            // payloads like GEN_FILE chunks are shared with the IPC thread
+            // instead of being copied into the buffer.
+
+            flushOut();
+
+            auto payload = data;
+            auto outId   = typeId;
+
+            packOut(&payload, &outId);
+
+            emit ipcOut(wrInt(outId, 8) + wrInt(payload.size(), MAX_FRAME_BITS));
+
+            if (!payload.isEmpty()) emit ipcOut(payload);
+        }
+    }
+
+    if ((typeId != TEXT) && (typeId != ERR) && (typeId != FILE_INFO))
+    {
+        flushOut();
+    }
+    else if ((outFrames.size() + outPayload.size()) >= OUT_BUFF_SIZE)
+    {
+        flushOut();
+    }
+    else if (!outTimer->isActive())
+    {
+        outTimer->start();
+    }
+}
+
+void CmdObject::packOut(QByteArray *data, quint8 *typeId)
+{
+    // output is compressed here in the command process instead of by the
+    // host so the session thread never spends time on it. the credit saved
+    // is given back so what was spent matches what the host counts.
+
+    if (rd8BitFromBlock(clientCaps) & CAP_COMPRESS)
+    {
+        auto len = data->size();
+
+        *data   = compressFrame(*data, typeId);
+        credit += len - data->size();
+    }
+}
+
+void CmdObject::flushOut()
+{
+    closeOutFrame();
+
+    outTimer->stop();
+
+    if (!outFrames.isEmpty())
+    {
+        emit ipcOut(outFrames);
+
+        outFrames.clear();
+    }
+}
+
 void CmdObject::mainTxt(const QString &txt)
 {
     emit procOut(txt.toUtf8(), TEXT);
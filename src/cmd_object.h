@@ -20,6 +20,20 @@
 #include "common.h"
 #include "db.h"
 
+#ifdef Q_OS_LINUX
+
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+#endif
+
+#define STEP_MSEC  50       // default time budget of a single LOOPING step.
+#define STEP_BYTES 33554432 // default io budget of a single LOOPING step (32MB).
+
+#define OUT_BUFF_SIZE  65536 // buffered output is sent to the host once it reaches this size.
+#define OUT_FLUSH_MSEC 10    // or once the oldest buffered output is this old.
+#define IPC_FLUSH_MSEC 1000  // longest a killed command waits for its last frames to reach the host.
+
 class IPCWorker : public QObject
 {
     Q_OBJECT
@@ -27,23 +41,30 @@ class IPCWorker : public QObject
 private slots:
 
     void rdFromIPC();
+    void onConnected();
 
 private:
 
-    QLocalSocket *ipcSocket;
-    quint32       flags;
-    quint8        ipcTypeId;
-    quint32       ipcDataSize;
-    QString       pipeName;
+    QLocalSocket          *ipcSocket;
+    QAtomicInteger<qint64> backlog;
+    int                    sndBuf;
+    quint32                flags;
+    quint8                 ipcTypeId;
+    quint32                ipcDataSize;
+    QString                pipeName;
 
 public slots:
 
-    void dataIn(const QByteArray &data, quint8 typeId);
+    void dataIn(const QByteArray &frames);
+    void flushIPC();
 
 public:
 
     explicit IPCWorker(const QString &pipe, QObject *parent = nullptr);
 
+    int  sendWindow() const;
+    void consumed(qint64 bytes);
+
 public slots:
 
     void connectIPC();
@@ -64,14 +85,23 @@ class CmdObject : public MemShare
 
 protected:
 
-    QTimer    *keepAliveTimer;
-    QTimer    *progTimer;
-    IPCWorker *ipcWorker;
-    QProcess  *dProc;
-    quint32    flags;
-    quint16    retCode;
-    qint64     progCurrent;
-    qint64     progMax;
+    WheelTimer *keepAliveTimer;
+    WheelTimer *progTimer;
+    QTimer     *outTimer;
+    IPCWorker  *ipcWorker;
+    QProcess   *dProc;
+    QByteArray  outFrames;
+    QByteArray  outPayload;
+    quint8      outType;
+    quint32     flags;
+    quint16     retCode;
+    qint64      progCurrent;
+    qint64      progMax;
+    qint64      stepBytes;
+    qint64      stepBytesUsed;
+    qint64      credit;
+    int         stepMsec;
+    bool        stepQueued;
 
     void    mainTxt(const QString &txt);
     void    errTxt(const QString &txt);
@@ -82,15 +112,27 @@ protected:
     void    startProgPulse();
     void    stopProgPulse();
     void    postProc();
+    void    closeOutFrame();
+    void    packOut(QByteArray *data, quint8 *typeId);
+    void    setStepBudget(int msec, qint64 bytes);
+    void    stepIo(qint64 bytes);
+    void    holdInput(qint64 bytes);
+    void    releaseInput(qint64 bytes);
+    int     ipcSendWindow();
     bool    runDetachedProc(const QStringList &args);
     QString libName();
 
+    QByteArray procUsage();
+
     virtual void procIn(const QByteArray &, quint8) {}
     virtual void onTerminate() {}
 
 protected slots:
 
     void preProc(const QByteArray &data, quint8 typeId);
+    void runSteps();
+    void bufferOut(const QByteArray &data, quint8 typeId);
+    void flushOut();
     void sendProg();
     void keepAlive();
     void term();
@@ -105,6 +147,7 @@ public:
 signals:
 
     void procOut(const QByteArray &data, quint8 typeId);
+    void ipcOut(const QByteArray &frames);
 };
 
 #endif // CMDOBJECT_H
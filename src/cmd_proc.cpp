@@ -16,20 +16,684 @@
 //    along with MRCI under the LICENSE.md file. If not, see
 //    <http://www.gnu.org/licenses/>.
 
+static QByteArray rdProcFile(const QString &path)
+{
+    QByteArray ret;
+
+    QFile file(path);
+
+    if (file.open(QFile::ReadOnly))
+    {
+        ret = file.readAll();
+    }
+
+    return ret;
+}
+
+static void applyProcLimits(const ProcLimits &lims)
+{
+    // this runs in the forked child right before exec so it sticks to plain
+    // system calls. failures are ignored; the command just runs without the
+    // limit the same as if it wasn't set in the conf.
+
+#ifdef Q_OS_LINUX
+
+    rlimit lim;
+
+    if (lims.cpuSecs != 0)
+    {
+        // the soft limit sends SIGXCPU; the hard limit a few seconds later
+        // sends SIGKILL if the command ignores it.
+
+        lim.rlim_cur = lims.cpuSecs;
+        lim.rlim_max = lims.cpuSecs + 5;
+
+        setrlimit(RLIMIT_CPU, &lim);
+    }
+
+    if (lims.memBytes != 0)
+    {
+        lim.rlim_cur = lims.memBytes;
+        lim.rlim_max = lims.memBytes;
+
+        setrlimit(RLIMIT_AS, &lim);
+    }
+
+    if (lims.openFiles != 0)
+    {
+        lim.rlim_cur = lims.openFiles;
+        lim.rlim_max = lims.openFiles;
+
+        setrlimit(RLIMIT_NOFILE, &lim);
+    }
+
+#else
+
+    Q_UNUSED(lims)
+
+#endif
+}
+
+CmdListing::CmdListing(QObject *parent) : QObject(parent) {}
+
+CmdListing *CmdListing::instance()
+{
+    static CmdListing inst;
+
+    return &inst;
+}
+
+QString CmdListing::listingKey(const QString &modApp, quint32 mode, const QString &modInst)
+{
+    // the module instructions from the client header get passed to the
+    // listing processes so they are part of the key in case a module
+    // lists different commands depending on them. the last modified times
+    // of the module binary and conf.json go last so a module that was
+    // rebuilt or a host config change misses the cache instead of serving
+    // the old listing forever; store() drops the listings they replace.
+
+    auto stamp = QString::number(QFileInfo(modApp).lastModified().toMSecsSinceEpoch()) + "-" +
+                 QString::number(QFileInfo(getLocalFilePath(CONF_FILENAME)).lastModified().toMSecsSinceEpoch());
+
+    return modApp + "|" + QString::number(mode) + "|" + modInst + "|" + stamp;
+}
+
+quint64 CmdListing::generation()
+{
+    QReadLocker locker(&lock);
+
+    return modGen;
+}
+
+bool CmdListing::claim(const QString &key)
+{
+    QWriteLocker locker(&lock);
+
+    auto ret = false;
+
+    if (!pending.contains(key) && !listings.contains(key))
+    {
+        pending.insert(key);
+
+        ret = true;
+    }
+
+    return ret;
+}
+
+QHash<QString, quint32> CmdListing::cmdRanks(const QString &modApp, QObject *dbParent)
+{
+    lock.lockForRead();
+
+    if (ranks.contains(modApp))
+    {
+        auto ret = ranks[modApp];
+
+        lock.unlock();
+
+        return ret;
+    }
+
+    auto gen = rankGen;
+
+    lock.unlock();
+
+    QHash<QString, quint32> ret;
+
+    Query db(dbParent);
+
+    db.setType(Query::PULL, TABLE_CMD_RANKS);
+    db.addColumn(COLUMN_HOST_RANK);
+    db.addColumn(COLUMN_COMMAND);
+    db.addCondition(COLUMN_MOD_MAIN, modApp);
+    db.exec();
+
+    for (int i = 0; i < db.rows(); ++i)
+    {
+        ret.insert(db.getData(COLUMN_COMMAND, i).toString(), db.getData(COLUMN_HOST_RANK, i).toUInt());
+    }
+
+    QWriteLocker locker(&lock);
+
+    if (gen == rankGen)
+    {
+        ranks.insert(modApp, ret);
+    }
+
+    return ret;
+}
+
+bool CmdListing::allowCmdLoad(const QString &modApp, const QString &cmdName, quint32 mode, quint32 rank, QObject *dbParent)
+{
+    bool ret = false;
+
+    if (validCommandName(cmdName))
+    {
+        if (mode & (LOADING_PUB_CMDS | LOADING_EXEMPT_CMDS))
+        {
+            ret = true;
+        }
+        else
+        {
+            auto modRanks = cmdRanks(modApp, dbParent);
+
+            if (!modRanks.contains(cmdName))
+            {
+                ret = (rank == 1);
+            }
+            else
+            {
+                ret = (modRanks[cmdName] >= rank);
+            }
+        }
+    }
+
+    return ret;
+}
+
+bool CmdListing::view(const QString &key, const QString &modApp, quint32 mode, quint32 rank, QList<ListedCmd> *out, QObject *dbParent)
+{
+    // the rank only matters for user command listings so the public and
+    // exempt listings share a single view for all ranks.
+
+    if (!(mode & LOADING_USER_CMDS)) rank = 0;
+
+    auto viewKey = key + "|" + QString::number(rank);
+
+    lock.lockForRead();
+
+    if (views.contains(viewKey))
+    {
+        *out = views[viewKey];
+
+        lock.unlock();
+
+        return true;
+    }
+    else if (!listings.contains(key))
+    {
+        lock.unlock();
+
+        return false;
+    }
+
+    auto frames = listings[key];
+    auto gen    = modGen + rankGen;
+
+    lock.unlock();
+
+    out->clear();
+
+    for (auto&& frame : frames)
+    {
+        ListedCmd cmd;
+
+        cmd.name    = QString::fromUtf8(frame.mid(3, 64)).trimmed().toLower();
+        cmd.frame   = frame;
+        cmd.allowed = allowCmdLoad(modApp, cmd.name, mode, rank, dbParent);
+
+        out->append(cmd);
+    }
+
+    QWriteLocker locker(&lock);
+
+    if (gen == (modGen + rankGen))
+    {
+        views.insert(viewKey, *out);
+    }
+
+    return true;
+}
+
+void CmdListing::store(const QString &key, const QList<QByteArray> &frames, quint64 gen)
+{
+    lock.lockForWrite();
+
+    auto stored = (gen == modGen);
+
+    if (stored)
+    {
+        // listings for the same module, mode and instructions with an older
+        // stamp (see listingKey()) can't be hit anymore.
+
+        auto base = key.left(key.lastIndexOf('|') + 1);
+
+        for (auto&& oldKey : listings.keys())
+        {
+            if (oldKey.startsWith(base) && (oldKey != key)) listings.remove(oldKey);
+        }
+
+        for (auto&& oldKey : views.keys())
+        {
+            if (oldKey.startsWith(base) && !oldKey.startsWith(key + "|")) views.remove(oldKey);
+        }
+
+        listings.insert(key, frames);
+    }
+
+    pending.remove(key);
+    lock.unlock();
+
+    if (stored) emit instance()->listingStored(key);
+    else        emit instance()->listingFailed(key);
+}
+
+void CmdListing::release(const QString &key)
+{
+    lock.lockForWrite();
+
+    auto claimed = pending.remove(key);
+
+    lock.unlock();
+
+    if (claimed)
+    {
+        emit instance()->listingFailed(key);
+    }
+}
+
+void CmdListing::ranksChanged()
+{
+    QWriteLocker locker(&lock);
+
+    rankGen++;
+
+    ranks.clear();
+    views.clear();
+}
+
+void CmdListing::modChanged(const QString &modApp)
+{
+    QWriteLocker locker(&lock);
+
+    auto prefix = modApp + "|";
+
+    modGen++;
+
+    for (auto&& key : listings.keys())
+    {
+        if (key.startsWith(prefix)) listings.remove(key);
+    }
+
+    for (auto&& key : views.keys())
+    {
+        if (key.startsWith(prefix)) views.remove(key);
+    }
+}
+
+QReadWriteLock                           CmdListing::lock;
+quint64                                  CmdListing::modGen  = 0;
+quint64                                  CmdListing::rankGen = 0;
+QHash<QString, QList<QByteArray> >       CmdListing::listings;
+QHash<QString, QHash<QString, quint32> > CmdListing::ranks;
+QHash<QString, QList<ListedCmd> >        CmdListing::views;
+QSet<QString>                            CmdListing::pending;
+
+CmdScheduler::CmdScheduler(QObject *parent) : QObject(parent) {}
+
+CmdScheduler *CmdScheduler::instance()
+{
+    static CmdScheduler inst;
+
+    return &inst;
+}
+
+void CmdScheduler::setLimit(quint32 max)
+{
+    QWriteLocker locker(&lock);
+
+    maxProcs = max;
+}
+
+bool CmdScheduler::acquire(quintptr ses)
+{
+    // new requests never jump ahead of sessions that are already waiting
+    // for a slot.
+
+    QWriteLocker locker(&lock);
+
+    auto     ret    = false;
+    quintptr target = 0;
+
+    if (waiting.isEmpty() && (running < maxProcs))
+    {
+        running++;
+
+        HostMetrics::set("cmd_sched.running", running);
+
+        ret = true;
+    }
+    else if (!waiting.contains(ses))
+    {
+        waiting.append(ses);
+
+        // warm processes that are sitting idle hold on to their slots, so
+        // the session holding the most of them is asked to give one up for
+        // each session that has to wait. see claimReclaim().
+
+        target = reclaimTarget();
+
+        if (target != 0) reclaims++;
+
+        HostMetrics::set("cmd_sched.waiting_sessions", waiting.size());
+    }
+
+    locker.unlock();
+
+    if (target != 0)
+    {
+        emit instance()->reclaimIdle(target);
+    }
+
+    return ret;
+}
+
+quintptr CmdScheduler::reclaimTarget()
+{
+    // the caller holds the write lock.
+
+    quintptr ret  = 0;
+    quint32  most = 0;
+
+    for (auto it = idleProcs.constBegin(); it != idleProcs.constEnd(); ++it)
+    {
+        if (it.value() > most)
+        {
+            ret  = it.key();
+            most = it.value();
+        }
+    }
+
+    return ret;
+}
+
+void CmdScheduler::reclaimMissed()
+{
+    // the session that was asked had its idle processes re-used or shut
+    // down in the meantime; its count is already down so another session
+    // is picked, if any still holds an idle process.
+
+    lock.lockForWrite();
+
+    quintptr target = 0;
+
+    if (reclaims > 0)
+    {
+        target = reclaimTarget();
+
+        if (target == 0) reclaims--;
+    }
+
+    lock.unlock();
+
+    if (target != 0)
+    {
+        emit instance()->reclaimIdle(target);
+    }
+}
+
+void CmdScheduler::idleChanged(quintptr ses, int delta)
+{
+    // idle warm command processes per session, kept up to date by
+    // CmdProcess::setIdle() and CmdProcess::evict().
+
+    QWriteLocker locker(&lock);
+
+    auto count = static_cast<qint64>(idleProcs.value(ses)) + delta;
+
+    if (count > 0) idleProcs.insert(ses, static_cast<quint32>(count));
+    else           idleProcs.remove(ses);
+}
+
+bool CmdScheduler::claimReclaim()
+{
+    // called by the session reclaimIdle() was sent to before it shuts down
+    // an idle process; only as many as were asked for get to go.
+
+    QWriteLocker locker(&lock);
+
+    auto ret = false;
+
+    if (reclaims > 0)
+    {
+        reclaims--;
+
+        ret = true;
+    }
+
+    return ret;
+}
+
+bool CmdScheduler::accept(quintptr ses)
+{
+    QWriteLocker locker(&lock);
+
+    auto ret = false;
+
+    if (granted.value(ses) != 0)
+    {
+        if (--granted[ses] == 0) granted.remove(ses);
+
+        ret = true;
+    }
+
+    return ret;
+}
+
+void CmdScheduler::release()
+{
+    lock.lockForWrite();
+
+    quintptr next = 0;
+
+    if (waiting.isEmpty() || (running > maxProcs))
+    {
+        // the slot is simply dropped if the limit was lowered below the
+        // amount of processes already running.
+
+        running--;
+    }
+    else
+    {
+        // the slot moves straight to the next session in line so the
+        // running count doesn't change.
+
+        next = waiting.takeFirst();
+
+        granted[next]++;
+
+        // the freed slot satisfies a pending reclaim just as well.
+
+        if (reclaims > 0) reclaims--;
+    }
+
+    HostMetrics::set("cmd_sched.running", running);
+    HostMetrics::set("cmd_sched.waiting_sessions", waiting.size());
+
+    lock.unlock();
+
+    if (next != 0)
+    {
+        emit instance()->slotGranted(next);
+    }
+}
+
+void CmdScheduler::leave(quintptr ses)
+{
+    lock.lockForWrite();
+
+    auto unused = granted.take(ses);
+
+    waiting.removeAll(ses);
+
+    reclaims = qMin(reclaims, static_cast<quint32>(waiting.size()));
+
+    HostMetrics::set("cmd_sched.waiting_sessions", waiting.size());
+
+    lock.unlock();
+
+    // slots that were granted to a session that ended before it could use
+    // them are passed on.
+
+    for (quint32 i = 0; i < unused; ++i)
+    {
+        release();
+    }
+}
+
+QReadWriteLock           CmdScheduler::lock;
+quint32                  CmdScheduler::maxProcs = DEFAULT_MAX_CMD_PROCS;
+quint32                  CmdScheduler::running  = 0;
+QList<quintptr>          CmdScheduler::waiting;
+QHash<quintptr, quint32> CmdScheduler::granted;
+QHash<quintptr, quint32> CmdScheduler::idleProcs;
+quint32                  CmdScheduler::reclaims = 0;
+
+RetentionManager::RetentionManager(QObject *parent) : QObject(parent)
+{
+    cutoff   = 1;
+    memTimer = new QTimer(this);
+
+    connect(memTimer, &QTimer::timeout, this, &RetentionManager::checkMem);
+}
+
+RetentionManager *RetentionManager::instance()
+{
+    static RetentionManager inst;
+
+    return &inst;
+}
+
+void RetentionManager::start(const QJsonObject &conf)
+{
+    lock.lockForWrite();
+
+    maxWarmMsec = static_cast<qint64>(conf[CONF_WARM_PROC_MAX_SECS].toInt(DEFAULT_WARM_MAX_SECS)) * 1000;
+    minMemPct   = static_cast<quint32>(conf[CONF_WARM_PROC_MIN_MEM].toInt(DEFAULT_WARM_MIN_MEM));
+
+    lock.unlock();
+
+#ifdef Q_OS_LINUX
+
+    memTimer->start(MEM_CHECK_MSEC);
+
+#endif
+}
+
+double RetentionManager::decayed(const Heat &entry, qint64 now)
+{
+    return entry.score * qPow(0.5, static_cast<double>(now - entry.stamp) / WARM_HALF_LIFE);
+}
+
+void RetentionManager::used(const QString &cmdName, bool warm)
+{
+    auto now = QDateTime::currentMSecsSinceEpoch();
+
+    lock.lockForWrite();
+
+    auto &entry = heat[cmdName];
+
+    entry.score = decayed(entry, now) + 1;
+    entry.stamp = now;
+
+    lock.unlock();
+
+    if (warm) HostMetrics::add("warm_procs.hits", 1);
+    else      HostMetrics::add("warm_procs.misses", 1);
+
+    auto hits  = HostMetrics::value("warm_procs.hits");
+    auto total = hits + HostMetrics::value("warm_procs.misses");
+
+    HostMetrics::set("warm_procs.hit_rate_pct", (hits * 100) / total);
+}
+
+double RetentionManager::cmdHeat(const QString &cmdName)
+{
+    QReadLocker locker(&lock);
+
+    return decayed(heat.value(cmdName, Heat{0, 0}), QDateTime::currentMSecsSinceEpoch());
+}
+
+int RetentionManager::idleMsec(const QString &cmdName)
+{
+    auto score = cmdHeat(cmdName);
+
+    QReadLocker locker(&lock);
+
+    qint64 ret = WARM_MIN_MSEC;
+
+    if (!pressure)
+    {
+        ret = qMin(WARM_MIN_MSEC + static_cast<qint64>(score * WARM_STEP_MSEC), qMax(maxWarmMsec, static_cast<qint64>(WARM_MIN_MSEC)));
+    }
+
+    return static_cast<int>(ret);
+}
+
+void RetentionManager::checkMem()
+{
+    quint64 total = 0;
+    quint64 avail = 0;
+
+    QFile file("/proc/meminfo");
+
+    if (file.open(QFile::ReadOnly))
+    {
+        for (auto&& line : file.readAll().split('\n'))
+        {
+            if      (line.startsWith("MemTotal:"))     total = line.mid(9).simplified().split(' ')[0].toULongLong();
+            else if (line.startsWith("MemAvailable:")) avail = line.mid(13).simplified().split(' ')[0].toULongLong();
+        }
+    }
+
+    if (total != 0)
+    {
+        auto pct = static_cast<quint32>((avail * 100) / total);
+
+        HostMetrics::set("warm_procs.mem_avail_pct", pct);
+
+        lock.lockForWrite();
+
+        pressure = (pct < minMemPct);
+
+        lock.unlock();
+
+        if (pct < minMemPct)
+        {
+            // each check that still finds the host under pressure raises the
+            // heat cutoff so hotter and hotter commands get reaped until
+            // enough memory is freed.
+
+            emit shrinkWarmSet(cutoff);
+
+            cutoff *= 2;
+        }
+        else
+        {
+            cutoff = 1;
+        }
+    }
+}
+
+QReadWriteLock                         RetentionManager::lock;
+QHash<QString, RetentionManager::Heat> RetentionManager::heat;
+qint64                                 RetentionManager::maxWarmMsec = DEFAULT_WARM_MAX_SECS * 1000;
+quint32                                RetentionManager::minMemPct   = DEFAULT_WARM_MIN_MEM;
+bool                                   RetentionManager::pressure    = false;
+
 ModProcess::ModProcess(const QString &app, const QString &memSes, const QString &memHos, const QString &pipe, QObject *parent) : QProcess(parent)
 {
     flags          = 0;
     ipcTypeId      = 0;
     ipcDataSize    = 0;
-    hostRank       = 0;
-    modCmdNames    = nullptr;
-    cmdUniqueNames = nullptr;
-    cmdRealNames   = nullptr;
-    cmdAppById     = nullptr;
-    cmdIds         = nullptr;
+    listingGen     = 0;
+    idled          = false;
+    usage          = ProcUsage();
+    recorded       = ProcUsage();
     ipcSocket      = nullptr;
     ipcServ        = new QLocalServer(this);
     idleTimer      = new IdleTimer(this);
+    usageTimer     = new QTimer(this);
     sesMemKey      = memSes;
     hostMemKey     = memHos;
     pipeName       = pipe;
@@ -42,7 +706,9 @@ ModProcess::ModProcess(const QString &app, const QString &memSes, const QString
     connect(this, SIGNAL(finished(int,QProcess::ExitStatus)), this, SLOT(onFinished(int,QProcess::ExitStatus)));
 
     connect(ipcServ, &QLocalServer::newConnection, this, &ModProcess::newIPCLink);
-    connect(idleTimer, &IdleTimer::timeout, this, &ModProcess::killProc);
+    connect(idleTimer, &IdleTimer::timeout, this, &ModProcess::idleTimeout);
+    connect(usageTimer, &QTimer::timeout, this, &ModProcess::sampleUsage);
+    connect(this, &QProcess::started, this, &ModProcess::sampleUsage);
 
     setProgram(app);
 }
@@ -66,126 +732,96 @@ void ModProcess::rdFromStdOut()
     emit dataToClient(toCmdId32(ASYNC_SYS_MSG, 0), readAllStandardOutput(), TEXT);
 }
 
-quint16 ModProcess::genCmdId()
+void ModProcess::sampleUsage()
 {
-    quint16 ret = 256;
+    // the process is already reaped by the time finished() is emitted so the
+    // usage is sampled from /proc while it runs, at every IDLE of a command
+    // and every USAGE_SAMPLE_MSEC in between for a process that crashes.
 
-    if (flags & SESSION_PARAMS_SET)
+#ifdef Q_OS_LINUX
+
+    if (processId() != 0)
     {
-        while(cmdIds->contains(ret)) ret++;
-    }
+        auto dir  = "/proc/" + QString::number(processId()) + "/";
+        auto stat = rdProcFile(dir + "stat");
+        auto pos  = stat.lastIndexOf(')');
 
-    return ret;
-}
+        if (pos != -1)
+        {
+            // fields after the command name start at field 3 (state) so
+            // utime (14) and stime (15) are at index 11 and 12.
 
-QString ModProcess::makeCmdUnique(const QString &name)
-{
-    QString strNum;
+            auto fields = stat.mid(pos + 2).split(' ');
 
-    auto names = cmdUniqueNames->values();
+            if (fields.size() > 12)
+            {
+                auto ticks = fields[11].toULongLong() + fields[12].toULongLong();
 
-    for (int i = 1; names.contains(name + strNum); ++i)
-    {
-        strNum = "_" + QString::number(i);
-    }
+                usage.cpuMsec = (ticks * 1000) / static_cast<quint64>(sysconf(_SC_CLK_TCK));
+            }
+        }
 
-    return QString(name + strNum).toLower();
-}
+        for (auto&& line : rdProcFile(dir + "status").split('\n'))
+        {
+            if (line.startsWith("VmHWM:"))
+            {
+                usage.peakRssKb = line.mid(6).simplified().split(' ')[0].toULongLong();
+            }
+        }
 
-bool ModProcess::isCmdLoaded(const QString &name)
-{
-    bool ret = false;
+        for (auto&& line : rdProcFile(dir + "io").split('\n'))
+        {
+            if      (line.startsWith("rchar:")) usage.rdBytes = line.mid(6).trimmed().toULongLong();
+            else if (line.startsWith("wchar:")) usage.wrBytes = line.mid(6).trimmed().toULongLong();
+        }
 
-    if (modCmdNames->contains(program()))
-    {
-        if (modCmdNames->value(program()).contains(name))
+        if (!usageTimer->isActive())
         {
-            ret = true;
+            usageTimer->start(USAGE_SAMPLE_MSEC);
         }
     }
 
-    return ret;
+#endif
 }
 
-bool ModProcess::allowCmdLoad(const QString &cmdName)
+static qint64 usageDelta(quint64 now, quint64 before)
 {
-    bool ret = false;
+    return (now > before) ? static_cast<qint64>(now - before) : 0;
+}
 
-    if (validCommandName(cmdName))
+void ModProcess::recordUsage(const QStringList &keys, bool run)
+{
+    // only what was used since the last call is added so a warm process that
+    // runs a command many times records each run on its own. run is false
+    // for the leftovers of a process that ends after its last run idled.
+
+    for (auto&& key : keys)
     {
-        if (flags & (LOADING_PUB_CMDS | LOADING_EXEMPT_CMDS))
-        {
-            ret = true;
-        }
-        else if (!cmdRanks.contains(cmdName))
-        {
-            ret = (hostRank == 1);
-        }
-        else
+        if (run)
         {
-            ret = (cmdRanks[cmdName] >= hostRank);
+            HostMetrics::add(key + ".runs", 1);
         }
+
+        HostMetrics::add(key + ".cpu_msec", usageDelta(usage.cpuMsec, recorded.cpuMsec));
+        HostMetrics::add(key + ".io_read_bytes", usageDelta(usage.rdBytes, recorded.rdBytes));
+        HostMetrics::add(key + ".io_write_bytes", usageDelta(usage.wrBytes, recorded.wrBytes));
+        HostMetrics::setMax(key + ".peak_rss_kb", static_cast<qint64>(usage.peakRssKb));
     }
 
-    return ret;
+    recorded = usage;
 }
 
 void ModProcess::onDataFromProc(quint8 typeId, const QByteArray &data)
 {
-    if ((typeId == NEW_CMD) && (flags & SESSION_PARAMS_SET))
+    if ((typeId == NEW_CMD) && (flags & (LOADING_PUB_CMDS | LOADING_EXEMPT_CMDS | LOADING_USER_CMDS)))
     {
         if (data.size() >= 131)
         {
             // a valid NEW_CMD must have a minimum of 131 bytes.
 
-            auto cmdName = QString::fromUtf8(data.mid(3, 64)).trimmed().toLower();
-
-             if (isCmdLoaded(cmdName))
-             {
-                 if (!allowCmdLoad(cmdName))
-                 {
-                     auto cmdId = cmdRealNames->key(cmdName);
-
-                     cmdIds->removeOne(cmdId);
-                     cmdRealNames->remove(cmdId);
-                     cmdUniqueNames->remove(cmdId);
-                     cmdAppById->remove(cmdId);
-
-                     if (modCmdNames->contains(program()))
-                     {
-                         modCmdNames->operator[](program()).removeOne(cmdName);
-                     }
-
-                     emit cmdUnloaded(cmdId);
-                     emit dataToClient(toCmdId32(ASYNC_RM_CMD, 0), wrInt(cmdId, 16), CMD_ID);
-                 }
-             }
-             else if (allowCmdLoad(cmdName))
-             {
-                 auto cmdId   = genCmdId();
-                 auto cmdIdBa = wrInt(cmdId, 16);
-                 auto unique  = makeCmdUnique(cmdName);
+            listing.append(data);
 
-                 cmdIds->append(cmdId);
-                 cmdRealNames->insert(cmdId, cmdName);
-                 cmdUniqueNames->insert(cmdId, unique);
-                 cmdAppById->insert(cmdId, program());
-
-                 if (modCmdNames->contains(program()))
-                 {
-                     modCmdNames->operator[](program()).append(cmdName);
-                 }
-                 else
-                 {
-                     auto list = QStringList() << cmdName;
-
-                     modCmdNames->insert(program(), list);
-                 }
-
-                 auto frame = cmdIdBa + data.mid(2, 1) + toFixedTEXT(unique, 64) + data.mid(67);
-
-                 emit dataToClient(toCmdId32(ASYNC_ADD_CMD, 0), frame, NEW_CMD);
-             }
+            emit newCmd(program(), flags & (LOADING_PUB_CMDS | LOADING_EXEMPT_CMDS | LOADING_USER_CMDS), data);
         }
     }
     else if (typeId == ERR)
@@ -246,37 +882,10 @@ void ModProcess::newIPCLink()
     }
 }
 
-void ModProcess::setSessionParams(QHash<quint16, QString> *uniqueNames,
-                                  QHash<quint16, QString> *realNames,
-                                  QHash<quint16, QString> *appById,
-                                  QHash<QString, QStringList> *namesForMod,
-                                  QList<quint16> *ids,
-                                  quint32 rnk)
-{
-    flags         |= SESSION_PARAMS_SET;
-    modCmdNames    = namesForMod;
-    cmdUniqueNames = uniqueNames;
-    cmdRealNames   = realNames;
-    cmdAppById     = appById;
-    cmdIds         = ids;
-    hostRank       = rnk;
-
-    Query db(this);
-
-    db.setType(Query::PULL, TABLE_CMD_RANKS);
-    db.addColumn(COLUMN_HOST_RANK);
-    db.addColumn(COLUMN_COMMAND);
-    db.addCondition(COLUMN_MOD_MAIN, program());
-    db.exec();
-
-    for (int i = 0; i < db.rows(); ++i)
-    {
-        cmdRanks.insert(db.getData(COLUMN_COMMAND, i).toString(), db.getData(COLUMN_HOST_RANK, i).toUInt());
-    }
-}
-
 void ModProcess::onFailToStart()
 {
+    CmdListing::release(listKey);
+
     emit modProcFinished();
 
     deleteLater();
@@ -335,25 +944,35 @@ void ModProcess::addArgs(const QString &cmdLine)
     additionalArgs = parseArgs(cmdLine.toUtf8(), -1);
 }
 
-bool ModProcess::loadPublicCmds()
+void ModProcess::setListingKey(const QString &key)
 {
-    flags |= LOADING_PUB_CMDS;
+    // the key the session claimed, kept as is since the stamp in it could
+    // change while the listing process runs.
 
-    return startProc(QStringList() << "-public_cmds");
+    listKey = key;
 }
 
-bool ModProcess::loadUserCmds()
+bool ModProcess::loadCmds(quint32 mode, const QString &arg)
 {
-    flags |= LOADING_USER_CMDS;
+    flags     |= mode;
+    listingGen = CmdListing::generation();
 
-    return startProc(QStringList() << "-user_cmds");
+    return startProc(QStringList() << arg);
 }
 
-bool ModProcess::loadExemptCmds()
+bool ModProcess::loadPublicCmds()
+{
+    return loadCmds(LOADING_PUB_CMDS, "-public_cmds");
+}
+
+bool ModProcess::loadUserCmds()
 {
-    flags |= LOADING_EXEMPT_CMDS;
+    return loadCmds(LOADING_USER_CMDS, "-user_cmds");
+}
 
-    return startProc(QStringList() << "-exempt_cmds");
+bool ModProcess::loadExemptCmds()
+{
+    return loadCmds(LOADING_EXEMPT_CMDS, "-exempt_cmds");
 }
 
 void ModProcess::cleanupPipe()
@@ -385,8 +1004,22 @@ void ModProcess::onReady()
 
 void ModProcess::onFinished(int exitCode, QProcess::ExitStatus exitStatus)
 {
-    Q_UNUSED(exitCode)
-    Q_UNUSED(exitStatus)
+    if (idled && (exitStatus == QProcess::NormalExit) && (exitCode == 0))
+    {
+        // the listing is only cached if the module went idle and then ended
+        // cleanly. a module that crashed or was killed early by the session
+        // could leave a partial command list behind for the other sessions.
+
+        CmdListing::store(listKey, listing, listingGen);
+    }
+    else
+    {
+        CmdListing::release(listKey);
+    }
+
+    usageTimer->stop();
+
+    recordUsage(QStringList() << "mod_list." + program(), true);
 
     emit modProcFinished();
 
@@ -402,6 +1035,15 @@ void ModProcess::wrIpcFrame(quint8 typeId, const QByteArray &data)
     }
 }
 
+void ModProcess::idleTimeout()
+{
+    idled = true;
+
+    sampleUsage();
+
+    killProc();
+}
+
 void ModProcess::killProc()
 {
     wrIpcFrame(KILL_CMD, QByteArray());
@@ -411,9 +1053,16 @@ void ModProcess::killProc()
 
 CmdProcess::CmdProcess(quint32 id, const QString &cmd, const QString &modApp, const QString &memSes, const QString &memHos, const QString &pipe, QObject *parent) : ModProcess(modApp, memSes, memHos, pipe, parent)
 {
-    cmdId   = id;
-    cmdName = cmd;
-    cmdIdle = false;
+    cmdId      = id;
+    cmdName    = cmd;
+    cmdIdle    = false;
+    limits     = ProcLimits();
+    owedCredit = 0;
+    freeCredit = 0;
+    creditMode = false;
+    evicting   = false;
+
+    connect(RetentionManager::instance(), &RetentionManager::shrinkWarmSet, this, &CmdProcess::shrinkWarm);
 }
 
 void CmdProcess::setSessionParams(QSharedMemory *mem, char *sesId, char *wrableSubChs, quint32 *hookCmd)
@@ -424,6 +1073,21 @@ void CmdProcess::setSessionParams(QSharedMemory *mem, char *sesId, char *wrableS
     openWritableSubChs = wrableSubChs;
 }
 
+void CmdProcess::setUsageParams(const QString &user, const ProcLimits &lims)
+{
+    userName = user;
+    limits   = lims;
+}
+
+#if QT_VERSION < QT_VERSION_CHECK(6, 0, 0)
+
+void CmdProcess::setupChildProcess()
+{
+    applyProcLimits(limits);
+}
+
+#endif
+
 void CmdProcess::killCmd16(quint16 id16)
 {
     if (toCmdId16(cmdId) == id16)
@@ -442,7 +1106,9 @@ void CmdProcess::killCmd32(quint32 id32)
 
 void CmdProcess::onReady()
 {
-    idleTimer->attach(ipcSocket, 120000); // 2min idle timeout
+    idleTimer->attach(ipcSocket, ACTIVE_IDLE_MSEC); // 2min idle timeout while the command is active
+
+    connect(ipcSocket, &QLocalSocket::bytesWritten, this, &CmdProcess::ipcBytesWritten);
 
     emit cmdProcReady(cmdId);
 }
@@ -460,6 +1126,13 @@ void CmdProcess::onFinished(int exitCode, QProcess::ExitStatus exitStatus)
     Q_UNUSED(exitCode)
     Q_UNUSED(exitStatus)
 
+    if (ipcSocket != nullptr)
+    {
+        // the ASYNC_PROC_USAGE sent on the way out can still be waiting.
+
+        rdFromIPC();
+    }
+
     if (!cmdIdle)
     {
         qCritical() << "Module: " + program() + "Command: '" + cmdName + "' has crashed or failed to return an IDLE frame when it terminated.";
@@ -467,6 +1140,14 @@ void CmdProcess::onFinished(int exitCode, QProcess::ExitStatus exitStatus)
         emit dataToClient(cmdId, "err: The command '" + cmdName.toUtf8() + "' has stopped unexpectedly.\n", ERR);
         emit dataToClient(cmdId, wrInt(CRASH, 16), IDLE);
     }
+    else if (!evicting)
+    {
+        CmdScheduler::idleChanged(reinterpret_cast<quintptr>(parent()), -1);
+    }
+
+    usageTimer->stop();
+
+    recordUsage(QStringList() << "cmd." + cmdName << HostMetrics::boundedKey("user", userName, USAGE_MAX_USERS), !cmdIdle);
 
     emit cmdProcFinished(cmdId);
 
@@ -474,6 +1155,63 @@ void CmdProcess::onFinished(int exitCode, QProcess::ExitStatus exitStatus)
     deleteLater();
 }
 
+void CmdProcess::shrinkWarm(double maxHeat)
+{
+    if (cmdIdle && (RetentionManager::cmdHeat(cmdName) <= maxHeat))
+    {
+        HostMetrics::add("warm_procs.reaped", 1);
+
+        killProc();
+    }
+}
+
+bool CmdProcess::evict()
+{
+    // an idle warm process is shut down to make room for a command that is
+    // waiting to start. it goes through the normal KILL_CMD path so the
+    // slot is released in the session's cmdProcFinished().
+
+    auto ret = false;
+
+    if (cmdIdle && !evicting)
+    {
+        evicting = true;
+
+        CmdScheduler::idleChanged(reinterpret_cast<quintptr>(parent()), -1);
+        HostMetrics::add("warm_procs.evicted", 1);
+
+        killProc();
+
+        ret = true;
+    }
+
+    return ret;
+}
+
+bool CmdProcess::isEvicting()
+{
+    return evicting;
+}
+
+bool CmdProcess::isIdle()
+{
+    return cmdIdle && !evicting;
+}
+
+void CmdProcess::setIdle(bool idle)
+{
+    // the scheduler counts the idle processes of each session so it knows
+    // which session to ask for a slot back. an evicting process was already
+    // taken off the count in evict().
+
+    if ((idle != cmdIdle) && !evicting)
+    {
+        CmdScheduler::idleChanged(reinterpret_cast<quintptr>(parent()), idle ? 1 : -1);
+    }
+
+    cmdIdle = idle;
+}
+
 void CmdProcess::rdFromStdOut()
 {
     emit dataToClient(cmdId, readAllStandardOutput(), TEXT);
@@ -488,12 +1226,60 @@ void CmdProcess::dataFromSession(quint32 id, const QByteArray &data, quint8 dTyp
 {
     if (id == cmdId)
     {
-        cmdIdle = false;
+        if (cmdIdle)
+        {
+            // the command is being re-used while still warm from a previous
+            // run.
+
+            RetentionManager::used(cmdName, true);
+
+            idleTimer->setInterval(ACTIVE_IDLE_MSEC);
+            usageTimer->start(USAGE_SAMPLE_MSEC);
+        }
+
+        setIdle(false);
 
         wrIpcFrame(dType, data);
     }
 }
 
+void CmdProcess::ipcBytesWritten()
+{
+    if ((ipcSocket != nullptr) && (ipcSocket->bytesToWrite() < (FLOW_INBOUND_MAX / 2)))
+    {
+        emit inboundDrained(cmdId);
+    }
+}
+
+qint64 CmdProcess::inboundBacklog()
+{
+    // client input written to the pipe that the command process hasn't
+    // picked up yet.
+
+    qint64 ret = 0;
+
+    if (ipcSocket != nullptr)
+    {
+        ret = ipcSocket->bytesToWrite();
+    }
+
+    return ret;
+}
+
+void CmdProcess::releaseCredit()
+{
+    // called by the session while its socket to the client is keeping up.
+    // credit spent on output that went to the client is only handed back
+    // from here so a slow client holds the command back.
+
+    if (creditMode && (owedCredit >= FLOW_RETURN_MIN))
+    {
+        wrIpcFrame(CREDIT, wrInt(owedCredit, 64));
+
+        owedCredit = 0;
+    }
+}
+
 bool CmdProcess::validAsync(quint16 async, const QByteArray &data, QTextStream &errMsg)
 {
     auto ret = true;
@@ -505,6 +1291,13 @@ bool CmdProcess::validAsync(quint16 async, const QByteArray &data, QTextStream &
             ret = false; errMsg << "the 256bit user id is not " << BLKSIZE_USER_ID << " bytes long.";
         }
     }
+    else if (async == ASYNC_PROC_USAGE)
+    {
+        if (data.size() != 32)
+        {
+            ret = false; errMsg << "the process usage is not 32 bytes long.";
+        }
+    }
     else if (async == ASYNC_USER_RENAMED)
     {
         if (data.size() != (BLKSIZE_USER_ID + BLKSIZE_USER_NAME))
@@ -547,6 +1340,11 @@ bool CmdProcess::validAsync(quint16 async, const QByteArray &data, QTextStream &
 
             ret = false; errMsg << "attempted to cast PING_PEERS which is forbidden for module commands.";
         }
+        else if ((rd8BitFromBlock(data.data() + (payloadOffs - 1)) & FRAME_COMPRESSED) &&
+                 !compressibleType(rd8BitFromBlock(data.data() + (payloadOffs - 1)) & ~FRAME_COMPRESSED))
+        {
+            ret = false; errMsg << "the compressed flag is set on a type id that can't be compressed.";
+        }
 
         sesMem->unlock();
     }
@@ -645,14 +1443,50 @@ void CmdProcess::asyncDirector(quint16 id, const QByteArray &payload)
              (id == ASYNC_INVITE_ACCEPTED) || (id == ASYNC_MEM_LEVEL_CHANGED) || (id == ASYNC_SUB_CH_LEVEL_CHG)  || (id == ASYNC_ADD_RDONLY)        ||
              (id == ASYNC_RM_RDONLY)       || (id == ASYNC_USER_RENAMED))
     {
+        // the host wide listing caches are invalidated here, once, before
+        // the change is broadcast to the sessions instead of by each session
+        // that receives it.
+
+        if (id == ASYNC_CMD_RANKS_CHANGED)
+        {
+            CmdListing::ranksChanged();
+        }
+        else if ((id == ASYNC_ENABLE_MOD) || (id == ASYNC_DISABLE_MOD))
+        {
+            CmdListing::modChanged(QString::fromUtf8(payload));
+        }
+
         emit pubIPCWithFeedBack(id, payload);
     }
 }
 
 void CmdProcess::onDataFromProc(quint8 typeId, const QByteArray &data)
 {
-    if (typeId == ASYNC_PAYLOAD)
+    if (typeId == CREDIT)
+    {
+        // the command process spends credit on its output and stops once it
+        // runs out; see CmdObject::bufferOut(). older modules never send
+        // this so they never get CREDIT frames they don't understand.
+
+        creditMode = true;
+    }
+    else if (typeId == ASYNC_PAYLOAD)
     {
+        if (creditMode)
+        {
+            // async payloads never reach the client's socket so the credit
+            // comes straight back, batched like the rest.
+
+            freeCredit += data.size();
+
+            if (freeCredit >= FLOW_RETURN_MIN)
+            {
+                wrIpcFrame(CREDIT, wrInt(freeCredit, 64));
+
+                freeCredit = 0;
+            }
+        }
+
         if (data.size() >= 2)
         {
             auto async = rd16BitFromBlock(data.data());
@@ -677,6 +1511,13 @@ void CmdProcess::onDataFromProc(quint8 typeId, const QByteArray &data)
                     {
                         *hook = 0;
                     }
+                    else if (async == ASYNC_PROC_USAGE)
+                    {
+                        usage.cpuMsec   = qMax(usage.cpuMsec, rdInt(payload.mid(0, 8)));
+                        usage.peakRssKb = qMax(usage.peakRssKb, rdInt(payload.mid(8, 8)));
+                        usage.rdBytes   = qMax(usage.rdBytes, rdInt(payload.mid(16, 8)));
+                        usage.wrBytes   = qMax(usage.wrBytes, rdInt(payload.mid(24, 8)));
+                    }
                     else
                     {
                         asyncDirector(async, payload);
@@ -691,9 +1532,22 @@ void CmdProcess::onDataFromProc(quint8 typeId, const QByteArray &data)
     }
     else
     {
+        if (creditMode)
+        {
+            owedCredit += data.size();
+        }
+
         if (typeId == IDLE)
         {
-            cmdIdle = true;
+            setIdle(true);
+
+            sampleUsage();
+
+            usageTimer->stop();
+
+            recordUsage(QStringList() << "cmd." + cmdName << HostMetrics::boundedKey("user", userName, USAGE_MAX_USERS), true);
+
+            idleTimer->start(RetentionManager::idleMsec(cmdName));
 
             if (*hook == cmdId)
             {
@@ -718,5 +1572,15 @@ void CmdProcess::onDataFromProc(quint8 typeId, const QByteArray &data)
 
 bool CmdProcess::startCmdProc()
 {
+#if QT_VERSION >= QT_VERSION_CHECK(6, 0, 0)
+
+    auto lims = limits;
+
+    setChildProcessModifier([lims]() {applyProcLimits(lims);});
+
+#endif
+
+    RetentionManager::used(cmdName, false);
+
     return startProc(QStringList() << "-run_cmd" << cmdName);
 }
@@ -20,22 +20,195 @@
 #include "common.h"
 #include "db.h"
 
+#ifdef Q_OS_LINUX
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#endif
+
+#define USAGE_SAMPLE_MSEC 2000
+#define USAGE_MAX_USERS   256 // user names that get their own usage counters, see HostMetrics::boundedKey().
+#define ACTIVE_IDLE_MSEC  120000
+#define WARM_MIN_MSEC     15000
+#define WARM_STEP_MSEC    30000
+#define WARM_HALF_LIFE    600000
+#define MEM_CHECK_MSEC    5000
+
+struct ProcLimits
+{
+    quint64 cpuSecs;   // RLIMIT_CPU, 0 means no limit.
+    quint64 memBytes;  // RLIMIT_AS, 0 means no limit.
+    quint64 openFiles; // RLIMIT_NOFILE, 0 means no limit.
+};
+
+struct ProcUsage
+{
+    quint64 cpuMsec;
+    quint64 peakRssKb;
+    quint64 rdBytes;
+    quint64 wrBytes;
+};
+
+struct ListedCmd
+{
+    QString    name;
+    QByteArray frame;
+    bool       allowed;
+};
+
+class CmdListing : public QObject
+{
+    Q_OBJECT
+
+    // host wide cache of the NEW_CMD frames each module returned in listing
+    // mode and the rank filtered views of those listings. sessions use this
+    // to load commands after a login, rank change or module change without
+    // starting a listing process per module per session. only one session
+    // runs the listing process for a key that is not cached yet; the rest
+    // wait for listingStored() or listingFailed().
+
+private:
+
+    static QReadWriteLock                           lock;
+    static quint64                                  modGen;
+    static quint64                                  rankGen;
+    static QHash<QString, QList<QByteArray> >       listings;
+    static QHash<QString, QHash<QString, quint32> > ranks;
+    static QHash<QString, QList<ListedCmd> >        views;
+    static QSet<QString>                            pending;
+
+    static QHash<QString, quint32> cmdRanks(const QString &modApp, QObject *dbParent);
+
+    explicit CmdListing(QObject *parent = nullptr);
+
+public:
+
+    static CmdListing *instance();
+    static QString     listingKey(const QString &modApp, quint32 mode, const QString &modInst);
+    static quint64     generation();
+    static bool        claim(const QString &key);
+    static bool        allowCmdLoad(const QString &modApp, const QString &cmdName, quint32 mode, quint32 rank, QObject *dbParent);
+    static bool        view(const QString &key, const QString &modApp, quint32 mode, quint32 rank, QList<ListedCmd> *out, QObject *dbParent);
+    static void        store(const QString &key, const QList<QByteArray> &frames, quint64 gen);
+    static void        release(const QString &key);
+    static void        ranksChanged();
+    static void        modChanged(const QString &modApp);
+
+signals:
+
+    void listingStored(const QString &key);
+    void listingFailed(const QString &key);
+};
+
+//----------------------------
+
+class CmdScheduler : public QObject
+{
+    Q_OBJECT
+
+    // host wide budget for running command processes. a session that can't
+    // get a slot right away is put in a round robin line and is handed the
+    // next freed slot via slotGranted() when it reaches the front, so one
+    // busy session can't starve the others.
+
+private:
+
+    static QReadWriteLock           lock;
+    static quint32                  maxProcs;
+    static quint32                  running;
+    static QList<quintptr>          waiting;
+    static QHash<quintptr, quint32> granted;
+    static QHash<quintptr, quint32> idleProcs;
+    static quint32                  reclaims;
+
+    static quintptr reclaimTarget();
+
+    explicit CmdScheduler(QObject *parent = nullptr);
+
+public:
+
+    static CmdScheduler *instance();
+    static void          setLimit(quint32 max);
+    static bool          acquire(quintptr ses);
+    static bool          accept(quintptr ses);
+    static void          release();
+    static void          leave(quintptr ses);
+    static bool          claimReclaim();
+    static void          reclaimMissed();
+    static void          idleChanged(quintptr ses, int delta);
+
+signals:
+
+    void slotGranted(quintptr ses);
+    void reclaimIdle(quintptr ses);
+};
+
+//----------------------------
+
+class RetentionManager : public QObject
+{
+    Q_OBJECT
+
+    // decides how long an idle command process is kept warm for reuse. each
+    // command name has a heat score that goes up by 1 every time it is run
+    // and halves every WARM_HALF_LIFE msec; hotter commands are kept warm
+    // longer. when available memory drops below the conf threshold, the warm
+    // set is shrunk host wide starting with the coldest commands.
+
+private:
+
+    struct Heat
+    {
+        double score;
+        qint64 stamp;
+    };
+
+    static QReadWriteLock       lock;
+    static QHash<QString, Heat> heat;
+    static qint64               maxWarmMsec;
+    static quint32              minMemPct;
+    static bool                 pressure;
+
+    QTimer *memTimer;
+    double  cutoff;
+
+    static double decayed(const Heat &entry, qint64 now);
+
+    explicit RetentionManager(QObject *parent = nullptr);
+
+private slots:
+
+    void checkMem();
+
+public:
+
+    static RetentionManager *instance();
+    static void              used(const QString &cmdName, bool warm);
+    static double            cmdHeat(const QString &cmdName);
+    static int               idleMsec(const QString &cmdName);
+
+    void start(const QJsonObject &conf);
+
+signals:
+
+    void shrinkWarmSet(double maxHeat);
+};
+
+//----------------------------
+
 class ModProcess : public QProcess
 {
     Q_OBJECT
 
 private:
 
-    QHash<QString, quint32>      cmdRanks;
-    QHash<QString, QStringList> *modCmdNames;
-    QHash<quint16, QString>     *cmdUniqueNames;
-    QHash<quint16, QString>     *cmdRealNames;
-    QHash<quint16, QString>     *cmdAppById;
-    QList<quint16>              *cmdIds;
+    QList<QByteArray> listing;
+    QString           listKey;
+    quint64           listingGen;
+    bool              idled;
 
-    quint16 genCmdId();
-    QString makeCmdUnique(const QString &name);
-    bool    allowCmdLoad(const QString &cmdName);
+    bool loadCmds(quint32 mode, const QString &arg);
 
 protected:
 
@@ -45,10 +218,12 @@ protected:
     QString       hostMemKey;
     quint8        ipcTypeId;
     quint32       ipcDataSize;
-    quint32       hostRank;
     quint32       flags;
+    ProcUsage     usage;
+    ProcUsage     recorded;
     QStringList   additionalArgs;
     IdleTimer    *idleTimer;
+    QTimer       *usageTimer;
     QLocalServer *ipcServ;
     QLocalSocket *ipcSocket;
 
@@ -57,10 +232,10 @@ protected:
     virtual void onDataFromProc(quint8 typeId, const QByteArray &data);
 
     void cleanupPipe();
+    void recordUsage(const QStringList &keys, bool run);
     void logErrMsgs(quint32 id);
     void wrIpcFrame(quint8 typeId, const QByteArray &data);
     bool startProc(const QStringList &args);
-    bool isCmdLoaded(const QString &name);
     bool openPipe();
 
 protected slots:
@@ -70,6 +245,8 @@ protected slots:
     virtual void rdFromStdOut();
 
     void rdFromIPC();
+    void sampleUsage();
+    void idleTimeout();
     void newIPCLink();
     void ipcDisconnected();
     void err(QProcess::ProcessError error);
@@ -79,12 +256,7 @@ public:
     explicit ModProcess(const QString &app, const QString &memSes, const QString &memHos, const QString &pipe, QObject *parent = nullptr);
 
     void addArgs(const QString &cmdLine);
-    void setSessionParams(QHash<quint16, QString> *uniqueNames,
-                          QHash<quint16, QString> *realNames,
-                          QHash<quint16, QString> *appById,
-                          QHash<QString, QStringList> *namesForMod,
-                          QList<quint16> *ids,
-                          quint32 rnk);
+    void setListingKey(const QString &key);
 
     bool loadPublicCmds();
     bool loadUserCmds();
@@ -97,7 +269,7 @@ public slots:
 signals:
 
     void modProcFinished();
-    void cmdUnloaded(quint16 cmdId);
+    void newCmd(const QString &modApp, quint32 mode, const QByteArray &data);
     void dataToClient(quint32 cmdId, const QByteArray &data, quint8 typeId);
 };
 
@@ -111,7 +283,13 @@ private:
 
     quint32        cmdId;
     QString        cmdName;
+    QString        userName;
+    ProcLimits     limits;
+    qint64         owedCredit;
+    qint64         freeCredit;
+    bool           creditMode;
     bool           cmdIdle;
+    bool           evicting;
     quint32       *hook;
     QSharedMemory *sesMem;
     char          *sessionId;
@@ -122,12 +300,21 @@ private:
     void asyncDirector(quint16 id, const QByteArray &payload);
     void onFinished(int exitCode, QProcess::ExitStatus exitStatus);
     void onDataFromProc(quint8 typeId, const QByteArray &data);
+    void setIdle(bool idle);
     bool validAsync(quint16 async, const QByteArray &data, QTextStream &errMsg);
 
+#if QT_VERSION < QT_VERSION_CHECK(6, 0, 0)
+
+    void setupChildProcess() override;
+
+#endif
+
 private slots:
 
     void rdFromStdOut();
     void rdFromStdErr();
+    void shrinkWarm(double maxHeat);
+    void ipcBytesWritten();
 
 public slots:
 
@@ -138,14 +325,21 @@ public:
 
     explicit CmdProcess(quint32 id, const QString &cmd, const QString &modApp, const QString &memSes, const QString &memHos, const QString &pipe, QObject *parent = nullptr);
 
-    void dataFromSession(quint32 id, const QByteArray &data, quint8 dType);
-    void setSessionParams(QSharedMemory *mem, char *sesId, char *wrableSubChs, quint32 *hookCmd);
-    bool startCmdProc();
+    void   dataFromSession(quint32 id, const QByteArray &data, quint8 dType);
+    void   setSessionParams(QSharedMemory *mem, char *sesId, char *wrableSubChs, quint32 *hookCmd);
+    void   setUsageParams(const QString &user, const ProcLimits &lims);
+    void   releaseCredit();
+    bool   startCmdProc();
+    bool   evict();
+    bool   isEvicting();
+    bool   isIdle();
+    qint64 inboundBacklog();
 
 signals:
 
     void cmdProcFinished(quint32 id);
     void cmdProcReady(quint32 id);
+    void inboundDrained(quint32 id);
     void pubIPC(quint16 cmdId, const QByteArray &data);
     void privIPC(quint16 cmdId, const QByteArray &data);
     void pubIPCWithFeedBack(quint16 cmdId, const QByteArray &data);
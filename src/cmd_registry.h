@@ -0,0 +1,199 @@
+#ifndef CMD_REGISTRY_H
+#define CMD_REGISTRY_H
+
+//    This file is part of MRCI.
+
+//    MRCI is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+
+//    MRCI is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+
+//    You should have received a copy of the GNU General Public License
+//    along with MRCI under the LICENSE.md file. If not, see
+//    <http://www.gnu.org/licenses/>.
+
+#include <QtGlobal>
+#include <QObject>
+
+#define CMD_HASH_SLOTS 1024
+#define CMD_HASH_EMPTY 0xFF
+
+class CmdObject;
+
+typedef CmdObject *(*CmdFactory)(QObject *parent);
+typedef QString    (*CmdNameFn)();
+
+enum CmdVisibility : quint8
+{
+    CMD_USER     = 1,
+    CMD_EXEMPT   = 1 << 1,
+    CMD_PUBLIC   = 1 << 2,
+    GATE_PUB_REG = 1 << 3, // public only if enable_public_reg is set in the conf.
+    GATE_PW_RES  = 1 << 4, // public only if enable_pw_reset is set in the conf.
+    GATE_EVERIFY = 1 << 5  // loaded at all only if enable_email_verify is set in the conf.
+};
+
+struct InternCmd
+{
+    const char *name;       // must match what the command's cmdName() returns, see Module::Module().
+    CmdFactory  factory;
+    CmdNameFn   cmdName;
+    quint8      visibility;
+    quint8      genType;
+};
+
+struct CmdDoc
+{
+    const char *name;
+    const char *shortTxt;
+    const char *ioTxt;
+    const char *longTxt;
+};
+
+template <typename T>
+CmdObject *makeCmd(QObject *parent)
+{
+    return new T(parent);
+}
+
+constexpr char cmdLower(char chr)
+{
+    return ((chr >= 'A') && (chr <= 'Z')) ? static_cast<char>(chr + ('a' - 'A')) : chr;
+}
+
+constexpr quint32 cmdHash(const char *str, int len, quint32 seed)
+{
+    // seeded FNV-1a over the lower case form of the command name so lookups
+    // stay case insensitive like the noCaseMatch() chain it replaces.
+
+    quint32 ret = 2166136261u ^ seed;
+
+    for (int i = 0; i < len; ++i)
+    {
+        ret ^= static_cast<quint8>(cmdLower(str[i]));
+        ret *= 16777619u;
+    }
+
+    return ret;
+}
+
+constexpr int cmdStrLen(const char *str)
+{
+    int ret = 0;
+
+    while (str[ret] != 0) ++ret;
+
+    return ret;
+}
+
+constexpr bool cmdStrEq(const char *strA, const char *strB)
+{
+    int i = 0;
+
+    for (; (strA[i] != 0) && (strB[i] != 0); ++i)
+    {
+        if (strA[i] != strB[i]) return false;
+    }
+
+    return strA[i] == strB[i];
+}
+
+constexpr int cmdStrCmp(const char *strA, const char *strB)
+{
+    int i = 0;
+
+    while ((strA[i] != 0) && (strA[i] == strB[i])) ++i;
+
+    return static_cast<quint8>(strA[i]) - static_cast<quint8>(strB[i]);
+}
+
+template <int N>
+constexpr const CmdDoc *findCmdDoc(const CmdDoc (&docs)[N], const char *name)
+{
+    // the generated doc index is sorted by name so a binary search is enough.
+
+    int low  = 0;
+    int high = N - 1;
+
+    while (low <= high)
+    {
+        auto mid = (low + high) / 2;
+        auto cmp = cmdStrCmp(name, docs[mid].name);
+
+        if      (cmp == 0) return &docs[mid];
+        else if (cmp < 0)  high = mid - 1;
+        else               low  = mid + 1;
+    }
+
+    return nullptr;
+}
+
+template <int N>
+constexpr bool uniqueCmdNames(const InternCmd (&table)[N])
+{
+    for (int i = 0; i < N; ++i)
+    {
+        for (int j = i + 1; j < N; ++j)
+        {
+            if (cmdStrEq(table[i].name, table[j].name)) return false;
+        }
+    }
+
+    return true;
+}
+
+template <int N>
+constexpr quint32 findCmdSeed(const InternCmd (&table)[N])
+{
+    // brute force search for a seed that maps every command name to its own slot.
+    // this only runs in the compiler; the table is small enough relative to
+    // CMD_HASH_SLOTS that a usable seed turns up within the first few tries.
+
+    for (quint32 seed = 0; ; ++seed)
+    {
+        bool used[CMD_HASH_SLOTS] = {};
+        bool ok                   = true;
+
+        for (int i = 0; ok && (i < N); ++i)
+        {
+            auto slot = cmdHash(table[i].name, cmdStrLen(table[i].name), seed) % CMD_HASH_SLOTS;
+
+            if (used[slot]) ok = false;
+            else            used[slot] = true;
+        }
+
+        if (ok) return seed;
+    }
+}
+
+struct CmdSlots
+{
+    quint8 index[CMD_HASH_SLOTS];
+};
+
+template <int N>
+constexpr CmdSlots buildCmdSlots(const InternCmd (&table)[N], quint32 seed)
+{
+    static_assert(N < CMD_HASH_EMPTY, "the command registry has outgrown the 8bit slot index.");
+
+    CmdSlots ret = {};
+
+    for (int i = 0; i < CMD_HASH_SLOTS; ++i)
+    {
+        ret.index[i] = CMD_HASH_EMPTY;
+    }
+
+    for (int i = 0; i < N; ++i)
+    {
+        ret.index[cmdHash(table[i].name, cmdStrLen(table[i].name), seed) % CMD_HASH_SLOTS] = static_cast<quint8>(i);
+    }
+
+    return ret;
+}
+
+#endif // CMD_REGISTRY_H
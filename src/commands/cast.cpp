@@ -73,7 +73,32 @@ int lowestAcessLevel(quint64 chId, quint8 subId)
 
 void Cast::procIn(const QByteArray &binIn, quint8 dType)
 {
-    async(ASYNC_CAST, rdFromBlock(openWritableSubChs, BLKSIZE_SUB_CHANNEL * MAX_OPEN_SUB_CHANNELS) + wrInt(dType, 8) + binIn);
+    // the cast is compressed once here (or by the client if it sent it that
+    // way) rather than by every session that receives it, but only if some
+    // other session on the host has a client that can take it that way.
+    // sessions with clients that can't take compressed frames expand it on
+    // their end.
+
+    auto typeId  = dType;
+    auto payload = binIn;
+
+    hostSharedMem->lock();
+
+    auto capable = rd32BitFromBlock(compressSes);
+
+    hostSharedMem->unlock();
+
+    if ((rd8BitFromBlock(clientCaps) & CAP_COMPRESS) && (capable > 0))
+    {
+        capable -= 1;
+    }
+
+    if (!(typeId & FRAME_COMPRESSED) && (capable > 0))
+    {
+        payload = compressFrame(binIn, &typeId);
+    }
+
+    async(ASYNC_CAST, rdFromBlock(openWritableSubChs, BLKSIZE_SUB_CHANNEL * MAX_OPEN_SUB_CHANNELS) + wrInt(typeId, 8) + payload);
 }
 
 void OpenSubChannel::procIn(const QByteArray &binIn, quint8 dType)
@@ -62,169 +62,1282 @@ void mkPathForFile(const QString &path)
     mkPath(QFileInfo(path).absolutePath());
 }
 
-DownloadFile::DownloadFile(QObject *parent) : CmdObject(parent) {file = new QFile(this); onTerminate();}
-UploadFile::UploadFile(QObject *parent)     : CmdObject(parent) {file = new QFile(this); onTerminate();}
-Delete::Delete(QObject *parent)             : CmdObject(parent) {}
-Copy::Copy(QObject *parent)                 : CmdObject(parent) {src = new QFile(this); dst = new QFile(this);}
-Move::Move(QObject *parent)                 : Copy(parent)      {}
-MakePath::MakePath(QObject *parent)         : CmdObject(parent) {}
-ListFiles::ListFiles(QObject *parent)       : CmdObject(parent) {}
-FileInfo::FileInfo(QObject *parent)         : CmdObject(parent) {}
-ChangeDir::ChangeDir(QObject *parent)       : CmdObject(parent) {}
-Tree::Tree(QObject *parent)                 : CmdObject(parent) {}
-
-QString DownloadFile::cmdName() {return "fs_download";}
-QString UploadFile::cmdName()   {return "fs_upload";}
-QString Delete::cmdName()       {return "fs_delete";}
-QString Copy::cmdName()         {return "fs_copy";}
-QString Move::cmdName()         {return "fs_move";}
-QString MakePath::cmdName()     {return "fs_mkpath";}
-QString ListFiles::cmdName()    {return "fs_list";}
-QString FileInfo::cmdName()     {return "fs_info";}
-QString ChangeDir::cmdName()    {return "fs_cd";}
-QString Tree::cmdName()         {return "fs_tree";}
+TransferManifest::TransferManifest(const QByteArray &owner, const QString &transferId)
+{
+    QCryptographicHash hasher(QCryptographicHash::Sha3_256);
+
+    hasher.addData(owner);
+    hasher.addData(transferId.toUtf8());
+
+    path = getLocalFilePath(QString(XFER_DIRNAME) + "/" + QString::fromLatin1(hasher.result().toHex()) + ".json", true);
+}
+
+bool TransferManifest::validId(const QString &transferId)
+{
+    return !transferId.isEmpty() && (transferId.size() <= XFER_ID_MAX_LEN);
+}
+
+QList<ByteRange> TransferManifest::merge(QList<ByteRange> ranges)
+{
+    QList<ByteRange> ret;
+
+    std::sort(ranges.begin(), ranges.end());
+
+    for (auto &&range : ranges)
+    {
+        if (range.first >= range.second)
+        {
+            continue;
+        }
+        else if (!ret.isEmpty() && (range.first <= ret.last().second))
+        {
+            ret.last().second = qMax(ret.last().second, range.second);
+        }
+        else
+        {
+            ret.append(range);
+        }
+    }
+
+    return ret;
+}
+
+QList<ByteRange> TransferManifest::gaps(const QList<ByteRange> &ranges, qint64 total)
+{
+    QList<ByteRange> ret;
+
+    qint64 pos = 0;
+
+    for (auto &&range : merge(ranges))
+    {
+        if (pos >= total) break;
+
+        if (range.first > pos)
+        {
+            ret.append(ByteRange(pos, qMin(range.first, total)));
+        }
+
+        pos = qMax(pos, range.second);
+    }
+
+    if (pos < total)
+    {
+        ret.append(ByteRange(pos, total));
+    }
+
+    return ret;
+}
+
+QList<ByteRange> TransferManifest::toRanges(const QJsonObject &obj)
+{
+    QList<ByteRange> ret;
+
+    for (auto &&val : obj.value("ranges").toArray())
+    {
+        auto pair = val.toArray();
+
+        ret.append(ByteRange(static_cast<qint64>(pair[0].toDouble()), static_cast<qint64>(pair[1].toDouble())));
+    }
+
+    return ret;
+}
+
+QJsonArray TransferManifest::toJson(const QList<ByteRange> &ranges)
+{
+    QJsonArray ret;
+
+    for (auto &&range : ranges)
+    {
+        ret.append(QJsonArray({static_cast<double>(range.first), static_cast<double>(range.second)}));
+    }
+
+    return ret;
+}
+
+QJsonObject TransferManifest::read()
+{
+    QFile file(path);
+
+    QJsonObject ret;
+
+    if (file.open(QFile::ReadOnly))
+    {
+        ret = QJsonDocument::fromJson(file.readAll()).object();
+    }
+
+    return ret;
+}
+
+bool TransferManifest::write(const QJsonObject &obj)
+{
+    // QSaveFile replaces the manifest with a rename so the getters can read
+    // it without taking the lock; they never see a half written file.
+
+    QSaveFile file(path);
+
+    auto ret = false;
+
+    if (file.open(QFile::WriteOnly))
+    {
+        file.write(QJsonDocument(obj).toJson(QJsonDocument::Compact));
+
+        ret = file.commit();
+    }
+
+    return ret;
+}
+
+void TransferManifest::purgeStale()
+{
+    // transfers that were never finished or cleaned up by the client would
+    // otherwise pile up forever.
+
+    auto limit = QDateTime::currentDateTime().addDays(-XFER_MAX_AGE_DAYS);
+
+    for (auto &&info : QDir(QFileInfo(path).path()).entryInfoList({"*.json"}, QDir::Files))
+    {
+        if (info.lastModified() < limit)
+        {
+            QFile::remove(info.filePath());
+        }
+    }
+}
+
+bool TransferManifest::exists()
+{
+    return QFile::exists(path);
+}
+
+bool TransferManifest::bind(const QString &remoteFile, const QString &direction, qint64 size)
+{
+    // ties the transfer id to a file and direction. re-using an id for
+    // something else, or downloading a file that changed size since the
+    // transfer started, starts the record over.
+
+    QLockFile lock(path + ".lock");
+
+    auto ret = false;
+
+    if (lock.tryLock(XFER_LOCK_MSEC))
+    {
+        purgeStale();
+
+        auto obj = read();
+
+        if ((obj.value("remote_file").toString() != remoteFile) ||
+            (obj.value("direction").toString() != direction)    ||
+            (static_cast<qint64>(obj.value("size").toDouble()) != size))
+        {
+            obj = QJsonObject();
+
+            obj.insert("remote_file", remoteFile);
+            obj.insert("direction", direction);
+            obj.insert("size", static_cast<double>(size));
+            obj.insert("ranges", QJsonArray());
+        }
+
+        ret = write(obj);
+    }
+
+    return ret;
+}
+
+bool TransferManifest::addRange(qint64 offs, qint64 len)
+{
+    QLockFile lock(path + ".lock");
+
+    auto ret = false;
+
+    if (lock.tryLock(XFER_LOCK_MSEC))
+    {
+        auto obj = read();
+
+        if (!obj.isEmpty())
+        {
+            obj.insert("ranges", toJson(merge(toRanges(obj) << ByteRange(offs, offs + len))));
+
+            ret = write(obj);
+        }
+    }
+
+    return ret;
+}
+
+bool TransferManifest::remove()
+{
+    QLockFile lock(path + ".lock");
+
+    return lock.tryLock(XFER_LOCK_MSEC) && QFile::remove(path);
+}
+
+QString TransferManifest::remoteFile()
+{
+    return read().value("remote_file").toString();
+}
+
+QString TransferManifest::direction()
+{
+    return read().value("direction").toString();
+}
+
+qint64 TransferManifest::size()
+{
+    return static_cast<qint64>(read().value("size").toDouble());
+}
+
+QList<ByteRange> TransferManifest::ranges()
+{
+    return toRanges(read());
+}
+
+DownloadFile::DownloadFile(QObject *parent)     : CmdObject(parent) {file = new QFile(this); reader = nullptr; walker = nullptr; archive = nullptr; hasher = nullptr; setStepBudget(STEP_MSEC, LOCAL_BUFFSIZE); onTerminate();}
+UploadFile::UploadFile(QObject *parent)         : CmdObject(parent) {file = new QFile(this); writer = nullptr; unpacker = nullptr; hasher = nullptr; manifest = nullptr; onTerminate();}
+TransferStatus::TransferStatus(QObject *parent) : CmdObject(parent) {}
+Delete::Delete(QObject *parent)                 : CmdObject(parent) {}
+Copy::Copy(QObject *parent)                     : CmdObject(parent) {src = new QFile(this); dst = new QFile(this); copier = nullptr; pool = nullptr;}
+Move::Move(QObject *parent)                     : Copy(parent)      {}
+MakePath::MakePath(QObject *parent)             : CmdObject(parent) {}
+ListFiles::ListFiles(QObject *parent)           : DirLister(parent) {}
+FileInfo::FileInfo(QObject *parent)             : CmdObject(parent) {file = new QFile(this); hasher = nullptr; onTerminate();}
+ChangeDir::ChangeDir(QObject *parent)           : CmdObject(parent) {}
+Tree::Tree(QObject *parent)                     : DirLister(parent) {setStepBudget(20, STEP_BYTES); recurse = true; walker = nullptr;}
+
+QString DownloadFile::cmdName()   {return "fs_download";}
+QString UploadFile::cmdName()     {return "fs_upload";}
+QString TransferStatus::cmdName() {return "fs_transfer";}
+QString Delete::cmdName()         {return "fs_delete";}
+QString Copy::cmdName()           {return "fs_copy";}
+QString Move::cmdName()           {return "fs_move";}
+QString MakePath::cmdName()       {return "fs_mkpath";}
+QString ListFiles::cmdName()      {return "fs_list";}
+QString FileInfo::cmdName()       {return "fs_info";}
+QString ChangeDir::cmdName()      {return "fs_cd";}
+QString Tree::cmdName()           {return "fs_tree";}
+
+ReadAhead::ReadAhead(const QString &path, qint64 offs, qint64 len, int chunk)
+{
+    remaining = len;
+    chunkSize = chunk;
+    stopping  = false;
+    failed    = false;
+
+    file.setFileName(path);
+
+    if (!file.open(QFile::ReadOnly) || !file.seek(offs))
+    {
+        errMsg = file.errorString();
+        failed = true;
+    }
+    else
+    {
+#ifdef Q_OS_LINUX
+
+        // the whole range is read front to back exactly once so the kernel
+        // can read ahead aggressively.
+
+        posix_fadvise(file.handle(), offs, len, POSIX_FADV_SEQUENTIAL);
+
+#endif
+    }
+
+    thr = QThread::create([this]() {run();});
+
+    thr->start();
+}
+
+ReadAhead::~ReadAhead()
+{
+    mutex.lock();
+
+    stopping = true;
+
+    chunkTaken.wakeAll();
+    mutex.unlock();
+
+    thr->wait();
+
+    delete thr;
+}
+
+void ReadAhead::run()
+{
+    QMutexLocker locker(&mutex);
+
+    while (!stopping && !failed && (remaining > 0))
+    {
+        while ((ready.size() >= DL_READ_AHEAD) && !stopping)
+        {
+            chunkTaken.wait(&mutex);
+        }
+
+        if (stopping) break;
+
+        QByteArray buff;
+
+        // a recycled buffer is only taken once the pool holds the last
+        // reference to it, filling one that is still shared would just
+        // detach it into a fresh allocation plus a copy.
+
+        for (int i = 0; i < pool.size(); ++i)
+        {
+            if (pool.at(i).isDetached())
+            {
+                buff = pool.takeAt(i); break;
+            }
+        }
+
+        auto len = static_cast<int>(qMin(static_cast<qint64>(chunkSize), remaining));
+
+        locker.unlock();
+
+        buff.resize(len);
+
+        auto got = file.read(buff.data(), len);
+
+        locker.relock();
+
+        if (got <= 0)
+        {
+            errMsg = (got == 0) ? QString("unexpected end of file") : file.errorString();
+            failed = true;
+        }
+        else
+        {
+            buff.resize(static_cast<int>(got));
+
+            remaining -= got;
+
+            ready.append(buff);
+        }
+
+        chunkReady.wakeAll();
+    }
+
+    file.close();
+}
+
+int ReadAhead::take(QByteArray *chunk, unsigned long waitMsec)
+{
+    // returns 1 if a chunk was taken, 0 if none is ready yet and -1 if the
+    // read failed.
+
+    QMutexLocker locker(&mutex);
+
+    if (ready.isEmpty() && !failed && (remaining > 0))
+    {
+        chunkReady.wait(&mutex, waitMsec);
+    }
+
+    auto ret = 0;
+
+    if (!ready.isEmpty())
+    {
+        *chunk = ready.takeFirst();
+        ret    = 1;
+
+        chunkTaken.wakeAll();
+    }
+    else if (failed)
+    {
+        ret = -1;
+    }
+
+    return ret;
+}
+
+void ReadAhead::recycle(const QByteArray &buff)
+{
+    // buffers still out with the IPC thread stay in the pool until run()
+    // finds them unshared. the oldest are let go first if it fills up, those
+    // are the ones most likely to be stuck in a slow socket.
+
+    QMutexLocker locker(&mutex);
+
+    if (pool.size() >= (DL_READ_AHEAD + 1))
+    {
+        pool.removeFirst();
+    }
+
+    pool.append(buff);
+}
+
+QString ReadAhead::errorString()
+{
+    QMutexLocker locker(&mutex);
+
+    return errMsg;
+}
 
 void DownloadFile::onTerminate()
 {
+    delete reader;
+    delete walker;
+    delete archive;
+    delete hasher;
+
+    reader  = nullptr;
+    walker  = nullptr;
+    archive = nullptr;
+    hasher  = nullptr;
+
     file->close();
+    cachedHash.clear();
+    hashAlgo.clear();
+    hashKey.clear();
 
     ssMode    = false;
     paramsSet = false;
     flags     = 0;
 }
 
-void DownloadFile::sendChunk()
+int DownloadFile::chunkLen(const QStringList &args)
+{
+    auto chunk = getParam("-chunk", args).toLongLong();
+
+    if (chunk <= 0)
+    {
+        // sized to what the IPC socket can take in one go so chunks
+        // move through to the host without sitting in big buffers.
+
+        chunk = static_cast<qint64>(ipcSendWindow()) * DL_WINDOW_CHUNKS;
+    }
+
+    return static_cast<int>(qBound(static_cast<qint64>(DL_MIN_CHUNK), chunk, static_cast<qint64>(LOCAL_BUFFSIZE)));
+}
+
+void DownloadFile::scanStep()
+{
+    WalkBatch entries;
+
+    if (walker->takeBatch(&entries, 5))
+    {
+        for (auto&& entry : entries)
+        {
+            archive->addEntry(QDir::cleanPath(QString::fromUtf8(entry)));
+        }
+    }
+    else if (walker->isDone())
+    {
+        // the whole tree has to be stat'ed before the archive size is known
+        // so the -len goes out only now. the client's reply to it starts
+        // the data flowing like any other download.
+
+        delete walker;
+
+        walker    = nullptr;
+        progMax   = archive->size();
+        paramsSet = true;
+        flags    &= ~LOOPING;
+
+        emit mainTxt("dl_dir:  " + dirPath + "\n");
+        emit mainTxt("entries: " + QString::number(archive->count()) + "\n");
+        emit mainTxt("bytes:   " + QString::number(progMax) + "\n");
+        emit procOut(QString("-len " + QString::number(progMax)).toUtf8(), GEN_FILE);
+
+        startProgPulse();
+    }
+}
+
+void DownloadFile::reportHash()
+{
+    auto digest = cachedHash;
+
+    if (hasher != nullptr)
+    {
+        digest = hasher->result();
+
+        HashCache::store(file->fileName(), hashAlgo, hashKey, digest);
+    }
+    else if (HashCache::key(file->fileName(), hashAlgo) != hashKey)
+    {
+        // the cached digest is of the file as it was when the download
+        // started.
+
+        retCode = EXECUTION_FAIL;
+
+        errTxt("err: The file changed while it was being downloaded.\n");
+    }
+
+    emit mainTxt(hashAlgo + ": " + QString::fromLatin1(digest.toHex()) + "\n");
+}
+
+void DownloadFile::sendChunk()
+{
+    QByteArray data;
+
+    auto got = 0;
+
+    if ((progCurrent < progMax) && (archive != nullptr))
+    {
+        // archives are put together on the command thread a chunk at a time
+        // straight from the files in the tree.
+
+        got = archive->read(&data, chunkSize) ? 1 : 0;
+    }
+    else if (progCurrent < progMax)
+    {
+        // single step mode has to answer each request with a chunk so it
+        // waits on the reader for as long as it takes.
+
+        got = reader->take(&data, ssMode ? ULONG_MAX : 5);
+    }
+
+    if (progCurrent >= progMax)
+    {
+        onTerminate();
+    }
+    else if (got < 0)
+    {
+        retCode = EXECUTION_FAIL;
+
+        errTxt("err: File IO failure: " + reader->errorString() + ".\n");
+        onTerminate();
+    }
+    else if ((got == 0) && (archive != nullptr))
+    {
+        retCode = EXECUTION_FAIL;
+
+        errTxt("err: The archive ended short of its expected size.\n");
+        onTerminate();
+    }
+    else if (got > 0)
+    {
+        progCurrent += data.size();
+
+        stepIo(data.size());
+
+        emit procOut(data, GEN_FILE);
+
+        if (hasher != nullptr)
+        {
+            hasher->addData(data);
+        }
+
+        if (reader != nullptr)
+        {
+            reader->recycle(data);
+        }
+
+        if ((progCurrent >= progMax) && !hashAlgo.isEmpty())
+        {
+            reportHash();
+        }
+
+        if ((progCurrent >= progMax) && (archive != nullptr) && !archive->skippedFiles().isEmpty())
+        {
+            // the archive still comes out whole; these just have zeros in
+            // place of whatever couldn't be read.
+
+            retCode = EXECUTION_FAIL;
+
+            errTxt("err: The following files could not be fully read and were zero filled in the archive:\n" + archive->skippedFiles().join("\n") + "\n");
+        }
+
+        if (progCurrent >= progMax)
+        {
+            onTerminate();
+        }
+    }
+}
+
+void DownloadFile::procIn(const QByteArray &binIn, quint8 dType)
+{
+    if (walker != nullptr)
+    {
+        scanStep();
+    }
+    else if ((dType == GEN_FILE) && binIn.isEmpty() && ssMode && paramsSet)
+    {
+        sendChunk();
+    }
+    else if (paramsSet)
+    {
+        flags |= LOOPING;
+
+        sendChunk();
+    }
+    else if (dType == GEN_FILE)
+    {
+        auto args   = parseArgs(binIn, 20);
+        auto path   = getParam("-remote_file", args);
+        auto offStr = getParam("-offset", args);
+        auto lenStr = getParam("-len", args);
+        auto tarDir = argExists("-archive", args);
+        auto hashAl = hashArg(args);
+
+        retCode = INVALID_PARAMS;
+
+        file->setFileName(path);
+
+        if (path.isEmpty())
+        {   
+            errTxt("err: -remote_file not found or is empty.\n");
+        }
+        else if (argExists("-transfer_id", args))
+        {
+            // the host only knows what it handed to the IPC, not what the
+            // client actually got, so downloads are tracked by the client.
+
+            errTxt("err: -transfer_id is only supported by fs_upload, the client keeps track of the ranges it received for downloads.\n");
+        }
+        else if (!hashAl.isEmpty() && (StreamHash::digest(hashAl) == nullptr))
+        {
+            errTxt("err: Unknown hash '" + hashAl + "', it can be one of: " + StreamHash::names().join(", ") + ".\n");
+        }
+        else if (!file->exists())
+        {
+            errTxt("err: File not found.\n");
+        }
+        else if (!offStr.isEmpty() && !isInt(offStr))
+        {
+            errTxt("err: Offset '" + offStr + "' is not a valid integer.\n");
+        }
+        else if (!lenStr.isEmpty() && !isInt(lenStr))
+        {
+            errTxt("err: Len '" + lenStr + "' is not a valid integer.\n");
+        }
+        else if (tarDir && argExists("-offset", args))
+        {
+            errTxt("err: -offset cannot be used with -archive.\n");
+        }
+        else if (tarDir && !QFileInfo(path).isDir())
+        {
+            errTxt("err: The remote file is not a directory.\n");
+        }
+        else if (tarDir && !QFileInfo(path).isReadable())
+        {
+            errTxt("err: Cannot read '" + path + "' permission denied.\n");
+        }
+        else if (tarDir)
+        {
+            // the tree is walked with the same threaded walker as fs_tree
+            // over the next few steps before anything is sent.
+
+            ssMode    = argExists("-single_step", args);
+            dirPath   = path;
+            hashAlgo  = hashAl;
+            chunkSize = chunkLen(args);
+            retCode   = NO_ERRORS;
+            archive   = new TarWriter(path);
+            walker    = new TreeWalker(QDir::cleanPath(path), WALK_THREADS, 0, false, false, false);
+            flags    |= MORE_INPUT | LOOPING;
+
+            if (!hashAlgo.isEmpty())
+            {
+                hasher = new StreamHash(hashAlgo);
+            }
+        }
+        else if (!QFileInfo(path).isFile())
+        {
+            errTxt("err: The remote file is not a file or does not exists.\n");
+        }
+        else if (offStr.toLongLong() > QFileInfo(path).size())
+        {
+            errTxt("err: Offset '" + offStr + "' is past the end of the file.\n");
+        }
+        else if (!file->open(QFile::ReadOnly))
+        {
+            retCode = EXECUTION_FAIL;
+
+            errTxt("err: Unable to open the remote file for reading. reason: " + file->errorString() + "\n");
+        }
+        else
+        {
+            progMax   = lenStr.toLongLong();
+            ssMode    = argExists("-single_step", args);
+            paramsSet = true;
+            retCode   = NO_ERRORS;
+            flags    |= MORE_INPUT;
+
+            if ((progMax == 0) || (progMax > file->size()))
+            {
+                progMax = file->size();
+            }
+
+            offs = offStr.toLongLong();
+
+            if ((offs + progMax) > file->size())
+            {
+                progMax = file->size() - offs;
+            }
+
+            file->close();
+
+            if (!hashAl.isEmpty())
+            {
+                // only a digest of the whole file can come from or go into the
+                // cache; a range is always hashed as it's sent.
+
+                hashAlgo = hashAl;
+
+                if ((offs == 0) && (progMax == file->size()))
+                {
+                    hashKey    = HashCache::key(path, hashAlgo);
+                    cachedHash = HashCache::find(hashKey);
+                }
+
+                if (cachedHash.isEmpty())
+                {
+                    hasher = new StreamHash(hashAlgo);
+                }
+            }
+
+            reader = new ReadAhead(path, offs, progMax, chunkLen(args));
+
+            emit mainTxt("dl_file: " + path + "\n");
+            emit mainTxt("bytes:   " + QString::number(progMax) + "\n");
+            emit procOut(QString("-len " + QString::number(progMax)).toUtf8(), GEN_FILE);
+
+            startProgPulse();
+        }
+    }
+}
+
+WriteBehind::WriteBehind(const QString &path, QFile::OpenModeFlag mode, qint64 offs, qint64 len, bool directIo)
+{
+    backlogBytes = 0;
+    startPos     = offs;
+    pos          = offs;
+    done         = 0;
+    reserved     = 0;
+    directBuff   = nullptr;
+    directFill   = 0;
+    fd           = -1;
+    direct       = false;
+    highWater    = false;
+    stopping     = false;
+    failed       = false;
+
+#ifdef Q_OS_LINUX
+
+    if (directIo && ((offs % UL_DIRECT_ALIGN) == 0))
+    {
+        auto oflags = O_WRONLY | O_CREAT | O_DIRECT;
+
+        if (mode == QFile::WriteOnly) oflags |= O_TRUNC;
+
+        fd = ::open(QFile::encodeName(path).constData(), oflags, 0666);
+
+        if ((fd != -1) && (posix_memalign(reinterpret_cast<void**>(&directBuff), UL_DIRECT_ALIGN, UL_DIRECT_BLOCK) == 0))
+        {
+            direct = true;
+        }
+        else if (fd != -1)
+        {
+            ::close(fd);
+
+            fd = -1;
+        }
+    }
+
+#else
+
+    Q_UNUSED(directIo)
+
+#endif
+
+    if (!direct)
+    {
+        file.setFileName(path);
+
+        // unbuffered so that what written() reports has actually been handed
+        // to the OS; the data already comes in large chunks anyway.
+
+        if (!file.open(mode | QFile::Unbuffered) || !file.seek(offs))
+        {
+            errMsg = file.errorString();
+            failed = true;
+        }
+    }
+
+#ifdef Q_OS_LINUX
+
+    if (!failed)
+    {
+        // reserving the range now lets the file system lay it out in as few
+        // extents as possible. the file size itself is left alone in case
+        // the upload doesn't finish. -len comes from the client so the
+        // reservation is capped and never takes more than half of the free
+        // space. not every file system supports this so errors are ignored.
+
+        auto handle = direct ? fd : file.handle();
+
+        struct statvfs vfs;
+
+        if (fstatvfs(handle, &vfs) == 0)
+        {
+            auto avail = static_cast<qint64>(vfs.f_bavail) * static_cast<qint64>(vfs.f_frsize);
+
+            reserved = qMax(static_cast<qint64>(0), qMin(len, qMin(static_cast<qint64>(UL_MAX_RESERVE), avail / 2)));
+        }
+
+        if ((reserved > 0) && (fallocate(handle, FALLOC_FL_KEEP_SIZE, offs, reserved) != 0))
+        {
+            reserved = 0;
+        }
+    }
+
+#else
+
+    Q_UNUSED(len)
+
+#endif
+
+    thr = QThread::create([this]() {run();});
+
+    thr->start();
+}
+
+WriteBehind::~WriteBehind()
+{
+    finish();
+
+    delete thr;
+}
+
+bool WriteBehind::isOpen()
+{
+    QMutexLocker locker(&mutex);
+
+    return !failed;
+}
+
+QString WriteBehind::errorString()
+{
+    QMutexLocker locker(&mutex);
+
+    return errMsg;
+}
+
+qint64 WriteBehind::backlog()
+{
+    QMutexLocker locker(&mutex);
+
+    return backlogBytes;
+}
+
+qint64 WriteBehind::written()
+{
+    // bytes from the start of the range that made it out to the file.
+
+    QMutexLocker locker(&mutex);
+
+    return done;
+}
+
+bool WriteBehind::push(const QByteArray &data)
+{
+    QMutexLocker locker(&mutex);
+
+    while ((backlogBytes >= UL_MAX_BACKLOG) && !failed)
+    {
+        dataTaken.wait(&mutex);
+    }
+
+    if (!failed)
+    {
+        pending.append(data);
+
+        backlogBytes += data.size();
+
+        if (backlogBytes >= UL_HIGH_WATER)
+        {
+            highWater = true;
+        }
+
+        dataReady.wakeOne();
+    }
+
+    return !failed;
+}
+
+bool WriteBehind::finish()
+{
+    // blocks until everything pushed so far is on disk (or failed to get
+    // there) and the file is closed.
+
+    mutex.lock();
+
+    stopping = true;
+
+    dataReady.wakeAll();
+    mutex.unlock();
+
+    thr->wait();
+
+    QMutexLocker locker(&mutex);
+
+    return !failed;
+}
+
+void WriteBehind::run()
+{
+    QMutexLocker locker(&mutex);
+
+    while (true)
+    {
+        while (pending.isEmpty() && !stopping)
+        {
+            dataReady.wait(&mutex);
+        }
+
+        if (pending.isEmpty())
+        {
+            break;
+        }
+
+        auto data = pending.takeFirst();
+
+        locker.unlock();
+
+        auto ok = failed || writeOut(data);
+
+        locker.relock();
+
+        backlogBytes -= data.size();
+
+        if (!ok)
+        {
+            failed = true;
+        }
+        else if (!failed)
+        {
+            done = direct ? (pos - startPos) : (done + data.size());
+        }
+
+        dataTaken.wakeAll();
+
+        if (highWater && (backlogBytes <= UL_LOW_WATER))
+        {
+            highWater = false;
+
+            emit backlogLow();
+        }
+    }
+
+    locker.unlock();
+
+    closeOut();
+}
+
+bool WriteBehind::writeOut(const QByteArray &data)
+{
+    auto ret = true;
+
+    if (direct)
+    {
+        // O_DIRECT needs aligned buffers, offsets and lengths so the data is
+        // staged into whole blocks first. whatever is left of the last block
+        // is written by closeOut().
+
+        auto offs = 0;
+
+        while (ret && (offs < data.size()))
+        {
+            auto len = qMin(UL_DIRECT_BLOCK - directFill, static_cast<int>(data.size()) - offs);
+
+            memcpy(directBuff + directFill, data.constData() + offs, static_cast<size_t>(len));
+
+            directFill += len;
+            offs       += len;
+
+            if (directFill == UL_DIRECT_BLOCK)
+            {
+                ret        = writeDirect(directBuff, UL_DIRECT_BLOCK);
+                directFill = 0;
+            }
+        }
+    }
+    else if (file.write(data) != data.size())
+    {
+        ret = false;
+
+        QMutexLocker locker(&mutex);
+
+        errMsg = file.errorString();
+    }
+
+    return ret;
+}
+
+bool WriteBehind::writeDirect(const char *data, int len)
+{
+    auto ret = true;
+
+#ifdef Q_OS_LINUX
+
+    auto done = 0;
+
+    while (ret && (done < len))
+    {
+        auto wr = pwrite(fd, data + done, static_cast<size_t>(len - done), pos);
+
+        if ((wr == -1) && (errno == EINVAL) && (fcntl(fd, F_GETFL) & O_DIRECT))
+        {
+            // the file system turned down the direct write so the rest of the
+            // upload just goes through the page cache.
+
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+        }
+        else if (wr == -1)
+        {
+            ret = false;
+
+            QMutexLocker locker(&mutex);
+
+            errMsg = QString::fromLocal8Bit(strerror(errno));
+        }
+        else
+        {
+            done += static_cast<int>(wr);
+            pos  += wr;
+        }
+    }
+
+#else
+
+    Q_UNUSED(data)
+    Q_UNUSED(len)
+
+#endif
+
+    return ret;
+}
+
+void WriteBehind::closeOut()
 {
-    auto data = file->read(LOCAL_BUFFSIZE);
+#ifdef Q_OS_LINUX
 
-    if (file->error() != QFile::NoError)
+    if (direct && (directFill > 0) && !failed)
     {
-        retCode = EXECUTION_FAIL;
+        // the tail isn't a whole block so it can't go out with O_DIRECT.
 
-        errTxt("err: File IO failure: " + file->errorString() + ".\n");
-        onTerminate();
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+
+        auto ok = writeDirect(directBuff, directFill);
+
+        QMutexLocker locker(&mutex);
+
+        if (ok) done   = pos - startPos;
+        else    failed = true;
     }
-    else
+
+    mutex.lock();
+
+    auto handle = direct ? fd : file.handle();
+    auto trim   = (handle != -1) && (reserved > done);
+
+    mutex.unlock();
+
+    if (trim)
     {
-        progCurrent += data.size();
+        // the upload stopped short of the reserved range. truncating to the
+        // size the file already has hands the blocks preallocated past the
+        // end back to the file system.
 
-        emit procOut(data, GEN_FILE);
+        struct stat st;
 
-        if ((progCurrent >= progMax) || file->atEnd())
-        {
-            onTerminate();
-        }
+        if (fstat(handle, &st) == 0) ftruncate(handle, st.st_size);
+    }
+
+    if (direct)
+    {
+        ::close(fd);
+        free(directBuff);
+
+        directBuff = nullptr;
+        directFill = 0;
+        fd         = -1;
     }
+
+#endif
+
+    file.close();
 }
 
-void DownloadFile::procIn(const QByteArray &binIn, quint8 dType)
+void UploadFile::onTerminate()
 {
-    if ((dType == GEN_FILE) && binIn.isEmpty() && ssMode && paramsSet)
+    if (writer != nullptr)
     {
-        sendChunk();
+        // whatever got written before a cancel or a dropped connection is
+        // still recorded so the client only has to send the rest.
+
+        writer->finish();
+
+        recordDone(writer->written());
     }
-    else if (paramsSet)
+
+    delete writer;
+    delete unpacker;
+    delete hasher;
+    delete manifest;
+
+    writer   = nullptr;
+    unpacker = nullptr;
+    hasher   = nullptr;
+    manifest = nullptr;
+
+    file->close();
+    hashAlgo.clear();
+
+    force       = false;
+    confirm     = false;
+    ssMode      = false;
+    direct      = false;
+    flowCtrl    = false;
+    paused      = false;
+    ackHeld     = false;
+    flags       = 0;
+    offs        = 0;
+    recorded    = 0;
+    progCurrent = 0;
+    mode        = QFile::OpenModeFlag();
+}
+
+void UploadFile::recordDone(qint64 bytes)
+{
+    if ((manifest != nullptr) && (bytes > recorded))
     {
-        flags |= LOOPING;
+        manifest->addRange(offs + recorded, bytes - recorded);
 
-        sendChunk();
+        recorded = bytes;
     }
-    else if (dType == GEN_FILE)
+}
+
+void UploadFile::reportHash()
+{
+    auto digest = hasher->result();
+
+    if ((unpacker == nullptr) && (manifest == nullptr) && (offs == 0) && (QFileInfo(file->fileName()).size() == progMax))
     {
-        auto args   = parseArgs(binIn, 11);
-        auto path   = getParam("-remote_file", args);
-        auto offStr = getParam("-offset", args);
-        auto lenStr = getParam("-len", args);
+        // the file is exactly what was hashed so the digest can go straight
+        // into the cache for later downloads and fs_info -hash.
 
-        retCode = INVALID_PARAMS;
+        HashCache::store(file->fileName(), hashAlgo, HashCache::key(file->fileName(), hashAlgo), digest);
+    }
 
-        file->setFileName(path);
+    emit mainTxt(hashAlgo + ": " + QString::fromLatin1(digest.toHex()) + "\n");
+}
 
-        if (path.isEmpty())
-        {   
-            errTxt("err: -remote_file not found or is empty.\n");
-        }
-        else if (!file->exists())
-        {
-            errTxt("err: File not found.\n");
-        }
-        else if (!offStr.isEmpty() && !isInt(offStr))
-        {
-            errTxt("err: Offset '" + offStr + "' is not a valid integer.\n");
-        }
-        else if (!lenStr.isEmpty() && !isInt(lenStr))
+void UploadFile::backlogLow()
+{
+    // the disk caught up with the upload so the client can carry on.
+
+    if (ackHeld)
+    {
+        ackHeld = false;
+
+        emit procOut(QByteArray(), GEN_FILE);
+    }
+
+    if (paused)
+    {
+        paused = false;
+
+        emit procOut(QByteArray("-resume"), GEN_FILE);
+    }
+}
+
+void UploadFile::wrToFile(const QByteArray &data)
+{
+    if (!writer->push(data))
+    {
+        retCode = EXECUTION_FAIL;
+
+        errTxt("err: File IO failure: " + writer->errorString() + ".\n");
+        onTerminate();
+    }
+    else
+    {
+        progCurrent += data.size();
+
+        if (hasher != nullptr)
         {
-            errTxt("err: Len '" + lenStr + "' is not a valid integer.\n");
+            hasher->addData(data);
         }
-        else if (!QFileInfo(path).isFile())
+
+        if ((manifest != nullptr) && ((writer->written() - recorded) >= XFER_SYNC_BYTES))
         {
-            errTxt("err: The remote file is not a file or does not exists.\n");
+            recordDone(writer->written());
         }
-        else if (!file->open(QFile::ReadOnly))
-        {
-            retCode = EXECUTION_FAIL;
 
-            errTxt("err: Unable to open the remote file for reading. reason: " + file->errorString() + "\n");
-        }
-        else
+        if (progCurrent >= progMax)
         {
-            progMax   = lenStr.toLongLong();
-            ssMode    = argExists("-single_step", args);
-            paramsSet = true;
-            retCode   = NO_ERRORS;
-            flags    |= MORE_INPUT;
+            if (!writer->finish())
+            {
+                retCode = EXECUTION_FAIL;
 
-            if ((progMax == 0) || (progMax > file->size()))
+                errTxt("err: File IO failure: " + writer->errorString() + ".\n");
+            }
+            else if (hasher != nullptr)
             {
-                progMax = file->size();
+                reportHash();
             }
 
-            file->seek(offStr.toLongLong());
+            onTerminate();
+        }
+        else if (writer->backlog() >= UL_HIGH_WATER)
+        {
+            // single step clients are simply not sent the go ahead for the
+            // next frame until backlogLow(). clients that support it are
+            // told to pause, the rest are held up by push() once the backlog
+            // reaches UL_MAX_BACKLOG.
 
-            emit mainTxt("dl_file: " + path + "\n");
-            emit mainTxt("bytes:   " + QString::number(progMax) + "\n");
-            emit procOut(QString("-len " + QString::number(progMax)).toUtf8(), GEN_FILE);
+            if (ssMode)
+            {
+                ackHeld = true;
+            }
+            else if (flowCtrl && !paused)
+            {
+                paused = true;
 
-            startProgPulse();
+                emit procOut(QByteArray("-pause"), GEN_FILE);
+            }
+        }
+        else if (ssMode)
+        {
+            emit procOut(QByteArray(), GEN_FILE);
         }
     }
 }
 
-void UploadFile::onTerminate()
+void UploadFile::unpack(const QByteArray &data)
 {
-    file->close();
-
-    force   = false;
-    confirm = false;
-    ssMode  = false;
-    flags   = 0;
-    offs    = 0;
-    mode    = QFile::OpenModeFlag();
-}
+    progCurrent += data.size();
 
-void UploadFile::wrToFile(const QByteArray &data)
-{
-    auto written = file->write(data);
+    if (hasher != nullptr)
+    {
+        hasher->addData(data);
+    }
 
-    if (written == -1)
+    if (!unpacker->write(data))
     {
         retCode = EXECUTION_FAIL;
 
-        errTxt("err: File IO failure: " + file->errorString() + ".\n");
+        errTxt("err: Unable to unpack the archive: " + unpacker->errorString() + ".\n");
         onTerminate();
     }
-    else
+    else if (progCurrent >= progMax)
     {
-        progCurrent += written;
-
-        if (progCurrent >= progMax)
+        if (!unpacker->isDone())
         {
-            onTerminate();
+            retCode = EXECUTION_FAIL;
+
+            errTxt("err: The archive was cut short, some of its entries may be missing.\n");
         }
-        else if (ssMode)
+
+        emit mainTxt("entries: " + QString::number(unpacker->count()) + "\n");
+
+        if (hasher != nullptr)
         {
-            emit procOut(QByteArray(), GEN_FILE);
+            reportHash();
         }
+
+        onTerminate();
+    }
+    else if (ssMode)
+    {
+        emit procOut(QByteArray(), GEN_FILE);
     }
 }
 
@@ -237,9 +1350,33 @@ void UploadFile::ask()
 
 void UploadFile::run()
 {
-    if (file->open(mode))
+    if (!hashAlgo.isEmpty())
+    {
+        hasher = new StreamHash(hashAlgo);
+    }
+
+    if (unpacker != nullptr)
+    {
+        if (unpacker->errorString().isEmpty())
+        {
+            emit procOut(QByteArray(), GEN_FILE);
+        }
+        else
+        {
+            retCode = EXECUTION_FAIL;
+
+            errTxt("err: Unable to unpack the archive: " + unpacker->errorString() + ".\n");
+            onTerminate();
+        }
+
+        return;
+    }
+
+    writer = new WriteBehind(file->fileName(), mode, offs, progMax, direct);
+
+    if (writer->isOpen())
     {
-        file->seek(offs);
+        connect(writer, &WriteBehind::backlogLow, this, &UploadFile::backlogLow);
 
         emit procOut(QByteArray(), GEN_FILE);
     }
@@ -247,7 +1384,7 @@ void UploadFile::run()
     {
         retCode = EXECUTION_FAIL;
 
-        errTxt("err: Unable to open the remote file for writing. reason: " + file->errorString() + "\n");
+        errTxt("err: Unable to open the remote file for writing. reason: " + writer->errorString() + "\n");
         onTerminate();
     }
 }
@@ -275,67 +1412,215 @@ void UploadFile::procIn(const QByteArray &binIn, quint8 dType)
             ask();
         }
     }
-    else if ((dType == GEN_FILE) && (flags & MORE_INPUT))
-    {
-        wrToFile(binIn);
-    }
-    else if (dType == GEN_FILE)
+    else if ((dType == GEN_FILE) && (flags & MORE_INPUT) && (unpacker != nullptr))
+    {
+        unpack(binIn);
+    }
+    else if ((dType == GEN_FILE) && (flags & MORE_INPUT))
+    {
+        wrToFile(binIn);
+    }
+    else if (dType == GEN_FILE)
+    {
+        auto args   = parseArgs(binIn, 20);
+        auto lenStr = getParam("-len", args);
+        auto offStr = getParam("-offset", args);
+        auto dst    = getParam("-remote_file", args);
+        auto xferId = getParam("-transfer_id", args);
+        auto tarDir = argExists("-archive", args);
+        auto hashAl = hashArg(args);
+
+        retCode = INVALID_PARAMS;
+
+        if (dst.isEmpty())
+        {
+            errTxt("err: The remote file path argument (-remote_file) was not found or is empty.\n");
+        }
+        else if (lenStr.isEmpty())
+        {
+            errTxt("err: The data len argument (-len) was not found or is empty.\n");
+        }
+        else if (!offStr.isEmpty() && !isInt(offStr))
+        {
+            errTxt("err: Offset '" + offStr + "' is not a valid integer.\n");
+        }
+        else if (!isInt(lenStr))
+        {
+            errTxt("err: Len '" + lenStr + "' is not valid integer.\n");
+        }
+        else if (argExists("-transfer_id", args) && !TransferManifest::validId(xferId))
+        {
+            errTxt("err: The transfer id (-transfer_id) is empty or longer than " + QString::number(XFER_ID_MAX_LEN) + " chars.\n");
+        }
+        else if (!hashAl.isEmpty() && (StreamHash::digest(hashAl) == nullptr))
+        {
+            errTxt("err: Unknown hash '" + hashAl + "', it can be one of: " + StreamHash::names().join(", ") + ".\n");
+        }
+        else if (tarDir && (argExists("-offset", args) || argExists("-transfer_id", args)))
+        {
+            errTxt("err: -offset and -transfer_id cannot be used with -archive.\n");
+        }
+        else if (tarDir && QFileInfo(dst).exists() && !QFileInfo(dst).isDir())
+        {
+            errTxt("err: The remote file exists and is not a directory.\n");
+        }
+        else if (tarDir)
+        {
+            // the archive is unpacked into the -remote_file directory as it
+            // comes in, same as 'tar -x -C <remote_file>'.
+
+            auto exists = QFileInfo(dst).exists();
+
+            force    = argExists("-force", args);
+            ssMode   = argExists("-single_step", args);
+            progMax  = lenStr.toLongLong();
+            hashAlgo = hashAl;
+            retCode  = NO_ERRORS;
+            unpacker = new TarReader(dst);
+            flags   |= MORE_INPUT;
+
+            file->setFileName(dst);
+
+            emit mainTxt("ul_dir:  " + dst + "\n");
+            emit mainTxt("bytes:   " + QString::number(progMax) + "\n");
+
+            if (exists && !force)
+            {
+                ask();
+            }
+            else
+            {
+                run();
+            }
+        }
+        else
+        {
+            if (argExists("-truncate", args))
+            {
+                mode = QFile::WriteOnly;
+            }
+            else
+            {
+                mode = QFile::ReadWrite;
+            }
+
+            force    = argExists("-force", args);
+            ssMode   = argExists("-single_step", args);
+            direct   = argExists("-direct", args);
+            flowCtrl = argExists("-flow_ctrl", args);
+            progMax  = lenStr.toLongLong();
+            offs     = offStr.toLongLong();
+            hashAlgo = hashAl;
+            retCode  = NO_ERRORS;
+            flags   |= MORE_INPUT;
+
+            file->setFileName(dst);
+
+            if (!xferId.isEmpty())
+            {
+                // the other ranges of the same transfer are allowed to land
+                // in the file without asking about overwriting it each time
+                // and without truncating what the earlier ranges wrote.
+
+                auto absPath = QFileInfo(dst).absoluteFilePath();
+
+                manifest = new TransferManifest(rdFromBlock(userId, BLKSIZE_USER_ID), xferId);
+
+                if (manifest->exists() && (manifest->remoteFile() == absPath) && (manifest->direction() == "upload"))
+                {
+                    force = true;
+                    mode  = QFile::ReadWrite;
+                }
+
+                if (!manifest->bind(absPath, "upload", 0))
+                {
+                    errTxt("err: Unable to update the transfer manifest, this transfer will not be recorded.\n");
+
+                    delete manifest;
+
+                    manifest = nullptr;
+                }
+            }
+
+            emit mainTxt("ul_file: " + dst + "\n");
+            emit mainTxt("bytes:   " + QString::number(progMax) + "\n");
+            emit procOut(QByteArray(), GEN_FILE);
+
+            if (QFileInfo(dst).exists() && !force)
+            {
+                ask();
+            }
+            else
+            {
+                run();
+            }
+        }
+    }
+}
+
+void TransferStatus::procIn(const QByteArray &binIn, quint8 dType)
+{
+    if (dType == TEXT)
     {
-        auto args   = parseArgs(binIn, 11);
+        auto args   = parseArgs(binIn, 5);
+        auto xferId = getParam("-transfer_id", args);
         auto lenStr = getParam("-len", args);
-        auto offStr = getParam("-offset", args);
-        auto dst    = getParam("-remote_file", args);
+
+        TransferManifest manifest(rdFromBlock(userId, BLKSIZE_USER_ID), xferId);
 
         retCode = INVALID_PARAMS;
 
-        if (dst.isEmpty())
+        if (!TransferManifest::validId(xferId))
         {
-            errTxt("err: The remote file path argument (-remote_file) was not found or is empty.\n");
+            errTxt("err: The transfer id (-transfer_id) was not found, is empty or longer than " + QString::number(XFER_ID_MAX_LEN) + " chars.\n");
         }
-        else if (lenStr.isEmpty())
+        else if (!lenStr.isEmpty() && !isInt(lenStr))
         {
-            errTxt("err: The data len argument (-len) was not found or is empty.\n");
+            errTxt("err: Len '" + lenStr + "' is not a valid integer.\n");
         }
-        else if (!offStr.isEmpty() && !isInt(offStr))
+        else if (!manifest.exists())
         {
-            errTxt("err: Offset '" + offStr + "' is not a valid integer.\n");
+            errTxt("err: No transfer with that id was found.\n");
         }
-        else if (!isInt(lenStr))
+        else if (argExists("-remove", args))
         {
-            errTxt("err: Len '" + lenStr + "' is not valid integer.\n");
+            retCode = NO_ERRORS;
+
+            if (!manifest.remove())
+            {
+                retCode = EXECUTION_FAIL;
+
+                errTxt("err: Unable to remove the transfer manifest.\n");
+            }
         }
         else
         {
-            if (argExists("-truncate", args))
-            {
-                mode = QFile::WriteOnly;
-            }
-            else
-            {
-                mode = QFile::ReadWrite;
-            }
+            QString     txt;
+            QTextStream txtOut(&txt);
 
-            force   = argExists("-force", args);
-            ssMode  = argExists("-single_step", args);
-            progMax = lenStr.toLongLong();
-            offs    = offStr.toLongLong();
-            retCode = NO_ERRORS;
-            flags  |= MORE_INPUT;
+            auto total = lenStr.isEmpty() ? manifest.size() : lenStr.toLongLong();
+            auto done  = manifest.ranges();
 
-            file->setFileName(dst);
+            retCode = NO_ERRORS;
 
-            emit mainTxt("ul_file: " + dst + "\n");
-            emit mainTxt("bytes:   " + QString::number(progMax) + "\n");
-            emit procOut(QByteArray(), GEN_FILE);
+            txtOut << "remote_file: " << manifest.remoteFile() << Qt::endl;
+            txtOut << "direction:   " << manifest.direction()  << Qt::endl;
+            txtOut << "bytes:       " << QString::number(total) << Qt::endl << Qt::endl;
 
-            if (QFileInfo(dst).exists() && !force)
+            for (auto &&range : done)
             {
-                ask();
+                txtOut << "done:    -offset " << QString::number(range.first) << " -len " << QString::number(range.second - range.first) << Qt::endl;
             }
-            else
+
+            if (total > 0)
             {
-                run();
+                for (auto &&range : TransferManifest::gaps(done, total))
+                {
+                    txtOut << "missing: -offset " << QString::number(range.first) << " -len " << QString::number(range.second - range.first) << Qt::endl;
+                }
             }
+
+            mainTxt(txt);
         }
     }
 }
@@ -430,12 +1715,318 @@ void Delete::procIn(const QByteArray &binIn, uchar dType)
     }
 }
 
+FileCopier::FileCopier(QFile *source, QFile *dest)
+{
+    src    = source;
+    dst    = dest;
+    pos    = 0;
+    len    = src->size();
+    method = CLONE;
+}
+
+bool FileCopier::atEnd()
+{
+    return pos >= len;
+}
+
+QString FileCopier::errorString()
+{
+    return errMsg;
+}
+
+bool FileCopier::unsupported(int err)
+{
+    // the errors that mean "not here" rather than a real IO failure. only
+    // trusted before the method moved any data.
+
+    return (pos == 0) && ((err == ENOSYS) || (err == EXDEV) || (err == EINVAL) || (err == EOPNOTSUPP) || (err == ENOTTY));
+}
+
+qint64 FileCopier::step(qint64 maxBytes)
+{
+    // returns the bytes copied or -1 on failure.
+
+    qint64 ret = -1;
+
+    auto chunk = qMin(maxBytes, len - pos);
+
+#ifdef Q_OS_LINUX
+
+    auto in  = src->handle();
+    auto out = dst->handle();
+
+#ifdef FICLONE
+
+    if (method == CLONE)
+    {
+        if (ioctl(out, FICLONE, in) == 0)
+        {
+            ret = len - pos;
+            pos = len;
+
+            return ret;
+        }
+
+        method = COPY_RANGE;
+    }
+
+#else
+
+    if (method == CLONE) method = COPY_RANGE;
+
+#endif
+
+    if (method == COPY_RANGE)
+    {
+        loff_t inOffs  = pos;
+        loff_t outOffs = pos;
+
+        ret = copy_file_range(in, &inOffs, out, &outOffs, static_cast<size_t>(chunk), 0);
+
+        if ((ret == -1) && unsupported(errno))
+        {
+            method = SEND_FILE;
+        }
+    }
+
+    if (method == SEND_FILE)
+    {
+        off_t inOffs = pos;
+
+        ret = -1;
+
+        if (lseek(out, pos, SEEK_SET) != -1)
+        {
+            ret = sendfile(out, in, &inOffs, static_cast<size_t>(qMin(chunk, static_cast<qint64>(0x7FFFF000))));
+        }
+
+        if ((ret == -1) && unsupported(errno))
+        {
+            method = READ_WRITE;
+        }
+    }
+
+    if (method == READ_WRITE)
+    {
+        if (buff.size() < chunk) buff.resize(static_cast<int>(qMin(chunk, static_cast<qint64>(LOCAL_BUFFSIZE))));
+
+        ret = pread(in, buff.data(), static_cast<size_t>(qMin(chunk, static_cast<qint64>(buff.size()))), pos);
+
+        if ((ret > 0) && (pwrite(out, buff.constData(), static_cast<size_t>(ret), pos) != ret))
+        {
+            ret = -1;
+        }
+    }
+
+    if (ret == -1)
+    {
+        errMsg = QString::fromLocal8Bit(strerror(errno));
+    }
+
+#else
+
+    method = READ_WRITE;
+
+    auto data = src->read(chunk);
+
+    if ((data.size() == chunk) && (dst->write(data) == data.size()))
+    {
+        ret = data.size();
+    }
+    else
+    {
+        errMsg = (src->error() != QFile::NoError) ? src->errorString() : dst->errorString();
+    }
+
+#endif
+
+    if (ret == 0)
+    {
+        // the source got shorter since the copy started.
+
+        len = pos;
+    }
+    else if (ret > 0)
+    {
+        pos += ret;
+    }
+
+    return ret;
+}
+
+CopyPool::CopyPool(int threads)
+{
+    active   = 0;
+    stopping = false;
+
+    for (int i = 0; i < threads; ++i)
+    {
+        auto *thr = QThread::create([this]() {work();});
+
+        workers.append(thr);
+
+        thr->start();
+    }
+}
+
+CopyPool::~CopyPool()
+{
+    mutex.lock();
+
+    stopping = true;
+
+    jobReady.wakeAll();
+    mutex.unlock();
+
+    for (auto *thr : workers)
+    {
+        thr->wait();
+
+        delete thr;
+    }
+}
+
+bool CopyPool::isStopping()
+{
+    QMutexLocker locker(&mutex);
+
+    return stopping;
+}
+
+bool CopyPool::hasRoom()
+{
+    QMutexLocker locker(&mutex);
+
+    return pending.size() < COPY_MAX_PENDING;
+}
+
+bool CopyPool::isIdle()
+{
+    QMutexLocker locker(&mutex);
+
+    return pending.isEmpty() && (active == 0) && finished.isEmpty();
+}
+
+void CopyPool::submit(const QString &srcPath, const QString &dstPath)
+{
+    QMutexLocker locker(&mutex);
+
+    CopyJob job;
+
+    job.src   = srcPath;
+    job.dst   = dstPath;
+    job.bytes = 0;
+    job.ok    = false;
+
+    pending.append(job);
+    jobReady.wakeOne();
+}
+
+void CopyPool::waitForDone(unsigned long msec)
+{
+    QMutexLocker locker(&mutex);
+
+    if (finished.isEmpty() && ((active > 0) || !pending.isEmpty()))
+    {
+        jobDone.wait(&mutex, msec);
+    }
+}
+
+QList<CopyJob> CopyPool::takeFinished()
+{
+    QMutexLocker locker(&mutex);
+
+    QList<CopyJob> ret;
+
+    ret.swap(finished);
+
+    return ret;
+}
+
+void CopyPool::copyFile(CopyJob *job)
+{
+    QFile srcFile(job->src);
+    QFile dstFile(job->dst);
+
+    if (!dstFile.open(QFile::WriteOnly | QFile::Truncate))
+    {
+        job->errMsg = "err: Unable to open the destination file '" + job->dst + "' for writing. reason: " + dstFile.errorString() + "\n";
+    }
+    else if (!srcFile.open(QFile::ReadOnly))
+    {
+        job->errMsg = "err: Unable to open the source file '" + job->src + "' for reading. reason: " + srcFile.errorString() + "\n";
+    }
+    else
+    {
+        FileCopier copier(&srcFile, &dstFile);
+
+        job->ok = true;
+
+        while (job->ok && !copier.atEnd() && !isStopping())
+        {
+            auto ret = copier.step(LOCAL_BUFFSIZE);
+
+            if (ret < 0)
+            {
+                job->ok     = false;
+                job->errMsg = "err: File IO failure copying '" + job->src + "'. reason: " + copier.errorString() + "\n";
+            }
+            else
+            {
+                job->bytes += ret;
+            }
+        }
+
+        job->ok = job->ok && copier.atEnd();
+    }
+}
+
+void CopyPool::work()
+{
+    QMutexLocker locker(&mutex);
+
+    while (true)
+    {
+        while (pending.isEmpty() && !stopping)
+        {
+            jobReady.wait(&mutex);
+        }
+
+        if (stopping)
+        {
+            break;
+        }
+
+        auto job = pending.takeFirst();
+
+        active++;
+
+        locker.unlock();
+
+        copyFile(&job);
+
+        locker.relock();
+
+        active--;
+
+        finished.append(job);
+        jobDone.wakeAll();
+    }
+}
+
 void Copy::onTerminate()
 {
-    fromQueue = false;
-    yToAll    = false;
-    nToAll    = false;
-    flags     = 0;
+    delete copier;
+    delete pool;
+
+    copier = nullptr;
+    pool   = nullptr;
+
+    fromQueue  = false;
+    yToAll     = false;
+    nToAll     = false;
+    copyFailed = false;
+    flags      = 0;
 
     src->close();
     dst->close();
@@ -506,7 +2097,7 @@ void Copy::run()
 
         if (QFile::link(QFileInfo(srcPath).symLinkTarget(), dstPath))
         {
-            postProcFile();
+            postProcFile(srcPath);
         }
         else
         {
@@ -524,8 +2115,25 @@ void Copy::run()
         mkPath(dstPath);
         listDir(queue, srcPath, dstPath);
 
+        if (pool == nullptr)
+        {
+            pool = new CopyPool(COPY_THREADS);
+
+            startProgPulse();
+        }
+
         flags |= LOOPING;
     }
+    else if (pool != nullptr)
+    {
+        // a file of a directory copy; the pool picks it up from here.
+
+        mainTxt("'" + srcPath + "' --> '" + dstPath + "'\n");
+
+        progMax += QFileInfo(srcPath).size();
+
+        pool->submit(srcPath, dstPath);
+    }
     else
     {
         if (!dst->open(QFile::WriteOnly | QFile::Truncate))
@@ -548,10 +2156,69 @@ void Copy::run()
         }
         else
         {
-            mainTxt("'" + srcPath + "' --> '" + dstPath + "'\n");
-            startProgPulse();
+            mainTxt("'" + srcPath + "' --> '" + dstPath + "'\n");
+            startProgPulse();
+
+            copier = new FileCopier(src, dst);
+            flags |= LOOPING;
+        }
+    }
+}
+
+void Copy::collect()
+{
+    for (auto &&job : pool->takeFinished())
+    {
+        progCurrent += job.bytes;
+
+        if (job.ok)
+        {
+            postProcFile(job.src);
+        }
+        else
+        {
+            retCode    = EXECUTION_FAIL;
+            copyFailed = true;
+
+            errTxt(job.errMsg);
+        }
+    }
+}
+
+void Copy::copyStep()
+{
+    auto ret = copier->step(LOCAL_BUFFSIZE);
+
+    if (ret > 0)
+    {
+        stepIo(ret);
+
+        progCurrent += ret;
+    }
+
+    progMax = src->size();
+
+    if ((ret < 0) || copier->atEnd())
+    {
+        if (ret < 0)
+        {
+            retCode    = EXECUTION_FAIL;
+            copyFailed = true;
 
-            flags |= LOOPING;
+            errTxt("err: File IO failure copying '" + srcPath + "'. reason: " + copier->errorString() + "\n");
+        }
+
+        delete copier;
+
+        copier = nullptr;
+
+        src->close();
+        dst->close();
+        stopProgPulse();
+
+        if (ret >= 0)
+        {
+            postProcFile(srcPath);
         }
     }
 }
@@ -560,51 +2227,58 @@ void Copy::procIn(const QByteArray &binIn, uchar dType)
 {
     if (flags & LOOPING)
     {
-        if (src->isOpen() || dst->isOpen())
+        if (copier != nullptr)
         {
-            dst->write(src->read(LOCAL_BUFFSIZE));
-
-            progMax     = src->size();
-            progCurrent = src->pos();
+            copyStep();
+        }
+        else
+        {
+            if (pool != nullptr)
+            {
+                collect();
+            }
 
-            if (src->atEnd())
+            if (!queue.isEmpty() && ((pool == nullptr) || pool->hasRoom()))
             {
-                src->close();
-                dst->close();
+                auto srcToDst = queue.takeFirst();
 
-                stopProgPulse();
-                postProcFile();
-            }
-        }
-        else if (!queue.isEmpty())
-        {
-            auto srcToDst = queue.takeFirst();
+                srcPath   = srcToDst.first;
+                dstPath   = srcToDst.second;
+                fromQueue = true;
 
-            srcPath   = srcToDst.first;
-            dstPath   = srcToDst.second;
-            fromQueue = true;
+                src->setFileName(srcPath);
+                dst->setFileName(dstPath);
 
-            src->setFileName(srcPath);
-            dst->setFileName(dstPath);
+                auto exists = QFileInfo(dstPath).exists();
 
-            auto exists = QFileInfo(dstPath).exists();
+                if (exists && !yToAll && !nToAll)
+                {
+                    flags &= ~LOOPING;
 
-            if (exists && !yToAll && !nToAll)
+                    ask();
+                }
+                else if (!nToAll || !exists)
+                {
+                    run();
+                }
+            }
+            else if (!queue.isEmpty() || ((pool != nullptr) && !pool->isIdle()))
             {
-                flags &= ~LOOPING;
+                // the workers are busy so there is nothing to do until one
+                // of them finishes a file.
 
-                ask();
+                pool->waitForDone(5);
             }
-            else if (!nToAll || !exists)
+            else
             {
-                run();
+                // a move leaves the source directory in place if any of its
+                // files failed to copy.
+
+                if (!copyFailed) preFinish();
+
+                onTerminate();
             }
         }
-        else
-        {
-            preFinish();
-            onTerminate();
-        }
     }
     else if ((dType == TEXT) && (flags & MORE_INPUT))
     {
@@ -727,9 +2401,9 @@ void Move::runOnMatchingVolume()
     }
 }
 
-void Move::postProcFile()
+void Move::postProcFile(const QString &path)
 {
-    QFile::remove(srcPath);
+    QFile::remove(path);
 }
 
 void Move::preFinish()
@@ -773,30 +2447,432 @@ void MakePath::procIn(const QByteArray &binIn, quint8 dType)
 {
     if (dType == TEXT)
     {
-        auto args = parseArgs(binIn, 2);
-        auto path = getParam("-path", args);
+        auto args = parseArgs(binIn, 2);
+        auto path = getParam("-path", args);
+
+        if (path.isEmpty())
+        {
+            retCode = INVALID_PARAMS;
+
+            errTxt("err: The path argument (-path) was not found or is empty.\n");
+        }
+        else
+        {
+            mkPath(path);
+        }
+    }
+}
+
+DirStream::DirStream(const QString &path, bool skipHidden)
+{
+    dirPath  = path;
+    noHidden = skipHidden;
+
+#ifdef Q_OS_LINUX
+
+    dir = opendir(QFile::encodeName(path).constData());
+
+#else
+
+    auto filter = QDir::AllEntries | QDir::System | QDir::NoDotAndDotDot;
+
+    if (!noHidden) filter |= QDir::Hidden;
+
+    iter  = new QDirIterator(path, filter);
+    count = 0;
+
+#endif
+}
+
+DirStream::~DirStream()
+{
+#ifdef Q_OS_LINUX
+
+    if (dir != nullptr) closedir(dir);
+
+#else
+
+    delete iter;
+
+#endif
+}
+
+QString DirStream::path() const
+{
+    return dirPath;
+}
+
+bool DirStream::isOpen() const
+{
+#ifdef Q_OS_LINUX
+
+    return dir != nullptr;
+
+#else
+
+    return QFileInfo(dirPath).isDir();
+
+#endif
+}
+
+bool DirStream::next(QFileInfo *info)
+{
+#ifdef Q_OS_LINUX
+
+    if (dir == nullptr) return false;
+
+    for (auto *ent = readdir(dir); ent != nullptr; ent = readdir(dir))
+    {
+        auto name = QFile::decodeName(ent->d_name);
+
+        if ((name == ".") || (name == ".."))
+        {
+            continue;
+        }
+
+        if (noHidden && name.startsWith('.'))
+        {
+            continue;
+        }
+
+        info->setFile(dirPath + "/" + name);
+
+        return true;
+    }
+
+    return false;
+
+#else
+
+    if (!iter->hasNext()) return false;
+
+    iter->next();
+
+    *info = iter->fileInfo();
+
+    count++;
+
+    return true;
+
+#endif
+}
+
+qint64 DirStream::pos() const
+{
+#ifdef Q_OS_LINUX
+
+    return (dir == nullptr) ? 0 : telldir(dir);
+
+#else
+
+    return count;
+
+#endif
+}
+
+void DirStream::seek(qint64 offs)
+{
+#ifdef Q_OS_LINUX
+
+    // telldir() positions on linux are the d_off cookies of getdents64 so
+    // they stay valid across opendir() calls on the same directory.
+
+    if (dir != nullptr) seekdir(dir, static_cast<long>(offs));
+
+#else
+
+    // no stable offsets here so the directory is simply read again up to
+    // the saved position.
+
+    if (offs < count)
+    {
+        delete iter;
+
+        auto filter = QDir::AllEntries | QDir::System | QDir::NoDotAndDotDot;
+
+        if (!noHidden) filter |= QDir::Hidden;
+
+        iter  = new QDirIterator(dirPath, filter);
+        count = 0;
+    }
+
+    QFileInfo skipped;
+
+    while ((count < offs) && next(&skipped));
+
+#endif
+}
+
+DirLister::DirLister(QObject *parent) : CmdObject(parent)
+{
+    recurse = false;
+
+    onTerminate();
+}
+
+void DirLister::onTerminate()
+{
+    qDeleteAll(stack);
+
+    stack.clear();
+    batch.clear();
+
+    flags       = 0;
+    limit       = 0;
+    listed      = 0;
+    maxDepth    = 0;
+    infoFrames  = false;
+    batchFrames = false;
+    noHidden    = false;
+}
+
+bool DirLister::isStreamMode(const QStringList &args)
+{
+    return argExists("-stream", args) || argExists("-cursor", args) || argExists("-limit", args);
+}
+
+void DirLister::listEntry(const QFileInfo &info)
+{
+    listed++;
+
+    if (infoFrames)
+    {
+        listEncoded(toFILE_INFO(info), info.isDir());
+    }
+    else
+    {
+        listEncoded((recurse ? info.filePath() : info.fileName()).toUtf8(), info.isDir());
+    }
+}
+
+void DirLister::listInfo(const QByteArray &fileInfo)
+{
+    // same as listEntry() but from an already encoded FILE_INFO.
+
+    listed++;
+
+    auto isDir = (static_cast<quint8>(fileInfo[0]) & IS_DIR) != 0;
+
+    if (infoFrames)
+    {
+        listEncoded(fileInfo, isDir);
+    }
+    else
+    {
+        auto end = fileInfo.indexOf('\0', 25);
+
+        listEncoded(fileInfo.mid(25, end - 25), isDir);
+    }
+}
+
+void DirLister::listEncoded(const QByteArray &entry, bool isDir)
+{
+    // entry is a FILE_INFO structure if infoFrames is set, otherwise it is
+    // the UTF8 name of the object to display.
+
+    if (batchFrames)
+    {
+        batch.append(wrInt(entry.size(), 16) + entry);
+
+        if (batch.size() >= INFO_BATCH_SIZE)
+        {
+            flushBatch();
+        }
+    }
+    else if (infoFrames)
+    {
+        emit procOut(entry, FILE_INFO);
+    }
+    else if (isDir)
+    {
+        emit procOut(entry + "/\n", TEXT);
+    }
+    else
+    {
+        emit procOut(entry + "\n", TEXT);
+    }
+}
+
+void DirLister::flushBatch()
+{
+    if (!batch.isEmpty())
+    {
+        emit procOut(batch, INFO_BATCH);
+
+        batch.clear();
+    }
+}
+
+QByteArray DirLister::cursor()
+{
+    // format: [8bytes(dir_pos)][TEXT(dir_path)]... for each open directory
+    //         from the root of the listing down, base64url encoded.
+
+    QByteArray data;
+
+    for (auto *dirStream : stack)
+    {
+        data.append(wrInt(dirStream->pos(), 64));
+        data.append(nullTermTEXT(dirStream->path()));
+    }
+
+    return data.toBase64(QByteArray::Base64UrlEncoding | QByteArray::OmitTrailingEquals);
+}
+
+bool DirLister::openCursor(const QString &root, const QString &cursor)
+{
+    auto data = QByteArray::fromBase64(cursor.toUtf8(), QByteArray::Base64UrlEncoding);
+    auto offs = 0;
+    auto ok   = true;
+
+    while (ok && (offs < data.size()))
+    {
+        auto term = data.indexOf('\0', offs + 8);
+
+        if ((offs + 8 > data.size()) || (term == -1))
+        {
+            ok = false;
+        }
+        else
+        {
+            auto pos  = rdInt(data.mid(offs, 8));
+            auto path = QString::fromUtf8(data.mid(offs + 8, term - offs - 8));
+
+            // the cursor is client supplied so every directory in it must
+            // be the root itself or sit under the previous one.
+
+            if (stack.isEmpty())
+            {
+                ok = (path == root);
+            }
+            else
+            {
+                ok = recurse && (path == QDir::cleanPath(path)) && path.startsWith(stack.last()->path() + "/");
+            }
+
+            if (ok)
+            {
+                auto *dirStream = new DirStream(path, noHidden);
+
+                stack.append(dirStream);
+
+                ok = dirStream->isOpen();
+
+                dirStream->seek(pos);
+            }
+
+            offs = term + 1;
+        }
+    }
+
+    return ok && !stack.isEmpty();
+}
+
+bool DirLister::startStream(const QString &path, const QStringList &args)
+{
+    auto root     = QDir::cleanPath(QDir(path).absolutePath());
+    auto cursorId = getParam("-cursor", args);
+    auto limitStr = getParam("-limit", args);
+    auto ret      = false;
+
+    if (!limitStr.isEmpty() && !isInt(limitStr))
+    {
+        errTxt("err: Limit '" + limitStr + "' is not a valid integer.\n");
+    }
+    else if (cursorId.isEmpty())
+    {
+        stack.append(new DirStream(root, noHidden));
+
+        ret = stack.last()->isOpen();
+
+        if (!ret)
+        {
+            retCode = EXECUTION_FAIL;
+
+            errTxt("err: Unable to open '" + root + "' for reading.\n");
+        }
+    }
+    else if (!openCursor(root, cursorId))
+    {
+        errTxt("err: The cursor is not valid for '" + root + "' or the directory it points to no longer exists.\n");
+    }
+    else
+    {
+        ret = true;
+    }
+
+    if (ret)
+    {
+        limit  = limitStr.toLongLong();
+        flags |= LOOPING;
+    }
+    else
+    {
+        qDeleteAll(stack);
+
+        stack.clear();
+    }
+
+    return ret;
+}
+
+void DirLister::streamStep()
+{
+    auto      *top = stack.last();
+    auto       pos = top->pos();
+    QFileInfo  info;
+
+    if (!top->next(&info))
+    {
+        delete stack.takeLast();
+
+        if (stack.isEmpty())
+        {
+            flushBatch();
+            onTerminate();
+        }
+    }
+    else if ((limit > 0) && (listed >= limit))
+    {
+        // there is more to list so the entry just read is put back and the
+        // client gets a cursor to pick up from there.
+
+        top->seek(pos);
+
+        flushBatch();
+        mainTxt("-cursor " + cursor() + "\n");
+        onTerminate();
+    }
+    else
+    {
+        listEntry(info);
 
-        if (path.isEmpty())
+        if (recurse && info.isDir() && !info.isSymLink() && ((maxDepth == 0) || (stack.size() < maxDepth)))
         {
-            retCode = INVALID_PARAMS;
+            auto *dirStream = new DirStream(info.filePath(), noHidden);
 
-            errTxt("err: The path argument (-path) was not found or is empty.\n");
-        }
-        else
-        {
-            mkPath(path);
+            if (dirStream->isOpen()) stack.append(dirStream);
+            else                     delete dirStream;
         }
     }
 }
 
 void ListFiles::procIn(const QByteArray &binIn, quint8 dType)
 {
-    if (dType == TEXT)
+    if (flags & LOOPING)
     {
-        auto args      = parseArgs(binIn, 4);
-        auto path      = getParam("-path", args);
-        auto infoFrame = argExists("-info_frame", args);
-        auto noHidden  = argExists("-no_hidden", args);
+        streamStep();
+    }
+    else if (dType == TEXT)
+    {
+        onTerminate();
+
+        auto args = parseArgs(binIn, 10);
+        auto path = getParam("-path", args);
+
+        batchFrames = argExists("-info_batch", args);
+        infoFrames  = argExists("-info_frame", args) || batchFrames;
+        noHidden    = argExists("-no_hidden", args);
 
         if (path.isEmpty())
         {
@@ -819,51 +2895,159 @@ void ListFiles::procIn(const QByteArray &binIn, quint8 dType)
         {
             errTxt("err: Cannot read '" + path + "' permission denied.\n");
         }
+        else if (isStreamMode(args))
+        {
+            if (startStream(path, args))
+            {
+                retCode = NO_ERRORS;
+            }
+        }
         else
         {
             retCode = NO_ERRORS;
 
-            QDir dir(path);
-
-            if (noHidden)
-            {
-                dir.setFilter(QDir::AllEntries | QDir::System | QDir::NoDotAndDotDot);
-            }
-            else
-            {
-                dir.setFilter(QDir::AllEntries | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot);
-            }
+            // the listing is kept in the host wide cache as INFO_BATCH data
+            // whatever the output mode so any later call can be served by it.
 
-            dir.setSorting(QDir::DirsFirst | QDir::Name);
+            auto key  = pathInfo.absoluteFilePath();
+            auto kind = noHidden ? FS_CACHE_DIR_NO_HIDDEN : FS_CACHE_DIR;
 
-            QFileInfoList list = dir.entryInfoList();
+            QByteArray   entries;
+            FsCacheStamp stamp;
 
-            for (auto&& info : list)
+            if (!FsCache::find(kind, key, &entries))
             {
-                if (infoFrame)
+                auto stamped = FsCache::stamp(key, &stamp);
+
+                QDir dir(path);
+
+                if (noHidden)
                 {
-                    emit procOut(toFILE_INFO(info), FILE_INFO);
+                    dir.setFilter(QDir::AllEntries | QDir::System | QDir::NoDotAndDotDot);
                 }
-                else if (info.isDir())
+                else
                 {
-                    mainTxt(info.fileName() + "/" + "\n");
+                    dir.setFilter(QDir::AllEntries | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot);
                 }
-                else
+
+                dir.setSorting(QDir::DirsFirst | QDir::Name);
+
+                QFileInfoList list = dir.entryInfoList();
+
+                for (auto&& info : list)
+                {
+                    auto entry = toFILE_INFO(info);
+
+                    entries.append(wrInt(entry.size(), 16));
+                    entries.append(entry);
+                }
+
+                if (stamped)
                 {
-                    mainTxt(info.fileName() + "\n");
+                    FsCache::store(kind, key, stamp, entries);
                 }
             }
+
+            for (int pos = 0; (pos + 2) <= entries.size();)
+            {
+                auto len = static_cast<int>(rdInt(entries.mid(pos, 2)));
+
+                listInfo(entries.mid(pos + 2, len));
+
+                pos += 2 + len;
+            }
+
+            flushBatch();
+        }
+    }
+}
+
+void FileInfo::onTerminate()
+{
+    delete hasher;
+
+    hasher = nullptr;
+
+    file->close();
+    hashKey.clear();
+
+    flags = 0;
+}
+
+void FileInfo::startHash(const QString &path, const QString &algo)
+{
+    hashKey = HashCache::key(path, algo);
+
+    auto digest = HashCache::find(hashKey);
+
+    if (!digest.isEmpty())
+    {
+        mainTxt(algo + ": " + QString::fromLatin1(digest.toHex()) + "\n");
+    }
+    else
+    {
+        file->setFileName(path);
+
+        if (file->open(QFile::ReadOnly))
+        {
+            hasher  = new StreamHash(algo);
+            progMax = file->size();
+            flags  |= LOOPING;
+
+            startProgPulse();
+        }
+        else
+        {
+            retCode = EXECUTION_FAIL;
+
+            errTxt("err: Unable to open the file for reading. reason: " + file->errorString() + "\n");
+        }
+    }
+}
+
+void FileInfo::hashStep()
+{
+    auto data = file->read(HASH_READ_SIZE);
+
+    if (data.isEmpty() && !file->atEnd())
+    {
+        retCode = EXECUTION_FAIL;
+
+        errTxt("err: File IO failure: " + file->errorString() + ".\n");
+        onTerminate();
+    }
+    else
+    {
+        hasher->addData(data);
+
+        progCurrent += data.size();
+
+        stepIo(data.size());
+
+        if (file->atEnd())
+        {
+            auto digest = hasher->result();
+
+            HashCache::store(file->fileName(), hasher->name(), hashKey, digest);
+
+            mainTxt(hasher->name() + ": " + QString::fromLatin1(digest.toHex()) + "\n");
+            onTerminate();
         }
     }
 }
 
 void FileInfo::procIn(const QByteArray &binIn, quint8 dType)
 {
-    if (dType == TEXT)
+    if (flags & LOOPING)
+    {
+        hashStep();
+    }
+    else if (dType == TEXT)
     {
-        auto args      = parseArgs(binIn, 3);
+        auto args      = parseArgs(binIn, 5);
         auto path      = getParam("-path", args);
         auto infoFrame = argExists("-info_frame", args);
+        auto hashAlgo  = hashArg(args);
 
         QFileInfo info(path);
 
@@ -877,13 +3061,51 @@ void FileInfo::procIn(const QByteArray &binIn, quint8 dType)
         {
             errTxt("err: Object not found.\n");
         }
+        else if (!hashAlgo.isEmpty() && (StreamHash::digest(hashAlgo) == nullptr))
+        {
+            errTxt("err: Unknown hash '" + hashAlgo + "', it can be one of: " + StreamHash::names().join(", ") + ".\n");
+        }
+        else if (!hashAlgo.isEmpty() && !info.isFile())
+        {
+            errTxt("err: Only files can be hashed.\n");
+        }
         else
         {
             retCode = NO_ERRORS;
 
+            // building the text output means a QStorageInfo which reads the
+            // whole mount table so both outputs go through the host wide
+            // cache. the stamp is taken ahead of reading anything about the
+            // object so a change in between can't be cached as current.
+            // reading the object doesn't change its stamp so last_accessed
+            // is left out of the cached text and added on every call.
+
+            auto key  = info.absoluteFilePath();
+            auto kind = infoFrame ? FS_CACHE_INFO : FS_CACHE_INFO_TEXT;
+
+            QByteArray   cached;
+            FsCacheStamp stamp;
+
+            auto hit     = FsCache::find(kind, key, &cached);
+            auto stamped = !hit && FsCache::stamp(key, &stamp);
+
+            if (!hit)
+            {
+                info.refresh();
+            }
+
             if (infoFrame)
             {
-                emit procOut(toFILE_INFO(info), FILE_INFO);
+                if (!hit)
+                {
+                    cached = toFILE_INFO(info);
+                }
+
+                emit procOut(cached, FILE_INFO);
+            }
+            else if (hit)
+            {
+                mainTxt(QString::fromUtf8(cached) + "last_accessed: " + info.lastRead().toString("MM/dd/yyyy hh:mm:ss AP t") + "\n");
             }
             else
             {
@@ -905,10 +3127,23 @@ void FileInfo::procIn(const QByteArray &binIn, quint8 dType)
 
                 txtOut << "time_created:  " << info.birthTime().toString("MM/dd/yyyy hh:mm:ss AP t")    << Qt::endl;
                 txtOut << "last_modified: " << info.lastModified().toString("MM/dd/yyyy hh:mm:ss AP t") << Qt::endl;
-                txtOut << "last_accessed: " << info.lastRead().toString("MM/dd/yyyy hh:mm:ss AP t")     << Qt::endl;
+
+                cached = txt.toUtf8();
+
+                txtOut << "last_accessed: " << info.lastRead().toString("MM/dd/yyyy hh:mm:ss AP t") << Qt::endl;
 
                 mainTxt(txt);
             }
+
+            if (stamped)
+            {
+                FsCache::store(kind, key, stamp, cached);
+            }
+
+            if (!hashAlgo.isEmpty())
+            {
+                startHash(path, hashAlgo);
+            }
         }
     }
 }
@@ -946,77 +3181,278 @@ void ChangeDir::procIn(const QByteArray &binIn, quint8 dType)
     }
 }
 
-void Tree::onTerminate()
+TreeWalker::TreeWalker(const QString &root, int threads, int depth, bool info, bool skipHidden, bool sortDirs)
 {
-    queue.clear();
+    busy       = 0;
+    maxDepth   = depth;
+    infoFrames = info;
+    noHidden   = skipHidden;
+    sorted     = sortDirs;
+    stopping   = false;
 
-    flags      = 0;
-    infoFrames = false;
-    noHidden   = false;
+    frontier.append(WalkDir(root, 0));
+
+    for (int i = 0; i < threads; ++i)
+    {
+        auto *thr = QThread::create([this]() {work();});
+
+        workers.append(thr);
+
+        thr->start();
+    }
 }
 
-void Tree::printList(const QString &path)
+TreeWalker::~TreeWalker()
 {
-    QDir dir(path);
+    mutex.lock();
 
-    if (noHidden)
+    stopping = true;
+
+    workReady.wakeAll();
+    batchTaken.wakeAll();
+    mutex.unlock();
+
+    for (auto *thr : workers)
     {
-        dir.setFilter(QDir::AllEntries | QDir::System | QDir::NoDotAndDotDot);
+        thr->wait();
+
+        delete thr;
     }
-    else
+}
+
+bool TreeWalker::isStopping()
+{
+    QMutexLocker locker(&mutex);
+
+    return stopping;
+}
+
+bool TreeWalker::isDone()
+{
+    QMutexLocker locker(&mutex);
+
+    return frontier.isEmpty() && (busy == 0) && batches.isEmpty();
+}
+
+bool TreeWalker::takeBatch(WalkBatch *batch, int waitMsec)
+{
+    QMutexLocker locker(&mutex);
+
+    if (batches.isEmpty() && (!frontier.isEmpty() || (busy > 0)))
+    {
+        batchReady.wait(&mutex, static_cast<unsigned long>(waitMsec));
+    }
+
+    auto ret = !batches.isEmpty();
+
+    if (ret)
+    {
+        *batch = batches.takeFirst();
+
+        batchTaken.wakeOne();
+    }
+
+    return ret;
+}
+
+void TreeWalker::work()
+{
+    QMutexLocker locker(&mutex);
+
+    while (true)
     {
-        dir.setFilter(QDir::AllEntries | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot);
+        while (frontier.isEmpty() && (busy > 0) && !stopping)
+        {
+            workReady.wait(&mutex);
+        }
+
+        if (stopping || frontier.isEmpty())
+        {
+            break;
+        }
+
+        // the newest directory is taken first to keep the walk leaning depth
+        // first which keeps the frontier small.
+
+        auto dir = frontier.takeLast();
+
+        busy++;
+
+        locker.unlock();
+        walk(dir);
+        locker.relock();
+
+        busy--;
+
+        if (frontier.isEmpty() && (busy == 0))
+        {
+            workReady.wakeAll();
+            batchReady.wakeAll();
+        }
     }
+}
 
-    dir.setSorting(QDir::DirsFirst | QDir::Name);
+void TreeWalker::publish(const QFileInfoList &infos)
+{
+    if (infos.isEmpty()) return;
 
-    QFileInfoList list = dir.entryInfoList();
+    WalkBatch batch;
 
-    for (auto&& info : list)
+    for (auto&& info : infos)
     {
         if (infoFrames)
         {
-            emit procOut(toFILE_INFO(info), FILE_INFO);
+            batch.append(toFILE_INFO(info));
         }
         else if (info.isDir())
         {
-            mainTxt(info.filePath() + "/" + "\n");
+            batch.append(QString(info.filePath() + "/").toUtf8());
+        }
+        else
+        {
+            batch.append(info.filePath().toUtf8());
+        }
+    }
+
+    QMutexLocker locker(&mutex);
+
+    while ((batches.size() >= WALK_MAX_BATCHES) && !stopping)
+    {
+        batchTaken.wait(&mutex);
+    }
+
+    if (!stopping)
+    {
+        batches.append(batch);
+
+        batchReady.wakeOne();
+    }
+}
+
+void TreeWalker::dispatch(const QList<WalkDir> &dirs)
+{
+    for (auto&& dir : dirs)
+    {
+        mutex.lock();
+
+        if (frontier.size() < WALK_MAX_FRONTIER)
+        {
+            frontier.append(dir);
+
+            workReady.wakeOne();
+            mutex.unlock();
         }
         else
         {
-            mainTxt(info.filePath() + "\n");
+            mutex.unlock();
+
+            walk(dir);
+        }
+    }
+}
+
+void TreeWalker::walk(const WalkDir &dir)
+{
+    DirStream      stream(dir.first, noHidden);
+    QFileInfoList  infos;
+    QList<WalkDir> subDirs;
+    QFileInfo      info;
+
+    auto more = true;
+
+    while (more && !isStopping())
+    {
+        more = stream.next(&info);
+
+        if (more)
+        {
+            // isDir() does the stat() here in the worker so the cached result
+            // is all the command thread ever sees.
+
+            if (info.isDir() && !info.isSymLink() && ((maxDepth == 0) || (dir.second + 1 < maxDepth)))
+            {
+                subDirs.append(WalkDir(info.filePath(), dir.second + 1));
+            }
+
+            infos.append(info);
         }
 
-        if (info.isDir())
+        if ((!more || (infos.size() >= WALK_BATCH)) && !sorted)
         {
-            queue.append(info);
+            publish(infos);
+            dispatch(subDirs);
+
+            infos.clear();
+            subDirs.clear();
         }
     }
 
-    if (queue.isEmpty())
+    if (sorted)
     {
-        onTerminate();
+        std::sort(infos.begin(), infos.end(), [](const QFileInfo &infoA, const QFileInfo &infoB)
+        {
+            if (infoA.isDir() != infoB.isDir()) return infoA.isDir();
+
+            return infoA.fileName() < infoB.fileName();
+        });
+
+        publish(infos);
+        dispatch(subDirs);
     }
-    else
+}
+
+void Tree::onTerminate()
+{
+    DirLister::onTerminate();
+
+    delete walker;
+
+    walker = nullptr;
+}
+
+void Tree::walkStep()
+{
+    WalkBatch entries;
+
+    if (walker->takeBatch(&entries, 5))
     {
-        flags |= LOOPING;
+        for (auto&& entry : entries)
+        {
+            // text entries already carry the trailing '/' of a directory.
+
+            listEncoded(entry, false);
+        }
+    }
+    else if (walker->isDone())
+    {
+        flushBatch();
+        onTerminate();
     }
 }
 
 void Tree::procIn(const QByteArray &binIn, quint8 dType)
 {
-    if (flags & LOOPING)
+    if ((flags & LOOPING) && !stack.isEmpty())
     {
-        printList(queue.takeFirst().filePath());
+        streamStep();
+    }
+    else if (flags & LOOPING)
+    {
+        walkStep();
     }
     else if (dType == TEXT)
     {
-        auto args = parseArgs(binIn, 4);
-        auto path = getParam("-path", args);
+        onTerminate();
 
-        infoFrames = argExists("-info_frame", args);
-        noHidden   = argExists("-no_hidden", args);
-        retCode    = INVALID_PARAMS;
+        auto args     = parseArgs(binIn, 15);
+        auto path     = getParam("-path", args);
+        auto depthStr = getParam("-depth", args);
+        auto thrStr   = getParam("-threads", args);
+
+        batchFrames = argExists("-info_batch", args);
+        infoFrames  = argExists("-info_frame", args) || batchFrames;
+        noHidden    = argExists("-no_hidden", args);
+        retCode     = INVALID_PARAMS;
 
         if (path.isEmpty())
         {
@@ -1037,11 +3473,31 @@ void Tree::procIn(const QByteArray &binIn, quint8 dType)
         {
             errTxt("err: Cannot read '" + path + "' permission denied.\n");
         }
+        else if (!depthStr.isEmpty() && !isInt(depthStr))
+        {
+            errTxt("err: Depth '" + depthStr + "' is not a valid integer.\n");
+        }
+        else if (!thrStr.isEmpty() && (!isInt(thrStr) || (thrStr.toInt() < 1) || (thrStr.toInt() > WALK_MAX_THREADS)))
+        {
+            errTxt("err: Threads '" + thrStr + "' is not a valid integer between 1 and " + QString::number(WALK_MAX_THREADS) + ".\n");
+        }
+        else if (isStreamMode(args))
+        {
+            maxDepth = depthStr.toInt();
+
+            if (startStream(path, args))
+            {
+                retCode = NO_ERRORS;
+            }
+        }
         else
         {
+            auto threads = thrStr.isEmpty() ? WALK_THREADS : thrStr.toInt();
+            auto sorted  = argExists("-sorted", args);
+
             retCode = NO_ERRORS;
-            
-            printList(path);
+            walker  = new TreeWalker(QDir::cleanPath(path), threads, depthStr.toInt(), infoFrames, noHidden, sorted);
+            flags  |= LOOPING;
         }
     }
 }
@@ -19,22 +19,165 @@
 
 #include "../common.h"
 #include "../cmd_object.h"
+#include "../fs_cache.h"
+#include "fs_archive.h"
+#include "fs_hash.h"
+
+#include <algorithm>
+#include <climits>
+#include <QDirIterator>
+#include <QJsonArray>
+#include <QLockFile>
+#include <QMutex>
+#include <QSaveFile>
+#include <QWaitCondition>
+
+#ifdef Q_OS_LINUX
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <linux/fs.h>
+
+#endif
+
+#define INFO_BATCH_SIZE   65536
+#define WALK_THREADS      4
+#define WALK_MAX_THREADS  32
+#define WALK_BATCH        256
+#define WALK_MAX_BATCHES  64
+#define WALK_MAX_FRONTIER 4096
+#define DL_MIN_CHUNK      65536
+#define DL_WINDOW_CHUNKS  4 // default chunk size in multiples of the IPC send window.
+#define DL_READ_AHEAD     2 // chunks read ahead of the one being sent.
+#define UL_HIGH_WATER     33554432  // unwritten upload data that makes the host ask the client to pause (32MB).
+#define UL_LOW_WATER      8388608   // and to resume once it drains back down to this (8MB).
+#define UL_MAX_BACKLOG    134217728 // hard cap; the command thread blocks past this (128MB).
+#define UL_DIRECT_ALIGN   4096
+#define UL_DIRECT_BLOCK   1048576
+#define UL_MAX_RESERVE    1073741824 // most disk space preallocated for a single upload (1GB), never more than half of what is free.
+#define XFER_DIRNAME      "transfers"
+#define XFER_ID_MAX_LEN   128
+#define XFER_SYNC_BYTES   67108864 // upload progress is recorded in the transfer manifest at least this often (64MB).
+#define XFER_MAX_AGE_DAYS 7        // manifests not updated within this many days are deleted.
+#define XFER_LOCK_MSEC    5000
+#define COPY_THREADS      4
+#define COPY_MAX_PENDING  64 // files handed to the copy pool ahead of the workers.
 
 QByteArray toFILE_INFO(const QString &path);
 QByteArray toFILE_INFO(const QFileInfo &info);
 void       mkPathForFile(const QString &path);
 
+typedef QPair<qint64, qint64> ByteRange; // [start, end)
+
+class TransferManifest
+{
+    // host side record of the byte ranges of a resumable transfer that are
+    // done, keyed by the user and the client's -transfer_id. the ranges of a
+    // parallel transfer run on separate branches and every branch is its own
+    // command process so the record is a small json file guarded by a lock
+    // file rather than anything in memory.
+
+private:
+
+    QString path;
+
+    static QList<ByteRange> toRanges(const QJsonObject &obj);
+    static QJsonArray       toJson(const QList<ByteRange> &ranges);
+
+    QJsonObject read();
+    bool        write(const QJsonObject &obj);
+    void        purgeStale();
+
+public:
+
+    static QList<ByteRange> merge(QList<ByteRange> ranges);
+    static QList<ByteRange> gaps(const QList<ByteRange> &ranges, qint64 total);
+    static bool             validId(const QString &transferId);
+
+    explicit TransferManifest(const QByteArray &owner, const QString &transferId);
+
+    bool             exists();
+    bool             bind(const QString &remoteFile, const QString &direction, qint64 size);
+    bool             addRange(qint64 offs, qint64 len);
+    bool             remove();
+    QString          remoteFile();
+    QString          direction();
+    qint64           size();
+    QList<ByteRange> ranges();
+};
+
+//-----------------------
+
+class ReadAhead
+{
+    // reads a file on its own thread into a small set of reusable buffers so
+    // the disk read of the next chunks overlaps with the send of the current
+    // one. buffers handed back with recycle() are filled again in place once
+    // nothing else holds a reference to them (the IPC thread and the socket
+    // share a chunk until it's written) so a download doesn't allocate a new
+    // chunk each time.
+
+private:
+
+    QMutex            mutex;
+    QWaitCondition    chunkReady;
+    QWaitCondition    chunkTaken;
+    QThread          *thr;
+    QFile             file;
+    QList<QByteArray> ready;
+    QList<QByteArray> pool;
+    QString           errMsg;
+    qint64            remaining;
+    int               chunkSize;
+    bool              stopping;
+    bool              failed;
+
+    void run();
+
+public:
+
+    explicit ReadAhead(const QString &path, qint64 offs, qint64 len, int chunk);
+    ~ReadAhead();
+
+    int     take(QByteArray *chunk, unsigned long waitMsec);
+    void    recycle(const QByteArray &buff);
+    QString errorString();
+};
+
+//-----------------------
+
+class TreeWalker;
+
 class DownloadFile : public CmdObject
 {
     Q_OBJECT
 
 private:
 
-    QFile *file;
-    bool   ssMode;
-    bool   paramsSet;
-
+    ReadAhead  *reader;
+    TreeWalker *walker;
+    TarWriter  *archive;
+    StreamHash *hasher;
+    QFile      *file;
+    QByteArray  cachedHash;
+    QString     hashAlgo;
+    QString     hashKey;
+    QString     dirPath;
+    qint64      offs;
+    int         chunkSize;
+    bool        ssMode;
+    bool        paramsSet;
+
+    int  chunkLen(const QStringList &args);
+    void scanStep();
     void sendChunk();
+    void reportHash();
     void onTerminate();
 
 public:
@@ -48,6 +191,61 @@ public:
 
 //-----------------------
 
+class WriteBehind : public QObject
+{
+    Q_OBJECT
+
+    // takes upload data from the command thread and writes it out on its own
+    // thread so a slow disk doesn't hold up the IPC. the target range is
+    // preallocated up front and very large uploads can optionally bypass the
+    // page cache with O_DIRECT.
+
+private:
+
+    QMutex            mutex;
+    QWaitCondition    dataReady;
+    QWaitCondition    dataTaken;
+    QThread          *thr;
+    QFile             file;
+    QList<QByteArray> pending;
+    QString           errMsg;
+    qint64            backlogBytes;
+    qint64            startPos;
+    qint64            pos;
+    qint64            done;
+    qint64            reserved;
+    char             *directBuff;
+    int               directFill;
+    int               fd;
+    bool              direct;
+    bool              highWater;
+    bool              stopping;
+    bool              failed;
+
+    void run();
+    bool writeOut(const QByteArray &data);
+    bool writeDirect(const char *data, int len);
+    void closeOut();
+
+public:
+
+    explicit WriteBehind(const QString &path, QFile::OpenModeFlag mode, qint64 offs, qint64 len, bool directIo);
+    ~WriteBehind();
+
+    bool    isOpen();
+    bool    push(const QByteArray &data);
+    bool    finish();
+    qint64  backlog();
+    qint64  written();
+    QString errorString();
+
+signals:
+
+    void backlogLow();
+};
+
+//-----------------------
+
 class UploadFile : public CmdObject
 {
     Q_OBJECT
@@ -55,17 +253,34 @@ class UploadFile : public CmdObject
 private:
 
     QFile::OpenModeFlag mode;
+    TransferManifest   *manifest;
+    WriteBehind        *writer;
+    TarReader          *unpacker;
+    StreamHash         *hasher;
     QFile              *file;
+    QString             hashAlgo;
     qint64              offs;
+    qint64              recorded;
     bool                ssMode;
     bool                confirm;
     bool                force;
+    bool                direct;
+    bool                flowCtrl;
+    bool                paused;
+    bool                ackHeld;
 
     void wrToFile(const QByteArray &data);
+    void unpack(const QByteArray &data);
+    void reportHash();
+    void recordDone(qint64 bytes);
     void onTerminate();
     void run();
     void ask();
 
+private slots:
+
+    void backlogLow();
+
 public:
 
     static QString cmdName();
@@ -77,6 +292,107 @@ public:
 
 //-----------------------
 
+class TransferStatus : public CmdObject
+{
+    Q_OBJECT
+
+public:
+
+    static QString cmdName();
+
+    void procIn(const QByteArray &binIn, quint8 dType);
+
+    explicit TransferStatus(QObject *parent = nullptr);
+};
+
+//-----------------------
+
+class FileCopier
+{
+    // copies one open file to another with the cheapest method the platform
+    // and file systems allow. a reflink (FICLONE) shares the source extents
+    // outright, copy_file_range() copies within the kernel (or server side
+    // on network file systems), sendfile() at least skips the user space
+    // bounce and the read/write loop is the last resort. each method falls
+    // through to the next once it turns out to be unsupported.
+
+public:
+
+    enum Method
+    {
+        CLONE,
+        COPY_RANGE,
+        SEND_FILE,
+        READ_WRITE
+    };
+
+private:
+
+    QFile     *src;
+    QFile     *dst;
+    QByteArray buff;
+    QString    errMsg;
+    qint64     pos;
+    qint64     len;
+    Method     method;
+
+    bool unsupported(int err);
+
+public:
+
+    explicit FileCopier(QFile *source, QFile *dest);
+
+    qint64  step(qint64 maxBytes);
+    bool    atEnd();
+    QString errorString();
+};
+
+//-----------------------
+
+struct CopyJob
+{
+    QString src;
+    QString dst;
+    QString errMsg;
+    qint64  bytes;
+    bool    ok;
+};
+
+class CopyPool
+{
+    // copies the files of a directory copy on a few worker threads. the
+    // command thread keeps doing the walk, the prompts and the symlinks and
+    // collects the finished jobs.
+
+private:
+
+    QMutex          mutex;
+    QWaitCondition  jobReady;
+    QWaitCondition  jobDone;
+    QList<QThread*> workers;
+    QList<CopyJob>  pending;
+    QList<CopyJob>  finished;
+    int             active;
+    bool            stopping;
+
+    bool isStopping();
+    void copyFile(CopyJob *job);
+    void work();
+
+public:
+
+    explicit CopyPool(int threads);
+    ~CopyPool();
+
+    bool           hasRoom();
+    bool           isIdle();
+    void           submit(const QString &srcPath, const QString &dstPath);
+    void           waitForDone(unsigned long msec);
+    QList<CopyJob> takeFinished();
+};
+
+//-----------------------
+
 class Delete : public CmdObject
 {
     Q_OBJECT
@@ -107,13 +423,18 @@ protected:
 
     void ask();
     void run();
+    void collect();
+    void copyStep();
     void onTerminate();
 
+    FileCopier                    *copier;
+    CopyPool                      *pool;
     QFile                         *src;
     QFile                         *dst;
     bool                           fromQueue;
     bool                           yToAll;
     bool                           nToAll;
+    bool                           copyFailed;
     QString                        dstPath;
     QString                        srcPath;
     QString                        oriSrcPath;
@@ -122,7 +443,7 @@ protected:
     virtual bool matchingVolumeMatters();
     virtual bool permissionsOk(bool dstExists);
     virtual void runOnMatchingVolume() {}
-    virtual void postProcFile() {}
+    virtual void postProcFile(const QString &path) {Q_UNUSED(path)}
     virtual void preFinish() {}
 
 public:
@@ -145,7 +466,7 @@ private:
     bool matchingVolumeMatters();
     bool permissionsOk(bool dstExists);
     void runOnMatchingVolume();
-    void postProcFile();
+    void postProcFile(const QString &path);
     void preFinish();
 
 public:
@@ -172,7 +493,82 @@ public:
 
 //-----------------------
 
-class ListFiles : public CmdObject
+class DirStream
+{
+    // unsorted directory reader that returns one entry at a time straight
+    // from readdir() so huge directories never have to be held in memory.
+    // pos()/seek() save and restore the read position so a listing can be
+    // picked up again by a later command call.
+
+private:
+
+#ifdef Q_OS_LINUX
+
+    DIR          *dir;
+
+#else
+
+    QDirIterator *iter;
+    qint64        count;
+
+#endif
+
+    QString       dirPath;
+    bool          noHidden;
+
+public:
+
+    explicit DirStream(const QString &path, bool skipHidden);
+    ~DirStream();
+
+    QString path() const;
+    bool    isOpen() const;
+    bool    next(QFileInfo *info);
+    qint64  pos() const;
+    void    seek(qint64 offs);
+};
+
+//-----------------------
+
+class DirLister : public CmdObject
+{
+    Q_OBJECT
+
+    // the -stream, -cursor and -limit mode shared by fs_list and fs_tree.
+    // entries go out in the order the file system returns them and only one
+    // open directory per level of depth is kept at any time.
+
+protected:
+
+    QList<DirStream*> stack;
+    QByteArray        batch;
+    qint64            limit;
+    qint64            listed;
+    int               maxDepth;
+    bool              infoFrames;
+    bool              batchFrames;
+    bool              noHidden;
+    bool              recurse;
+
+    bool       isStreamMode(const QStringList &args);
+    bool       startStream(const QString &path, const QStringList &args);
+    bool       openCursor(const QString &root, const QString &cursor);
+    void       streamStep();
+    void       listEntry(const QFileInfo &info);
+    void       listInfo(const QByteArray &fileInfo);
+    void       listEncoded(const QByteArray &entry, bool isDir);
+    void       flushBatch();
+    void       onTerminate();
+    QByteArray cursor();
+
+public:
+
+    explicit DirLister(QObject *parent = nullptr);
+};
+
+//-----------------------
+
+class ListFiles : public DirLister
 {
     Q_OBJECT
 
@@ -191,6 +587,16 @@ class FileInfo : public CmdObject
 {
     Q_OBJECT
 
+private:
+
+    StreamHash *hasher;
+    QFile      *file;
+    QString     hashKey;
+
+    void startHash(const QString &path, const QString &algo);
+    void hashStep();
+    void onTerminate();
+
 public:
 
     static QString cmdName();
@@ -217,17 +623,60 @@ public:
 
 //--------------------------
 
-class Tree : public CmdObject
+typedef QPair<QString, int>  WalkDir;   // directory path and its depth.
+typedef QList<QByteArray>    WalkBatch; // encoded FILE_INFO or text entries.
+
+class TreeWalker
+{
+    // parallel directory walker behind fs_tree. each worker thread reads and
+    // stats whole directories on its own and hands the encoded entries back
+    // in batches so the command thread only has to send them out. both the
+    // frontier of directories waiting to be walked and the finished batches
+    // are capped; a worker that finds the frontier full walks the
+    // sub-directory itself, depth first, instead of queuing it.
+
+private:
+
+    QMutex           mutex;
+    QWaitCondition   workReady;
+    QWaitCondition   batchReady;
+    QWaitCondition   batchTaken;
+    QList<QThread*>  workers;
+    QList<WalkDir>   frontier;
+    QList<WalkBatch> batches;
+    int              busy;
+    int              maxDepth;
+    bool             infoFrames;
+    bool             noHidden;
+    bool             sorted;
+    bool             stopping;
+
+    void work();
+    void walk(const WalkDir &dir);
+    void publish(const QFileInfoList &infos);
+    void dispatch(const QList<WalkDir> &dirs);
+    bool isStopping();
+
+public:
+
+    explicit TreeWalker(const QString &root, int threads, int depth, bool info, bool skipHidden, bool sortDirs);
+    ~TreeWalker();
+
+    bool takeBatch(WalkBatch *batch, int waitMsec);
+    bool isDone();
+};
+
+//--------------------------
+
+class Tree : public DirLister
 {
     Q_OBJECT
 
 private:
 
-    QFileInfoList queue;
-    bool          infoFrames;
-    bool          noHidden;
+    TreeWalker *walker;
 
-    void printList(const QString &path);
+    void walkStep();
     void onTerminate();
 
 public:
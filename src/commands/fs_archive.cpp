@@ -0,0 +1,657 @@
+#include "fs_archive.h"
+
+//    This file is part of MRCI.
+
+//    MRCI is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+
+//    MRCI is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+
+//    You should have received a copy of the GNU General Public License
+//    along with MRCI under the LICENSE.md file. If not, see
+//    <http://www.gnu.org/licenses/>.
+
+#ifdef Q_OS_LINUX
+
+#include <climits>
+#include <unistd.h>
+
+#endif
+
+static qint64 tarPadded(qint64 len)
+{
+    return ((len + TAR_BLOCK - 1) / TAR_BLOCK) * TAR_BLOCK;
+}
+
+TarWriter::TarWriter(const QString &rootPath)
+{
+    root     = QDir::cleanPath(rootPath);
+    total    = 0;
+    dataLeft = 0;
+    padLen   = 0;
+    index    = 0;
+    sorted   = false;
+
+    addEntry(root);
+}
+
+int TarWriter::toMode(QFile::Permissions perms)
+{
+    // Qt keeps the owner, group and other bits 4 bits apart from each other.
+
+    auto bits = static_cast<int>(perms);
+
+    return (((bits >> 12) & 7) << 6) | (((bits >> 4) & 7) << 3) | (bits & 7);
+}
+
+QByteArray TarWriter::header(const QByteArray &name, const QByteArray &link, qint64 size, qint64 mtime, int mode, char type)
+{
+    QByteArray ret(TAR_BLOCK, 0);
+
+    auto *blk = ret.data();
+
+    memcpy(blk, name.constData(), static_cast<size_t>(qMin(static_cast<int>(name.size()), TAR_NAME_LEN)));
+    memcpy(blk + 157, link.constData(), static_cast<size_t>(qMin(static_cast<int>(link.size()), TAR_NAME_LEN)));
+
+    qsnprintf(blk + 100, 8, "%07o", static_cast<unsigned int>(mode & 07777));
+    qsnprintf(blk + 108, 8, "%07o", 0u);
+    qsnprintf(blk + 116, 8, "%07o", 0u);
+    qsnprintf(blk + 124, 12, "%011llo", static_cast<unsigned long long>(size));
+    qsnprintf(blk + 136, 12, "%011llo", static_cast<unsigned long long>(qMax(Q_INT64_C(0), mtime)));
+
+    memset(blk + 148, ' ', 8);
+    memcpy(blk + 257, "ustar", 6);
+    memcpy(blk + 263, "00", 2);
+
+    blk[156] = type;
+
+    unsigned int sum = 0;
+
+    for (int i = 0; i < TAR_BLOCK; ++i)
+    {
+        sum += static_cast<quint8>(blk[i]);
+    }
+
+    qsnprintf(blk + 148, 8, "%06o", sum);
+
+    blk[155] = ' ';
+
+    return ret;
+}
+
+QByteArray TarWriter::paxRecord(const QByteArray &key, const QByteArray &val)
+{
+    // each record is prefixed with its own length in decimal, including the
+    // digits of that length.
+
+    auto base = static_cast<int>(key.size() + val.size()) + 3;
+    auto len  = base + 1;
+
+    while (base + QByteArray::number(len).size() != len)
+    {
+        len = base + static_cast<int>(QByteArray::number(len).size());
+    }
+
+    return QByteArray::number(len) + " " + key + "=" + val + "\n";
+}
+
+QByteArray TarWriter::paxRecords(const TarEntry &entry)
+{
+    QByteArray ret;
+
+    if (entry.name.size() > TAR_NAME_LEN) ret.append(paxRecord("path", entry.name));
+    if (entry.link.size() > TAR_NAME_LEN) ret.append(paxRecord("linkpath", entry.link));
+    if (entry.size > TAR_MAX_OCTAL)       ret.append(paxRecord("size", QByteArray::number(entry.size)));
+
+    return ret;
+}
+
+qint64 TarWriter::entryLen(const TarEntry &entry)
+{
+    auto pax = paxRecords(entry);
+    auto ret = static_cast<qint64>(TAR_BLOCK) + tarPadded(entry.size);
+
+    if (!pax.isEmpty())
+    {
+        ret += TAR_BLOCK + tarPadded(pax.size());
+    }
+
+    return ret;
+}
+
+void TarWriter::addEntry(const QString &path)
+{
+    QFileInfo info(path);
+    TarEntry  entry;
+
+    // names are relative to the directory the root is in so the archive
+    // unpacks into a single directory named after the root.
+
+    auto base = QFileInfo(root).path();
+    auto name = QDir(base).relativeFilePath(info.filePath());
+
+    entry.path  = info.filePath();
+    entry.name  = name.toUtf8();
+    entry.size  = 0;
+    entry.mtime = info.lastModified().toSecsSinceEpoch();
+    entry.mode  = toMode(info.permissions());
+
+    if (info.isSymLink())
+    {
+        entry.type = '2';
+
+#ifdef Q_OS_LINUX
+
+        // the link is stored the way it was made so relative links still
+        // work once unpacked somewhere else.
+
+        QByteArray target(PATH_MAX, 0);
+
+        auto len = readlink(QFile::encodeName(entry.path).constData(), target.data(), PATH_MAX);
+
+        if (len < 0) return;
+
+        target.truncate(static_cast<int>(len));
+
+        entry.link = target;
+
+#else
+
+        entry.link = info.symLinkTarget().toUtf8();
+
+#endif
+
+    }
+    else if (info.isDir())
+    {
+        entry.type = '5';
+        entry.name.append('/');
+    }
+    else if (info.isFile())
+    {
+        entry.type = '0';
+        entry.size = info.size();
+    }
+    else
+    {
+        // sockets, fifos and device files are left out.
+
+        return;
+    }
+
+    entries.append(entry);
+
+    total += entryLen(entry);
+    sorted = false;
+}
+
+int TarWriter::count()
+{
+    return entries.size();
+}
+
+qint64 TarWriter::size()
+{
+    if (!sorted)
+    {
+        // the walk hands back entries in whatever order its threads finish
+        // them. sorting by name puts every directory ahead of its contents.
+
+        std::sort(entries.begin(), entries.end(), [](const TarEntry &a, const TarEntry &b) {return a.name < b.name;});
+
+        sorted = true;
+    }
+
+    return total + (TAR_BLOCK * 2);
+}
+
+void TarWriter::nextEntry()
+{
+    const auto &entry = entries[index++];
+
+    auto pax = paxRecords(entry);
+
+    file.close();
+
+    if (!pax.isEmpty())
+    {
+        pending.append(header(TAR_PAX_HEADER, QByteArray(), pax.size(), entry.mtime, 0644, 'x'));
+        pending.append(pax);
+        pending.append(QByteArray(static_cast<int>(tarPadded(pax.size()) - pax.size()), 0));
+    }
+
+    auto size = (entry.size > TAR_MAX_OCTAL) ? 0 : entry.size;
+
+    pending.append(header(entry.name, entry.link, size, entry.mtime, entry.mode, entry.type));
+
+    if (entry.type == '0')
+    {
+        dataLeft = entry.size;
+        padLen   = tarPadded(entry.size) - entry.size;
+
+        file.setFileName(entry.path);
+
+        if (!file.open(QFile::ReadOnly | QFile::Unbuffered))
+        {
+            skipped.append(entry.path);
+        }
+    }
+}
+
+bool TarWriter::read(QByteArray *chunk, int maxLen)
+{
+    size();
+
+    chunk->resize(0);
+    chunk->reserve(maxLen);
+
+    while (chunk->size() < maxLen)
+    {
+        auto room = static_cast<qint64>(maxLen - chunk->size());
+
+        if (!pending.isEmpty())
+        {
+            auto len = static_cast<int>(qMin(room, static_cast<qint64>(pending.size())));
+
+            chunk->append(pending.constData(), len);
+            pending.remove(0, len);
+        }
+        else if (dataLeft > 0)
+        {
+            auto len = static_cast<int>(qMin(room, dataLeft));
+            auto old = static_cast<int>(chunk->size());
+            auto got = qint64(0);
+
+            chunk->resize(old + len);
+
+            if (file.isOpen())
+            {
+                got = file.read(chunk->data() + old, len);
+            }
+
+            if (got < len)
+            {
+                // the size was already promised in the header so a file that
+                // can't be read or shrank since it was stat'ed is padded out
+                // with zeros and reported afterwards.
+
+                if (file.isOpen())
+                {
+                    skipped.append(file.fileName());
+
+                    file.close();
+                }
+
+                memset(chunk->data() + old + qMax(Q_INT64_C(0), got), 0, static_cast<size_t>(len - qMax(Q_INT64_C(0), got)));
+            }
+
+            dataLeft -= len;
+        }
+        else if (padLen > 0)
+        {
+            auto len = static_cast<int>(qMin(room, padLen));
+
+            chunk->append(QByteArray(len, 0));
+
+            padLen -= len;
+        }
+        else if (index < entries.size())
+        {
+            nextEntry();
+        }
+        else if (index == entries.size())
+        {
+            index++;
+
+            file.close();
+            pending.append(QByteArray(TAR_BLOCK * 2, 0));
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    return !chunk->isEmpty();
+}
+
+bool TarWriter::atEnd()
+{
+    return (index > entries.size()) && pending.isEmpty() && (dataLeft == 0) && (padLen == 0);
+}
+
+QStringList TarWriter::skippedFiles()
+{
+    return skipped;
+}
+
+TarReader::TarReader(const QString &dirPath)
+{
+    root       = QDir::cleanPath(dirPath);
+    dataLeft   = 0;
+    padLeft    = 0;
+    paxSize    = -1;
+    zeroBlocks = 0;
+    entryCount = 0;
+    mode       = 0;
+    type       = 0;
+    ended      = false;
+    failed     = false;
+
+    if (!QDir().mkpath(root))
+    {
+        fail("unable to create '" + root + "'");
+    }
+    else
+    {
+        canonRoot = QFileInfo(root).canonicalFilePath();
+    }
+}
+
+qint64 TarReader::rdOctal(const char *field, int len)
+{
+    qint64 ret = 0;
+
+    if (static_cast<quint8>(field[0]) & 0x80)
+    {
+        // GNU base-256 for numbers too big for the octal digits.
+
+        ret = field[0] & 0x3f;
+
+        for (int i = 1; i < len; ++i)
+        {
+            ret = (ret << 8) | static_cast<quint8>(field[i]);
+        }
+    }
+    else
+    {
+        int i = 0;
+
+        while ((i < len) && (field[i] == ' ')) i++;
+
+        for (; (i < len) && (field[i] >= '0') && (field[i] <= '7'); ++i)
+        {
+            ret = (ret << 3) | (field[i] - '0');
+        }
+    }
+
+    return ret;
+}
+
+static QByteArray tarField(const char *field, int len)
+{
+    return QByteArray(field, static_cast<int>(qstrnlen(field, static_cast<uint>(len))));
+}
+
+bool TarReader::fail(const QString &msg)
+{
+    if (!failed)
+    {
+        errMsg = msg;
+        failed = true;
+    }
+
+    file.close();
+
+    return false;
+}
+
+bool TarReader::safePath(const QByteArray &name, QString *path)
+{
+    auto rel   = QString::fromUtf8(name);
+    auto parts = rel.split('/', Qt::SkipEmptyParts);
+
+    parts.removeAll(".");
+
+    if (QDir::isAbsolutePath(rel) || parts.contains(".."))
+    {
+        return fail("'" + rel + "' points outside of the target directory");
+    }
+
+    *path = parts.isEmpty() ? root : root + "/" + parts.join('/');
+
+    // symlinks unpacked earlier (or already in the target directory) could
+    // lead anywhere so the closest existing parent directory is resolved
+    // and has to still be inside of the target.
+
+    auto dir = QFileInfo(*path).path();
+
+    while (!QFileInfo::exists(dir) && (dir != root) && (dir.size() > root.size()))
+    {
+        dir = QFileInfo(dir).path();
+    }
+
+    auto canon = QFileInfo(dir).canonicalFilePath();
+
+    if ((canon != canonRoot) && !canon.startsWith(canonRoot + "/"))
+    {
+        return fail("'" + rel + "' points outside of the target directory");
+    }
+
+    return true;
+}
+
+void TarReader::parsePax()
+{
+    int pos = 0;
+
+    while (pos < meta.size())
+    {
+        auto sp  = meta.indexOf(' ', pos);
+        auto len = (sp == -1) ? 0 : meta.mid(pos, sp - pos).toInt();
+
+        if ((len <= 0) || ((pos + len) > meta.size())) break;
+
+        auto rec = meta.mid(sp + 1, (pos + len) - (sp + 1) - 1);
+        auto eq  = rec.indexOf('=');
+
+        if (eq != -1)
+        {
+            auto key = rec.left(eq);
+            auto val = rec.mid(eq + 1);
+
+            if      (key == "path")     longName = val;
+            else if (key == "linkpath") longLink = val;
+            else if (key == "size")     paxSize  = val.toLongLong();
+        }
+
+        pos += len;
+    }
+}
+
+void TarReader::endData()
+{
+    if      (type == 'x') parsePax();
+    else if (type == 'L') longName = tarField(meta.constData(), meta.size());
+    else if (type == 'K') longLink = tarField(meta.constData(), meta.size());
+
+    meta.clear();
+
+    if (file.isOpen())
+    {
+        file.close();
+        file.setPermissions(static_cast<QFile::Permissions>(((mode & 0700) << 6) | ((mode & 0700) << 2) | ((mode & 070) << 1) | (mode & 07)));
+    }
+}
+
+bool TarReader::parseHeader(const char *block)
+{
+    unsigned int sum     = 0;
+    bool         allZero = true;
+
+    for (int i = 0; i < TAR_BLOCK; ++i)
+    {
+        auto byte = static_cast<quint8>(block[i]);
+
+        if (byte != 0) allZero = false;
+
+        sum += ((i >= 148) && (i < 156)) ? ' ' : byte;
+    }
+
+    if (allZero)
+    {
+        ended = (++zeroBlocks >= 2);
+
+        return true;
+    }
+
+    zeroBlocks = 0;
+
+    if (sum != static_cast<unsigned int>(rdOctal(block + 148, 8)))
+    {
+        return fail("the data is not a tar archive or is corrupt");
+    }
+
+    type = block[156] ? block[156] : '0';
+    mode = static_cast<int>(rdOctal(block + 100, 8));
+
+    auto size = (paxSize >= 0) ? paxSize : rdOctal(block + 124, 12);
+    auto name = longName.isEmpty() ? tarField(block, TAR_NAME_LEN) : longName;
+    auto link = longLink.isEmpty() ? tarField(block + 157, TAR_NAME_LEN) : longLink;
+
+    if (longName.isEmpty() && (memcmp(block + 257, "ustar", 5) == 0) && block[345])
+    {
+        name = tarField(block + 345, 155) + "/" + name;
+    }
+
+    if ((type == 'x') || (type == 'g') || (type == 'L') || (type == 'K'))
+    {
+        size = rdOctal(block + 124, 12);
+
+        if (size > TAR_MAX_META)
+        {
+            return fail("an extended header in the archive is too large");
+        }
+    }
+    else
+    {
+        QString path;
+
+        longName.clear();
+        longLink.clear();
+
+        paxSize = -1;
+
+        if (!safePath(name, &path))
+        {
+            return false;
+        }
+        else if (type == '5')
+        {
+            if (!QDir().mkpath(path)) return fail("unable to create directory '" + path + "'");
+
+            entryCount++;
+        }
+        else if ((type == '0') || (type == '7') || (type == '2'))
+        {
+            QFileInfo info(path);
+
+            // an existing symlink is replaced rather than followed.
+
+            if (info.isSymLink() || (info.exists() && !info.isDir()))
+            {
+                QFile::remove(path);
+            }
+
+            if (!QDir().mkpath(info.path())) return fail("unable to create directory '" + info.path() + "'");
+
+            if (type == '2')
+            {
+                if (!QFile::link(QString::fromUtf8(link), path)) return fail("unable to create symlink '" + path + "'");
+            }
+            else
+            {
+                file.setFileName(path);
+
+                if (!file.open(QFile::WriteOnly | QFile::Truncate)) return fail("unable to open '" + path + "' for writing. reason: " + file.errorString());
+            }
+
+            entryCount++;
+        }
+
+        // hard links and device entries are not unpacked; any data they carry
+        // is read past.
+    }
+
+    dataLeft = size;
+    padLeft  = tarPadded(size) - size;
+
+    if (dataLeft == 0)
+    {
+        endData();
+    }
+
+    return !failed;
+}
+
+bool TarReader::write(const QByteArray &data)
+{
+    int pos = 0;
+
+    while ((pos < data.size()) && !failed && !ended)
+    {
+        auto avail = static_cast<qint64>(data.size() - pos);
+
+        if (dataLeft > 0)
+        {
+            auto len = static_cast<int>(qMin(avail, dataLeft));
+
+            if ((type == 'x') || (type == 'g') || (type == 'L') || (type == 'K'))
+            {
+                meta.append(data.constData() + pos, len);
+            }
+            else if (file.isOpen() && (file.write(data.constData() + pos, len) != len))
+            {
+                return fail("file IO failure on '" + file.fileName() + "'. reason: " + file.errorString());
+            }
+
+            dataLeft -= len;
+            pos      += len;
+
+            if (dataLeft == 0) endData();
+        }
+        else if (padLeft > 0)
+        {
+            auto len = static_cast<int>(qMin(avail, padLeft));
+
+            padLeft -= len;
+            pos     += len;
+        }
+        else
+        {
+            auto len = static_cast<int>(qMin(avail, static_cast<qint64>(TAR_BLOCK - buff.size())));
+
+            buff.append(data.constData() + pos, len);
+
+            pos += len;
+
+            if (buff.size() == TAR_BLOCK)
+            {
+                parseHeader(buff.constData());
+                buff.clear();
+            }
+        }
+    }
+
+    return !failed;
+}
+
+bool TarReader::isDone()
+{
+    return ended;
+}
+
+int TarReader::count()
+{
+    return entryCount;
+}
+
+QString TarReader::errorString()
+{
+    return errMsg;
+}
@@ -0,0 +1,129 @@
+#ifndef FS_ARCHIVE_H
+#define FS_ARCHIVE_H
+
+//    This file is part of MRCI.
+
+//    MRCI is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+
+//    MRCI is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+
+//    You should have received a copy of the GNU General Public License
+//    along with MRCI under the LICENSE.md file. If not, see
+//    <http://www.gnu.org/licenses/>.
+
+#include "../common.h"
+
+#include <algorithm>
+
+#define TAR_BLOCK      512
+#define TAR_NAME_LEN   100
+#define TAR_MAX_OCTAL  Q_INT64_C(8589934591) // largest size an 11 digit octal field can hold.
+#define TAR_PAX_HEADER "././@PaxHeader"
+#define TAR_MAX_META   1048576 // largest pax or GNU long name entry the reader will take.
+
+struct TarEntry
+{
+    QString    path;
+    QByteArray name;
+    QByteArray link;
+    qint64     size;
+    qint64     mtime;
+    int        mode;
+    char       type;
+};
+
+class TarWriter
+{
+    // streams a list of file system objects as a ustar archive, with pax
+    // records for the names, link targets and sizes ustar can't hold. the
+    // entries are all added before the first read() so the size of the
+    // whole archive is known up front and can go in the GEN_FILE -len like
+    // any other download.
+
+private:
+
+    QList<TarEntry> entries;
+    QFile           file;
+    QByteArray      pending;
+    QStringList     skipped;
+    QString         root;
+    qint64          total;
+    qint64          dataLeft;
+    qint64          padLen;
+    int             index;
+    bool            sorted;
+
+    static QByteArray paxRecord(const QByteArray &key, const QByteArray &val);
+    static QByteArray paxRecords(const TarEntry &entry);
+    static qint64     entryLen(const TarEntry &entry);
+    void              nextEntry();
+
+public:
+
+    static QByteArray header(const QByteArray &name, const QByteArray &link, qint64 size, qint64 mtime, int mode, char type);
+    static int        toMode(QFile::Permissions perms);
+
+    explicit TarWriter(const QString &rootPath);
+
+    void        addEntry(const QString &path);
+    int         count();
+    qint64      size();
+    bool        read(QByteArray *chunk, int maxLen);
+    bool        atEnd();
+    QStringList skippedFiles();
+};
+
+//-----------------------
+
+class TarReader
+{
+    // unpacks a tar stream into a directory as the data comes in. understands
+    // ustar, pax path/linkpath/size records and the GNU long name entries.
+    // nothing is written outside of the target directory; names that climb
+    // out of it or go through a symlink that does are refused.
+
+private:
+
+    QFile      file;
+    QByteArray buff;
+    QByteArray meta;
+    QByteArray longName;
+    QByteArray longLink;
+    QString    root;
+    QString    canonRoot;
+    QString    errMsg;
+    qint64     dataLeft;
+    qint64     padLeft;
+    qint64     paxSize;
+    int        zeroBlocks;
+    int        entryCount;
+    int        mode;
+    char       type;
+    bool       ended;
+    bool       failed;
+
+    static qint64 rdOctal(const char *field, int len);
+
+    bool    parseHeader(const char *block);
+    void    parsePax();
+    bool    safePath(const QByteArray &name, QString *path);
+    bool    fail(const QString &msg);
+    void    endData();
+
+public:
+
+    explicit TarReader(const QString &dirPath);
+
+    bool    write(const QByteArray &data);
+    bool    isDone();
+    int     count();
+    QString errorString();
+};
+
+#endif // FS_ARCHIVE_H
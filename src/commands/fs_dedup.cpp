@@ -0,0 +1,506 @@
+#include "fs_dedup.h"
+
+//    This file is part of MRCI.
+
+//    MRCI is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+
+//    MRCI is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+
+//    You should have received a copy of the GNU General Public License
+//    along with MRCI under the LICENSE.md file. If not, see
+//    <http://www.gnu.org/licenses/>.
+
+DedupUpload::DedupUpload(QObject *parent) : CmdObject(parent) {store = nullptr; hasher = nullptr; part = nullptr; out = nullptr; setStepBudget(STEP_MSEC, LOCAL_BUFFSIZE); onTerminate();}
+
+QString DedupUpload::cmdName() {return "fs_dedup_up";}
+
+int dedupChunkSize(qint64 len, qint64 requested)
+{
+    // rounded up to DEDUP_ALIGN and raised if needed to keep the hash list
+    // in check. returns 0 if the file is too large even at the max size.
+
+    qint64 ret = (requested > 0) ? requested : DEDUP_CHUNK;
+
+    ret = ((ret + DEDUP_ALIGN - 1) / DEDUP_ALIGN) * DEDUP_ALIGN;
+    ret = qBound(static_cast<qint64>(DEDUP_MIN_CHUNK), ret, static_cast<qint64>(DEDUP_MAX_CHUNK));
+
+    while (((len + ret - 1) / ret > DEDUP_MAX_CHUNKS) && (ret < DEDUP_MAX_CHUNK)) ret *= 2;
+
+    if ((len + ret - 1) / ret > DEDUP_MAX_CHUNKS) ret = 0;
+
+    return static_cast<int>(ret);
+}
+
+void DedupUpload::onTerminate()
+{
+    delete store;
+    delete hasher;
+    delete part;
+    delete out;
+
+    store  = nullptr;
+    hasher = nullptr;
+    part   = nullptr;
+    out    = nullptr;
+
+    hashes.clear();
+    needMap.clear();
+    needList.clear();
+    requested.clear();
+    path.clear();
+
+    len      = 0;
+    chunk    = 0;
+    count    = 0;
+    looked   = 0;
+    needIdx  = 0;
+    partLen  = 0;
+    received = 0;
+    copyIdx  = 0;
+    stage    = HASHES;
+    method   = CLONE;
+    ssMode   = false;
+    confirm  = false;
+    flags    = 0;
+}
+
+void DedupUpload::fail(const QString &msg, quint16 code)
+{
+    retCode = code;
+
+    errTxt(msg);
+    onTerminate();
+}
+
+QByteArray DedupUpload::hashAt(qint64 idx)
+{
+    return hashes.mid(static_cast<int>(idx * DEDUP_HASH_LEN), DEDUP_HASH_LEN);
+}
+
+qint64 DedupUpload::chunkLen(qint64 idx)
+{
+    return qMin(chunk, len - (idx * chunk));
+}
+
+void DedupUpload::ask()
+{
+    confirm = true;
+
+    promptTxt("'" + path + "' already exists, do you want to overwrite? (y/n): ");
+}
+
+void DedupUpload::run()
+{
+    store = new ChunkStore(ChunkStore::spaceName(rdFromBlock(userId, BLKSIZE_USER_ID), confObject()[CONF_CHUNK_STORE_SHARED].toBool()));
+    flags = MORE_INPUT;
+
+    emit procOut(QString("-chunk " + QString::number(chunk) + " -count " + QString::number(count)).toUtf8(), GEN_FILE);
+
+    // an empty file has no hashes to wait for.
+
+    hashesIn(QByteArray());
+}
+
+void DedupUpload::hashesIn(const QByteArray &data)
+{
+    hashes.append(data);
+
+    if (hashes.size() > (count * DEDUP_HASH_LEN))
+    {
+        fail("err: The client sent more chunk hashes than the -count the host asked for.\n", INVALID_PARAMS);
+    }
+    else if (hashes.size() == (count * DEDUP_HASH_LEN))
+    {
+        needMap = QByteArray(static_cast<int>((count + 7) / 8), 0);
+        stage   = LOOKUP;
+        flags  |= LOOPING;
+    }
+}
+
+void DedupUpload::lookupStep()
+{
+    auto last = qMin(looked + DEDUP_LOOKUP_STEP, count);
+
+    for (; looked < last; ++looked)
+    {
+        // a chunk that shows up more than once in the file is only asked for
+        // the first time; it is in the store by the time the rest are needed.
+
+        auto hash = hashAt(looked);
+
+        if (!requested.contains(hash) && !store->has(hash, chunkLen(looked)))
+        {
+            needMap[static_cast<int>(looked / 8)] = static_cast<char>(needMap[static_cast<int>(looked / 8)] | (1 << (looked % 8)));
+
+            requested.insert(hash);
+            needList.append(looked);
+
+            progMax += chunkLen(looked);
+        }
+    }
+
+    if (looked == count)
+    {
+        qint64 needLen = progMax - len;
+
+        emit procOut(QString("-need " + QString::number(needList.size()) + " -len " + QString::number(needLen)).toUtf8(), GEN_FILE);
+        emit procOut(needMap, GEN_FILE);
+
+        if (needList.isEmpty())
+        {
+            stage = ASSEMBLE;
+        }
+        else
+        {
+            stage  = CHUNK_DATA;
+            flags &= ~LOOPING;
+        }
+    }
+}
+
+bool DedupUpload::finishChunk()
+{
+    // a chunk only goes in the store under the hash it actually has so a
+    // client can't plant data under some other chunk's hash.
+
+    auto idx  = needList[static_cast<int>(needIdx)];
+    auto hash = hashAt(idx);
+    auto ret  = false;
+
+    part->close();
+
+    if (hasher->result() != hash)
+    {
+        fail("err: Chunk " + QString::number(idx) + " does not match its hash.\n", EXECUTION_FAIL);
+    }
+    else if (!store->insert(part->fileName(), hash, partLen))
+    {
+        fail("err: Unable to add chunk " + QString::number(idx) + " to the chunk store.\n", EXECUTION_FAIL);
+    }
+    else
+    {
+        delete part;
+        delete hasher;
+
+        part    = nullptr;
+        hasher  = nullptr;
+        partLen = 0;
+        ret     = true;
+
+        needIdx++;
+    }
+
+    return ret;
+}
+
+void DedupUpload::dataIn(const QByteArray &data)
+{
+    qint64 pos = 0;
+
+    while (pos < data.size())
+    {
+        if (needIdx >= needList.size())
+        {
+            fail("err: The client sent more chunk data than the host asked for.\n", INVALID_PARAMS); return;
+        }
+
+        if (part == nullptr)
+        {
+            mkPath(store->path());
+
+            part   = new QTemporaryFile(store->path() + "/XXXXXX.part", this);
+            hasher = new StreamHash("sha256");
+
+            if (!part->open())
+            {
+                fail("err: Unable to open a chunk file for writing. reason: " + part->errorString() + "\n", EXECUTION_FAIL); return;
+            }
+        }
+
+        auto idx  = needList[static_cast<int>(needIdx)];
+        auto take = qMin(chunkLen(idx) - partLen, data.size() - pos);
+
+        if (part->write(data.constData() + pos, take) != take)
+        {
+            fail("err: File IO failure: " + part->errorString() + ".\n", EXECUTION_FAIL); return;
+        }
+
+        hasher->addData(data.constData() + pos, take);
+
+        pos         += take;
+        partLen     += take;
+        received    += take;
+        progCurrent += take;
+
+        stepIo(take);
+
+        if ((partLen == chunkLen(idx)) && !finishChunk())
+        {
+            return;
+        }
+    }
+
+    if (needIdx == needList.size())
+    {
+        stage  = ASSEMBLE;
+        flags |= LOOPING;
+    }
+    else if (ssMode)
+    {
+        emit procOut(QByteArray(), GEN_FILE);
+    }
+}
+
+bool DedupUpload::copyChunk(QFile *src, qint64 dstOffs, qint64 srcLen, QString *errMsg)
+{
+    // same idea as FileCopier except every chunk lands at its own offset in
+    // the output. a method that turns out to be unsupported is dropped for
+    // the rest of the file.
+
+    qint64 done = 0;
+
+#ifdef Q_OS_LINUX
+
+    auto in  = src->handle();
+    auto dst = out->handle();
+
+#ifdef FICLONERANGE
+
+    if (method == CLONE)
+    {
+        struct file_clone_range range;
+
+        range.src_fd      = in;
+        range.src_offset  = 0;
+        range.src_length  = 0; // to the end of the chunk, which also covers a short last chunk.
+        range.dest_offset = static_cast<quint64>(dstOffs);
+
+        if (ioctl(dst, FICLONERANGE, &range) == 0) return true;
+
+        method = COPY_RANGE;
+    }
+
+#else
+
+    if (method == CLONE) method = COPY_RANGE;
+
+#endif
+
+    while ((method == COPY_RANGE) && (done < srcLen))
+    {
+        loff_t inOffs  = done;
+        loff_t outOffs = dstOffs + done;
+
+        auto ret = copy_file_range(in, &inOffs, dst, &outOffs, static_cast<size_t>(srcLen - done), 0);
+
+        if (ret > 0)
+        {
+            done += ret;
+        }
+        else if ((ret == 0) || ((done == 0) && ((errno == ENOSYS) || (errno == EXDEV) || (errno == EINVAL) || (errno == EOPNOTSUPP))))
+        {
+            method = READ_WRITE;
+        }
+        else
+        {
+            *errMsg = QString::fromLocal8Bit(strerror(errno)); return false;
+        }
+    }
+
+    if (method == READ_WRITE)
+    {
+        QByteArray buff(static_cast<int>(srcLen - done), 0);
+
+        auto ret = pread(in, buff.data(), static_cast<size_t>(buff.size()), done);
+
+        if ((ret != static_cast<ssize_t>(buff.size())) || (pwrite(dst, buff.constData(), static_cast<size_t>(ret), dstOffs + done) != ret))
+        {
+            *errMsg = QString::fromLocal8Bit(strerror(errno)); return false;
+        }
+    }
+
+#else
+
+    // chunks are put together in order so a plain sequential write works
+    // here; there is no reflink to try.
+
+    Q_UNUSED(dstOffs)
+
+    auto data = src->read(srcLen);
+
+    if ((data.size() != srcLen) || (out->write(data) != srcLen))
+    {
+        *errMsg = out->errorString(); return false;
+    }
+
+#endif
+
+    return true;
+}
+
+void DedupUpload::assembleStep()
+{
+    if (out == nullptr)
+    {
+        mkPathForFile(path);
+
+        out = new QSaveFile(path, this);
+
+        if (!out->open(QFile::WriteOnly))
+        {
+            fail("err: Unable to open the remote file for writing. reason: " + out->errorString() + "\n", EXECUTION_FAIL); return;
+        }
+    }
+
+    if (copyIdx < count)
+    {
+        QFile   src(store->chunkPath(hashAt(copyIdx)));
+        QString errMsg;
+
+        auto srcLen = chunkLen(copyIdx);
+
+        if (!src.open(QFile::ReadOnly) || (src.size() != srcLen))
+        {
+            fail("err: Chunk " + QString::number(copyIdx) + " is missing from the chunk store or has the wrong size. try the upload again.\n", EXECUTION_FAIL);
+        }
+        else if (!copyChunk(&src, copyIdx * chunk, srcLen, &errMsg))
+        {
+            fail("err: File IO failure: " + errMsg + ".\n", EXECUTION_FAIL);
+        }
+        else
+        {
+            progCurrent += srcLen;
+
+            stepIo(srcLen);
+
+            copyIdx++;
+        }
+    }
+    else if (!out->commit())
+    {
+        fail("err: Unable to write the remote file. reason: " + out->errorString() + "\n", EXECUTION_FAIL);
+    }
+    else
+    {
+        store->addUpload(len, received);
+
+        mainTxt("deduped: " + QString::number(len - received) + " bytes\n");
+        mainTxt("sent:    " + QString::number(received) + " bytes\n");
+        onTerminate();
+    }
+}
+
+void DedupUpload::procIn(const QByteArray &binIn, quint8 dType)
+{
+    if (((dType == GEN_FILE) || (dType == TEXT)) && confirm)
+    {
+        auto ans = QString::fromUtf8(binIn);
+
+        if (noCaseMatch("y", ans))
+        {
+            confirm = false;
+
+            run();
+        }
+        else if (noCaseMatch("n", ans))
+        {
+            retCode = ABORTED;
+
+            onTerminate();
+        }
+        else
+        {
+            ask();
+        }
+    }
+    else if ((dType == TEXT) && (flags & LOOPING) && binIn.isEmpty())
+    {
+        if (stage == LOOKUP)
+        {
+            lookupStep();
+        }
+        else if (stage == ASSEMBLE)
+        {
+            assembleStep();
+        }
+    }
+    else if ((dType == GEN_FILE) && (flags & MORE_INPUT))
+    {
+        if (stage == HASHES)
+        {
+            hashesIn(binIn);
+        }
+        else if (stage == CHUNK_DATA)
+        {
+            dataIn(binIn);
+        }
+        else if (!binIn.isEmpty())
+        {
+            fail("err: The client sent data before the host asked for it.\n", INVALID_PARAMS);
+        }
+    }
+    else if (dType == GEN_FILE)
+    {
+        auto args   = parseArgs(binIn, 13);
+        auto dst    = getParam("-remote_file", args);
+        auto lenStr = getParam("-len", args);
+        auto chkStr = getParam("-chunk", args);
+
+        QFileInfo info(dst);
+
+        retCode = INVALID_PARAMS;
+
+        if (dst.isEmpty())
+        {
+            errTxt("err: The remote file path argument (-remote_file) was not found or is empty.\n");
+        }
+        else if (!isInt(lenStr) || (lenStr.toLongLong() < 0))
+        {
+            errTxt("err: The data len argument (-len) was not found or is not a valid integer.\n");
+        }
+        else if (!chkStr.isEmpty() && !isInt(chkStr))
+        {
+            errTxt("err: Chunk size '" + chkStr + "' is not a valid integer.\n");
+        }
+        else if (dedupChunkSize(lenStr.toLongLong(), chkStr.toLongLong()) == 0)
+        {
+            errTxt("err: The file is too large to upload in chunks.\n");
+        }
+        else if (info.exists() && !info.isFile())
+        {
+            errTxt("err: The remote file is not a file.\n");
+        }
+        else
+        {
+            path     = dst;
+            len      = lenStr.toLongLong();
+            chunk    = dedupChunkSize(len, chkStr.toLongLong());
+            count    = (len + chunk - 1) / chunk;
+            ssMode   = argExists("-single_step", args);
+            progMax  = len;
+            retCode  = NO_ERRORS;
+
+            emit mainTxt("dedup_file: " + path + "\n");
+            emit mainTxt("bytes:      " + QString::number(len) + "\n");
+
+            startProgPulse();
+
+            if (info.exists() && !argExists("-force", args))
+            {
+                flags |= MORE_INPUT;
+
+                ask();
+            }
+            else
+            {
+                run();
+            }
+        }
+    }
+}
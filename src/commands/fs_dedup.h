@@ -0,0 +1,107 @@
+#ifndef FS_DEDUP_H
+#define FS_DEDUP_H
+
+//    This file is part of MRCI.
+
+//    MRCI is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+
+//    MRCI is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+
+//    You should have received a copy of the GNU General Public License
+//    along with MRCI under the LICENSE.md file. If not, see
+//    <http://www.gnu.org/licenses/>.
+
+#include "fs.h"
+#include "../chunk_store.h"
+
+#include <QTemporaryFile>
+
+#define DEDUP_CHUNK       1048576
+#define DEDUP_MIN_CHUNK   65536
+#define DEDUP_MAX_CHUNK   8388608
+#define DEDUP_ALIGN       65536   // chunk sizes are a multiple of this so reflinked chunks line up with file system blocks.
+#define DEDUP_MAX_CHUNKS  4194304 // the chunk size is raised if a file would need more chunks than this.
+#define DEDUP_HASH_LEN    32      // sha256 of each chunk.
+#define DEDUP_LOOKUP_STEP 4096    // chunk hashes looked up in the store by a single step.
+
+int dedupChunkSize(qint64 len, qint64 requested = 0);
+
+class DedupUpload : public CmdObject
+{
+    Q_OBJECT
+
+    // the client sends the sha256 of each fixed size chunk of its file, the
+    // host answers with the chunks its store doesn't have yet and the client
+    // only sends those. the file is then put together from the store, with
+    // reflinks where the file system can share the chunk extents outright.
+
+public:
+
+    enum Stage
+    {
+        HASHES,
+        LOOKUP,
+        CHUNK_DATA,
+        ASSEMBLE
+    };
+
+    enum Method
+    {
+        CLONE,
+        COPY_RANGE,
+        READ_WRITE
+    };
+
+private:
+
+    ChunkStore       *store;
+    StreamHash       *hasher;
+    QTemporaryFile   *part;
+    QSaveFile        *out;
+    QByteArray        hashes;
+    QByteArray        needMap;
+    QList<qint64>     needList;
+    QSet<QByteArray>  requested;
+    QString           path;
+    qint64            len;
+    qint64            chunk;
+    qint64            count;
+    qint64            looked;
+    qint64            needIdx;
+    qint64            partLen;
+    qint64            received;
+    qint64            copyIdx;
+    Stage             stage;
+    Method            method;
+    bool              ssMode;
+    bool              confirm;
+
+    QByteArray hashAt(qint64 idx);
+    qint64     chunkLen(qint64 idx);
+    bool       copyChunk(QFile *src, qint64 dstOffs, qint64 srcLen, QString *errMsg);
+    void       fail(const QString &msg, quint16 code);
+    void       hashesIn(const QByteArray &data);
+    void       lookupStep();
+    void       dataIn(const QByteArray &data);
+    bool       finishChunk();
+    void       assembleStep();
+    void       onTerminate();
+    void       run();
+    void       ask();
+
+public:
+
+    static QString cmdName();
+
+    void procIn(const QByteArray &binIn, quint8 dType);
+
+    explicit DedupUpload(QObject *parent = nullptr);
+};
+
+#endif // FS_DEDUP_H
@@ -0,0 +1,210 @@
+#include "fs_hash.h"
+
+//    This file is part of MRCI.
+
+//    MRCI is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+
+//    MRCI is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+
+//    You should have received a copy of the GNU General Public License
+//    along with MRCI under the LICENSE.md file. If not, see
+//    <http://www.gnu.org/licenses/>.
+
+#ifdef Q_OS_LINUX
+
+#include <sys/stat.h>
+
+#endif
+
+QString hashArg(const QStringList &args)
+{
+    // -hash on its own picks the default digest.
+
+    QString ret;
+
+    if (argExists("-hash", args))
+    {
+        ret = getParam("-hash", args).toLower();
+
+        if (ret.isEmpty()) ret = HASH_DEFAULT;
+    }
+
+    return ret;
+}
+
+QStringList StreamHash::names()
+{
+    return QStringList() << "sha256" << "sha512" << "sha3_256" << "blake2b512" << "blake2s256";
+}
+
+const EVP_MD *StreamHash::digest(const QString &name)
+{
+    if      (name == "sha256")     return EVP_sha256();
+    else if (name == "sha512")     return EVP_sha512();
+    else if (name == "sha3_256")   return EVP_sha3_256();
+    else if (name == "blake2b512") return EVP_blake2b512();
+    else if (name == "blake2s256") return EVP_blake2s256();
+    else                           return nullptr;
+}
+
+StreamHash::StreamHash(const QString &name)
+{
+    algo = name;
+    ctx  = EVP_MD_CTX_new();
+
+    EVP_DigestInit_ex(ctx, digest(name), nullptr);
+}
+
+StreamHash::~StreamHash()
+{
+    EVP_MD_CTX_free(ctx);
+}
+
+void StreamHash::addData(const char *data, qint64 len)
+{
+    EVP_DigestUpdate(ctx, data, static_cast<size_t>(len));
+}
+
+void StreamHash::addData(const QByteArray &data)
+{
+    addData(data.constData(), data.size());
+}
+
+void StreamHash::reset()
+{
+    EVP_DigestInit_ex(ctx, digest(algo), nullptr);
+}
+
+QByteArray StreamHash::result()
+{
+    QByteArray   ret(EVP_MAX_MD_SIZE, 0);
+    unsigned int len = 0;
+
+    EVP_DigestFinal_ex(ctx, reinterpret_cast<unsigned char*>(ret.data()), &len);
+
+    ret.truncate(static_cast<int>(len));
+
+    return ret;
+}
+
+QString StreamHash::name()
+{
+    return algo;
+}
+
+QString HashCache::key(const QString &path, const QString &algo)
+{
+    QString ret;
+
+#ifdef Q_OS_LINUX
+
+    struct stat st;
+
+    if (stat(QFile::encodeName(path).constData(), &st) == 0)
+    {
+        ret = algo + "-" + QString::number(static_cast<quint64>(st.st_dev), 16) + "-" +
+                           QString::number(static_cast<quint64>(st.st_ino), 16) + "-" +
+                           QString::number(static_cast<qint64>(st.st_size))      + "-" +
+                           QString::number(static_cast<qint64>(st.st_mtim.tv_sec)) + "." +
+                           QString::number(static_cast<qint64>(st.st_mtim.tv_nsec)) + "-" +
+                           QString::number(static_cast<qint64>(st.st_ctim.tv_sec)) + "." +
+                           QString::number(static_cast<qint64>(st.st_ctim.tv_nsec));
+    }
+
+#else
+
+    // no inode to go by here so the full path takes its place.
+
+    QFileInfo info(path);
+
+    if (info.exists())
+    {
+        QCryptographicHash hasher(QCryptographicHash::Sha3_256);
+
+        hasher.addData(info.absoluteFilePath().toUtf8());
+
+        ret = algo + "-" + QString::fromLatin1(hasher.result().toHex().left(32)) + "-" +
+                           QString::number(info.size()) + "-" +
+                           QString::number(info.lastModified().toMSecsSinceEpoch()) + "-" +
+                           QString::number(info.metadataChangeTime().toMSecsSinceEpoch());
+    }
+
+#endif
+
+    return ret;
+}
+
+QString HashCache::entryPath(const QString &key)
+{
+    return getLocalFilePath(QString(HASH_DIRNAME) + "/" + key, true);
+}
+
+QByteArray HashCache::find(const QString &key)
+{
+    QByteArray ret;
+
+    if (key.isEmpty()) return ret;
+
+    QFile file(entryPath(key));
+
+    if (file.open(QFile::ReadOnly))
+    {
+        ret = QByteArray::fromHex(file.readAll().trimmed());
+
+        // entries are aged by when they were last used, not made.
+
+        file.close();
+        file.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+    }
+
+    return ret;
+}
+
+bool HashCache::store(const QString &path, const QString &algo, const QString &keyBefore, const QByteArray &digest)
+{
+    // a file that changed while it was being hashed gets a new key so the
+    // digest, which could be of neither version, is dropped.
+
+    if (keyBefore.isEmpty() || (key(path, algo) != keyBefore)) return false;
+
+    auto entry = entryPath(keyBefore);
+
+    mkPath(QFileInfo(entry).path());
+
+    QSaveFile file(entry);
+
+    auto ret = false;
+
+    if (file.open(QFile::WriteOnly))
+    {
+        file.write(digest.toHex());
+
+        ret = file.commit();
+    }
+
+    if (QRandomGenerator::global()->bounded(HASH_PURGE_ODDS) == 0)
+    {
+        purgeStale();
+    }
+
+    return ret;
+}
+
+void HashCache::purgeStale()
+{
+    auto limit = QDateTime::currentDateTime().addDays(-HASH_MAX_AGE_DAYS);
+
+    for (auto &&info : QDir(getLocalFilePath(HASH_DIRNAME, true)).entryInfoList(QDir::Files))
+    {
+        if (info.lastModified() < limit)
+        {
+            QFile::remove(info.filePath());
+        }
+    }
+}
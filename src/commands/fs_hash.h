@@ -0,0 +1,82 @@
+#ifndef FS_HASH_H
+#define FS_HASH_H
+
+//    This file is part of MRCI.
+
+//    MRCI is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+
+//    MRCI is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+
+//    You should have received a copy of the GNU General Public License
+//    along with MRCI under the LICENSE.md file. If not, see
+//    <http://www.gnu.org/licenses/>.
+
+#include "../common.h"
+
+#include <QSaveFile>
+#include <QRandomGenerator>
+#include <openssl/evp.h>
+
+#define HASH_DEFAULT       "sha256"
+#define HASH_DIRNAME       "hashes"
+#define HASH_READ_SIZE     4194304 // file data hashed by a single fs_info -hash step.
+#define HASH_MAX_AGE_DAYS  30      // cache entries not used within this many days are deleted.
+#define HASH_PURGE_ODDS    64      // one in this many cache stores also purges the stale entries.
+
+QString hashArg(const QStringList &args);
+
+class StreamHash
+{
+    // incremental digest over OpenSSL's EVP interface. OpenSSL picks the
+    // SHA-NI/AVX2 code for the running CPU on its own so this is a good deal
+    // faster than QCryptographicHash on large transfers.
+
+private:
+
+    EVP_MD_CTX *ctx;
+    QString     algo;
+
+public:
+
+    static const EVP_MD *digest(const QString &name);
+    static QStringList   names();
+
+    explicit StreamHash(const QString &name);
+    ~StreamHash();
+
+    void       addData(const char *data, qint64 len);
+    void       addData(const QByteArray &data);
+    void       reset();
+    QByteArray result();
+    QString    name();
+};
+
+//-----------------------
+
+class HashCache
+{
+    // whole file digests kept on disk, keyed by the device, inode, size,
+    // modification time and status change time of the file so any change to
+    // it makes the old entry unreachable, even when the mtime was put back
+    // (touch -r, rsync -t, cp -p). every command runs in its own process so the cache is a
+    // directory of tiny files rather than anything in memory.
+
+private:
+
+    static QString entryPath(const QString &key);
+    static void    purgeStale();
+
+public:
+
+    static QString    key(const QString &path, const QString &algo);
+    static QByteArray find(const QString &key);
+    static bool       store(const QString &path, const QString &algo, const QString &keyBefore, const QByteArray &digest);
+};
+
+#endif // FS_HASH_H
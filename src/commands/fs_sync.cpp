@@ -0,0 +1,1070 @@
+#include "fs_sync.h"
+
+//    This file is part of MRCI.
+
+//    MRCI is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+
+//    MRCI is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+
+//    You should have received a copy of the GNU General Public License
+//    along with MRCI under the LICENSE.md file. If not, see
+//    <http://www.gnu.org/licenses/>.
+
+SyncUpload::SyncUpload(QObject *parent)     : CmdObject(parent), outHash("sha256") {basis = new QFile(this); out = nullptr; sigJob = nullptr; opsQueued = 0; setStepBudget(STEP_MSEC, LOCAL_BUFFSIZE); onTerminate();}
+SyncDownload::SyncDownload(QObject *parent) : CmdObject(parent) {scanner = nullptr; setStepBudget(STEP_MSEC, LOCAL_BUFFSIZE); onTerminate();}
+
+QString SyncUpload::cmdName()   {return "fs_sync_up";}
+QString SyncDownload::cmdName() {return "fs_sync_down";}
+
+int syncBlockSize(qint64 len, int requested)
+{
+    // about the square root of the file size unless the client asked for
+    // something else, then raised if needed to keep the signature count in
+    // check.
+
+    qint64 ret = requested;
+
+    if (ret <= 0)
+    {
+        ret = SYNC_MIN_BLOCK;
+
+        while (((ret * ret) < len) && (ret < SYNC_MAX_BLOCK)) ret *= 2;
+    }
+
+    while ((syncBlockCount(len, static_cast<int>(ret)) > SYNC_MAX_BLOCKS) && (ret < SYNC_MAX_BLOCK)) ret *= 2;
+
+    return static_cast<int>(qBound(static_cast<qint64>(SYNC_MIN_BLOCK), ret, static_cast<qint64>(SYNC_MAX_BLOCK)));
+}
+
+qint64 syncBlockCount(qint64 len, int block)
+{
+    // written so it can't overflow on a -len near the top of qint64.
+
+    return (len / block) + (((len % block) != 0) ? 1 : 0);
+}
+
+#ifdef __SSE2__
+
+static quint32 hsum(__m128i vec)
+{
+    vec = _mm_add_epi32(vec, _mm_shuffle_epi32(vec, _MM_SHUFFLE(1, 0, 3, 2)));
+    vec = _mm_add_epi32(vec, _mm_shuffle_epi32(vec, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    return static_cast<quint32>(_mm_cvtsi128_si32(vec));
+}
+
+#endif
+
+void RollingSum::sums(const char *data, int dataLen, quint32 *sum1, quint32 *sum2)
+{
+    quint32 a = 0;
+    quint32 b = 0;
+    int     i = 0;
+
+#ifdef __SSE2__
+
+    // 16 bytes at a time. for each run, s2 gains 16 times the s1 from before
+    // the run plus the bytes weighted 16 down to 1 (madd does the weighting
+    // and the pairwise adds). the lanes only get added up once at the end;
+    // everything wraps the same way the scalar code does so the result is
+    // identical.
+
+    if (dataLen >= 16)
+    {
+        const auto zero = _mm_setzero_si128();
+        const auto ones = _mm_set1_epi16(1);
+        const auto wLo  = _mm_setr_epi16(16, 15, 14, 13, 12, 11, 10, 9);
+        const auto wHi  = _mm_setr_epi16(8, 7, 6, 5, 4, 3, 2, 1);
+
+        auto vs1 = zero;
+        auto vs2 = zero;
+        auto vps = zero;
+
+        for (; (i + 16) <= dataLen; i += 16)
+        {
+            auto bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            auto lo    = _mm_unpacklo_epi8(bytes, zero);
+            auto hi    = _mm_unpackhi_epi8(bytes, zero);
+
+            vps = _mm_add_epi32(vps, vs1);
+            vs1 = _mm_add_epi32(vs1, _mm_add_epi32(_mm_madd_epi16(lo, ones), _mm_madd_epi16(hi, ones)));
+            vs2 = _mm_add_epi32(vs2, _mm_add_epi32(_mm_madd_epi16(lo, wLo), _mm_madd_epi16(hi, wHi)));
+        }
+
+        a = hsum(vs1);
+        b = (hsum(vps) * 16) + hsum(vs2);
+    }
+
+#endif
+
+    for (; i < dataLen; ++i)
+    {
+        a += static_cast<quint8>(data[i]);
+        b += a;
+    }
+
+    *sum1 = a;
+    *sum2 = b;
+}
+
+quint32 RollingSum::checksum(const char *data, int dataLen)
+{
+    quint32 a;
+    quint32 b;
+
+    sums(data, dataLen, &a, &b);
+
+    return (a & 0xFFFF) | (b << 16);
+}
+
+void RollingSum::reset(const char *data, int blockLen)
+{
+    len = static_cast<quint32>(blockLen);
+
+    sums(data, blockLen, &s1, &s2);
+}
+
+void RollingSum::roll(quint8 out, quint8 in)
+{
+    s1 = s1 - out + in;
+    s2 = s2 - (len * out) + s1;
+}
+
+quint32 RollingSum::value() const
+{
+    return (s1 & 0xFFFF) | (s2 << 16);
+}
+
+SignatureJob::SignatureJob(const QString &filePath, qint64 fileLen, int blockLen, int threads)
+{
+    auto count = syncBlockCount(fileLen, blockLen);
+
+    path     = filePath;
+    len      = fileLen;
+    block    = blockLen;
+    stopping = false;
+    failed   = false;
+
+    sigs.resize(static_cast<int>(count * SYNC_SIG_LEN));
+
+    threads = static_cast<int>(qMin(static_cast<qint64>(qBound(1, threads, SYNC_MAX_THREADS)), count));
+
+    for (int i = 0; i < threads; ++i)
+    {
+        auto first = (count * i) / threads;
+        auto last  = (count * (i + 1)) / threads;
+        auto dst   = sigs.data() + (first * SYNC_SIG_LEN);
+
+        auto *thr = QThread::create([this, first, last, dst]() {work(first, last, dst);});
+
+        workers.append(thr);
+
+        thr->start();
+    }
+}
+
+SignatureJob::~SignatureJob()
+{
+    mutex.lock();
+
+    stopping = true;
+
+    mutex.unlock();
+
+    for (auto *thr : workers)
+    {
+        thr->wait();
+
+        delete thr;
+    }
+}
+
+bool SignatureJob::wait(unsigned long msec)
+{
+    for (auto *thr : workers)
+    {
+        if (!thr->wait(msec)) return false;
+    }
+
+    return true;
+}
+
+bool SignatureJob::isStopping()
+{
+    QMutexLocker locker(&mutex);
+
+    return stopping || failed;
+}
+
+bool SignatureJob::isOk()
+{
+    QMutexLocker locker(&mutex);
+
+    return !failed;
+}
+
+QString SignatureJob::errorString()
+{
+    QMutexLocker locker(&mutex);
+
+    return errMsg;
+}
+
+void SignatureJob::fail(const QString &msg)
+{
+    QMutexLocker locker(&mutex);
+
+    if (!failed)
+    {
+        errMsg = msg;
+        failed = true;
+    }
+}
+
+QByteArray SignatureJob::result()
+{
+    return sigs;
+}
+
+void SignatureJob::work(qint64 first, qint64 last, char *dst)
+{
+    QFile      file(path);
+    StreamHash hasher("sha256");
+
+    // several blocks are read at a time to keep the syscall count down on
+    // small block sizes.
+
+    auto perRead = qMax(1, SYNC_READ_SIZE / block);
+
+    if (!file.open(QFile::ReadOnly) || !file.seek(first * block))
+    {
+        fail(file.errorString());
+    }
+    else
+    {
+        QByteArray buff(perRead * block, 0);
+
+        for (auto idx = first; (idx < last) && !isStopping();)
+        {
+            auto blocks = qMin(static_cast<qint64>(perRead), last - idx);
+            auto want   = qMin(blocks * block, len - (idx * block));
+
+            if (file.read(buff.data(), want) != want)
+            {
+                fail(file.errorString());
+
+                break;
+            }
+
+            for (qint64 i = 0; i < blocks; ++i)
+            {
+                auto data = buff.constData() + (i * block);
+                auto dLen = static_cast<int>(qMin(static_cast<qint64>(block), want - (i * block)));
+
+                hasher.reset();
+                hasher.addData(data, dLen);
+
+                qToLittleEndian<quint32>(RollingSum::checksum(data, dLen), dst);
+                memcpy(dst + 4, hasher.result().constData(), SYNC_STRONG_LEN);
+
+                dst += SYNC_SIG_LEN;
+            }
+
+            idx += blocks;
+        }
+    }
+}
+
+DeltaScanner::DeltaScanner(const QString &path, const QByteArray &signatures, qint64 basisSize, int blockLen) : fileHash("sha256"), blockHash("sha256")
+{
+    sigs       = signatures;
+    basisLen   = basisSize;
+    block      = blockLen;
+    blockCount = sigs.size() / SYNC_SIG_LEN;
+    tailLen    = static_cast<int>(basisLen % block);
+    readLen    = 0;
+    scanLen    = 0;
+    copyStart  = 0;
+    copyCount  = 0;
+    copied     = 0;
+    literal    = 0;
+    pos        = 0;
+    litStart   = 0;
+    sumValid   = false;
+    eof        = false;
+    ended      = false;
+    failed     = false;
+
+    // a short last block can only ever match the very end of the file so it
+    // is left out of the table and checked by finishScan() instead.
+
+    auto fullBlocks = (tailLen > 0) ? (blockCount - 1) : blockCount;
+
+    table.reserve(fullBlocks);
+
+    for (int i = 0; i < fullBlocks; ++i)
+    {
+        table.insert(qFromLittleEndian<quint32>(sigs.constData() + (i * SYNC_SIG_LEN)), i);
+    }
+
+    file.setFileName(path);
+
+    if (!file.open(QFile::ReadOnly))
+    {
+        errMsg = file.errorString();
+        failed = true;
+    }
+}
+
+bool DeltaScanner::isOpen()
+{
+    return file.isOpen();
+}
+
+bool DeltaScanner::isDone()
+{
+    return ended && out.isEmpty();
+}
+
+bool DeltaScanner::hasFailed()
+{
+    return failed;
+}
+
+qint64 DeltaScanner::scanned()
+{
+    return scanLen;
+}
+
+qint64 DeltaScanner::copiedBytes()
+{
+    return copied;
+}
+
+qint64 DeltaScanner::literalBytes()
+{
+    return literal;
+}
+
+QString DeltaScanner::errorString()
+{
+    return errMsg;
+}
+
+QByteArray DeltaScanner::strong(const char *data, int dataLen)
+{
+    blockHash.reset();
+    blockHash.addData(data, dataLen);
+
+    return blockHash.result().left(SYNC_STRONG_LEN);
+}
+
+int DeltaScanner::match(const char *data, quint32 weak)
+{
+    QByteArray hash;
+
+    auto ret = -1;
+
+    for (auto it = table.constFind(weak); (it != table.constEnd()) && (it.key() == weak); ++it)
+    {
+        if (hash.isEmpty())
+        {
+            hash = strong(data, block);
+        }
+
+        if (memcmp(sigs.constData() + (it.value() * SYNC_SIG_LEN) + 4, hash.constData(), SYNC_STRONG_LEN) == 0)
+        {
+            ret = it.value();
+
+            // the block right after the current run of copies is preferred so
+            // the run stays a single COPY op.
+
+            if ((copyCount > 0) && (ret == (copyStart + copyCount))) break;
+        }
+    }
+
+    return ret;
+}
+
+void DeltaScanner::refill()
+{
+    // drops everything up to the pending literal data and reads the next
+    // piece of the file.
+
+    buff.remove(0, litStart);
+
+    pos     -= litStart;
+    litStart = 0;
+
+    auto data = file.read(SYNC_READ_SIZE);
+
+    if (file.error() != QFile::NoError)
+    {
+        errMsg = file.errorString();
+        failed = true;
+    }
+    else
+    {
+        eof      = data.size() < SYNC_READ_SIZE;
+        readLen += data.size();
+
+        fileHash.addData(data);
+        buff.append(data);
+    }
+}
+
+void DeltaScanner::addCopy(qint64 idx)
+{
+    flushLiteral();
+
+    if ((copyCount > 0) && (idx == (copyStart + copyCount)) && (copyCount < 0xFFFFFFFF))
+    {
+        copyCount++;
+    }
+    else
+    {
+        flushCopy();
+
+        copyStart = idx;
+        copyCount = 1;
+    }
+}
+
+void DeltaScanner::flushCopy()
+{
+    if (copyCount > 0)
+    {
+        out.append(static_cast<char>(SYNC_OP_COPY));
+        out.append(wrInt(static_cast<quint64>(copyStart), 64));
+        out.append(wrInt(static_cast<quint64>(copyCount), 32));
+
+        copied   += qMin(copyCount * block, basisLen - (copyStart * block));
+        copyCount = 0;
+    }
+}
+
+void DeltaScanner::flushLiteral()
+{
+    if (pos > litStart)
+    {
+        flushCopy();
+
+        for (auto offs = litStart; offs < pos; offs += SYNC_MAX_LITERAL)
+        {
+            auto len = qMin(SYNC_MAX_LITERAL, pos - offs);
+
+            out.append(static_cast<char>(SYNC_OP_DATA));
+            out.append(wrInt(static_cast<quint64>(len), 32));
+            out.append(buff.constData() + offs, len);
+
+            literal += len;
+        }
+
+        litStart = pos;
+    }
+}
+
+void DeltaScanner::finishScan()
+{
+    auto left = static_cast<int>(buff.size() - pos);
+
+    if ((left > 0) && (left == tailLen))
+    {
+        auto idx = blockCount - 1;
+
+        if (memcmp(sigs.constData() + (idx * SYNC_SIG_LEN) + 4, strong(buff.constData() + pos, left).constData(), SYNC_STRONG_LEN) == 0)
+        {
+            addCopy(idx);
+
+            pos     += left;
+            litStart = pos;
+        }
+    }
+
+    scanLen += buff.size() - pos;
+    pos      = buff.size();
+
+    flushLiteral();
+    flushCopy();
+
+    out.append(static_cast<char>(SYNC_OP_END));
+    out.append(wrInt(static_cast<quint64>(readLen), 64));
+    out.append(fileHash.result());
+
+    ended = true;
+}
+
+bool DeltaScanner::step(QByteArray *frame)
+{
+    qint64 budget = SYNC_SCAN_BYTES;
+
+    while (!ended && !failed && (budget > 0) && (out.size() < SYNC_OUT_FRAME))
+    {
+        // the window plus the byte that rolls into it next need to be loaded.
+
+        if (!eof && ((buff.size() - pos) <= block))
+        {
+            refill();
+        }
+        else if ((buff.size() - pos) < block)
+        {
+            finishScan();
+        }
+        else if (table.isEmpty())
+        {
+            // nothing can match so the whole window goes out as literal data.
+
+            auto len = static_cast<int>(buff.size() - pos) - (eof ? tailLen : block);
+
+            pos     += len;
+            scanLen += len;
+            budget  -= len;
+
+            flushLiteral();
+        }
+        else
+        {
+            if (!sumValid)
+            {
+                sum.reset(buff.constData() + pos, block);
+
+                sumValid = true;
+            }
+
+            auto idx = match(buff.constData() + pos, sum.value());
+
+            if (idx >= 0)
+            {
+                addCopy(idx);
+
+                pos     += block;
+                scanLen += block;
+                budget  -= block;
+                litStart = pos;
+                sumValid = false;
+            }
+            else
+            {
+                if ((pos + block) < buff.size())
+                {
+                    sum.roll(static_cast<quint8>(buff[pos]), static_cast<quint8>(buff[pos + block]));
+                }
+                else
+                {
+                    sumValid = false;
+                }
+
+                pos++;
+                scanLen++;
+                budget--;
+
+                if ((pos - litStart) >= SYNC_MAX_LITERAL)
+                {
+                    flushLiteral();
+                }
+            }
+        }
+    }
+
+    auto ret = !failed && !out.isEmpty() && ((out.size() >= SYNC_OUT_FRAME) || ended);
+
+    if (ret)
+    {
+        *frame = out;
+
+        out.clear();
+    }
+
+    return ret;
+}
+
+void SyncUpload::onTerminate()
+{
+    delete sigJob;
+    delete out;
+
+    sigJob = nullptr;
+    out    = nullptr;
+
+    releaseInput(opsQueued);
+
+    basis->close();
+    opsIn.clear();
+    sigs.clear();
+    outHash.reset();
+
+    basisLen  = 0;
+    opsQueued = 0;
+    sigsSent  = 0;
+    copyPos   = 0;
+    copyLeft = 0;
+    written  = 0;
+    copied   = 0;
+    literal  = 0;
+    block    = 0;
+    opPos    = 0;
+    ssMode   = false;
+    flags    = 0;
+}
+
+void SyncUpload::fail(const QString &msg, quint16 code)
+{
+    retCode = code;
+
+    errTxt(msg);
+    onTerminate();
+}
+
+bool SyncUpload::writeOut(const QByteArray &data)
+{
+    auto ret = out->write(data) == data.size();
+
+    if (ret)
+    {
+        outHash.addData(data);
+
+        written     += data.size();
+        progCurrent += data.size();
+
+        stepIo(data.size());
+    }
+    else
+    {
+        fail("err: File IO failure: " + out->errorString() + ".\n", EXECUTION_FAIL);
+    }
+
+    return ret;
+}
+
+void SyncUpload::sigStep()
+{
+    if (sigJob->wait(5))
+    {
+        if (!sigJob->isOk())
+        {
+            fail("err: File IO failure: " + sigJob->errorString() + ".\n", EXECUTION_FAIL);
+        }
+        else
+        {
+            sigs = sigJob->result();
+
+            delete sigJob;
+
+            sigJob = nullptr;
+
+            emit procOut(QString("-block " + QString::number(block) + " -count " + QString::number(sigs.size() / SYNC_SIG_LEN) + " -len " + QString::number(basisLen)).toUtf8(), GEN_FILE);
+        }
+    }
+}
+
+void SyncUpload::finish(const QByteArray &endOp)
+{
+    auto newLen = static_cast<qint64>(rdInt(endOp.mid(1, 8)));
+    auto hash   = endOp.mid(9, 32);
+
+    if ((newLen != written) || (hash != outHash.result()))
+    {
+        fail("err: The synced file does not match the client's file. the remote file was left as it was.\n", EXECUTION_FAIL);
+    }
+    else
+    {
+        // the basis has to be closed before the new file replaces it.
+
+        basis->close();
+
+        if (!out->commit())
+        {
+            fail("err: Unable to replace the remote file. reason: " + out->errorString() + "\n", EXECUTION_FAIL);
+        }
+        else
+        {
+            mainTxt("matched: " + QString::number(copied) + " bytes\n");
+            mainTxt("sent:    " + QString::number(literal) + " bytes\n");
+            onTerminate();
+        }
+    }
+}
+
+bool SyncUpload::applyOp(const QByteArray &frame)
+{
+    // ops never span GEN_FILE frames so a short op is a protocol error.
+
+    auto op  = static_cast<quint8>(frame[opPos]);
+    auto ret = false;
+
+    if ((op == SYNC_OP_COPY) && ((opPos + 13) <= frame.size()))
+    {
+        auto idx   = static_cast<qint64>(rdInt(frame.mid(opPos + 1, 8)));
+        auto count = static_cast<qint64>(rdInt(frame.mid(opPos + 9, 4)));
+        auto total = (basisLen + block - 1) / block;
+
+        if ((idx < total) && (count <= (total - idx)))
+        {
+            copyPos  = idx * block;
+            copyLeft = qMin(count * block, basisLen - copyPos);
+            copied  += copyLeft;
+            opPos   += 13;
+            ret      = true;
+        }
+    }
+    else if ((op == SYNC_OP_DATA) && ((opPos + 5) <= frame.size()))
+    {
+        auto len = static_cast<int>(rdInt(frame.mid(opPos + 1, 4)));
+
+        if ((len >= 0) && ((static_cast<qint64>(opPos) + 5 + len) <= frame.size()))
+        {
+            literal += len;
+            ret      = writeOut(frame.mid(opPos + 5, len));
+            opPos   += 5 + len;
+
+            if (!ret) return false;
+        }
+    }
+    else if ((op == SYNC_OP_END) && ((opPos + 41) == frame.size()))
+    {
+        finish(frame.mid(opPos, 41));
+
+        return false;
+    }
+
+    if (!ret)
+    {
+        fail("err: Malformed delta op at offset " + QString::number(opPos) + " of the GEN_FILE frame.\n", INVALID_PARAMS);
+    }
+
+    return ret;
+}
+
+void SyncUpload::applyStep()
+{
+    if (copyLeft > 0)
+    {
+        auto len = qMin(copyLeft, static_cast<qint64>(SYNC_COPY_CHUNK));
+
+        if (!basis->seek(copyPos))
+        {
+            fail("err: File IO failure: " + basis->errorString() + ".\n", EXECUTION_FAIL);
+        }
+        else
+        {
+            auto data = basis->read(len);
+
+            if (data.size() != len)
+            {
+                fail("err: File IO failure: " + basis->errorString() + ".\n", EXECUTION_FAIL);
+            }
+            else if (writeOut(data))
+            {
+                copyPos  += len;
+                copyLeft -= len;
+            }
+        }
+    }
+    else if (opsIn.isEmpty())
+    {
+        flags &= ~LOOPING;
+    }
+    else if (applyOp(opsIn.first()) && (opPos >= opsIn.first().size()))
+    {
+        opsQueued -= opsIn.first().size();
+
+        releaseInput(opsIn.first().size());
+        opsIn.removeFirst();
+
+        opPos = 0;
+
+        if (ssMode)
+        {
+            emit procOut(QByteArray(), GEN_FILE);
+        }
+    }
+}
+
+void SyncUpload::procIn(const QByteArray &binIn, quint8 dType)
+{
+    if ((dType == TEXT) && (flags & LOOPING) && binIn.isEmpty())
+    {
+        if (sigJob != nullptr)
+        {
+            sigStep();
+        }
+        else if (sigsSent < sigs.size())
+        {
+            auto len = qMin(static_cast<qint64>(SYNC_SIG_FRAME), sigs.size() - sigsSent);
+
+            emit procOut(sigs.mid(static_cast<int>(sigsSent), static_cast<int>(len)), GEN_FILE);
+
+            stepIo(len);
+
+            sigsSent += len;
+        }
+        else
+        {
+            // LOOPING is dropped by applyStep() once it runs out of ops.
+
+            applyStep();
+        }
+    }
+    else if ((dType == GEN_FILE) && (flags & MORE_INPUT))
+    {
+        if (!binIn.isEmpty())
+        {
+            // the ops are applied over several steps so a client that
+            // doesn't use single step mode could send them faster than they
+            // can be applied. held input caps the queue at FLOW_INBOUND_MAX,
+            // the host stops feeding this command past that.
+
+            opsQueued += binIn.size();
+
+            holdInput(binIn.size());
+            opsIn.append(binIn);
+
+            flags |= LOOPING;
+        }
+    }
+    else if (dType == GEN_FILE)
+    {
+        auto args   = parseArgs(binIn, 13);
+        auto path   = getParam("-remote_file", args);
+        auto lenStr = getParam("-len", args);
+        auto blkStr = getParam("-block", args);
+        auto thrStr = getParam("-threads", args);
+
+        QFileInfo info(path);
+
+        retCode = INVALID_PARAMS;
+
+        if (path.isEmpty())
+        {
+            errTxt("err: The remote file path argument (-remote_file) was not found or is empty.\n");
+        }
+        else if (!isInt(lenStr) || (lenStr.toLongLong() < 0))
+        {
+            errTxt("err: The data len argument (-len) was not found or is not a valid integer.\n");
+        }
+        else if (!blkStr.isEmpty() && !isInt(blkStr))
+        {
+            errTxt("err: Block size '" + blkStr + "' is not a valid integer.\n");
+        }
+        else if (!thrStr.isEmpty() && !isInt(thrStr))
+        {
+            errTxt("err: Thread count '" + thrStr + "' is not a valid integer.\n");
+        }
+        else if (info.exists() && !info.isFile())
+        {
+            errTxt("err: The remote file is not a file.\n");
+        }
+        else if (info.exists() && (syncBlockCount(info.size(), syncBlockSize(info.size(), blkStr.toInt())) > SYNC_MAX_BLOCKS))
+        {
+            errTxt("err: The remote file is too large to sync, it would need more than " + QString::number(SYNC_MAX_BLOCKS) + " blocks.\n");
+        }
+        else if (info.exists() && !basis->open(QFile::ReadOnly))
+        {
+            retCode = EXECUTION_FAIL;
+
+            errTxt("err: Unable to open the remote file for reading. reason: " + basis->errorString() + "\n");
+        }
+        else
+        {
+            // the new file is put together next to the old one and only
+            // replaces it once the END op checks out, so a failed or
+            // cancelled sync leaves the remote file alone.
+
+            mkPathForFile(path);
+
+            out = new QSaveFile(path, this);
+
+            if (!out->open(QFile::WriteOnly))
+            {
+                retCode = EXECUTION_FAIL;
+
+                errTxt("err: Unable to open the remote file for writing. reason: " + out->errorString() + "\n");
+                onTerminate();
+            }
+            else
+            {
+                auto threads = thrStr.isEmpty() ? SYNC_THREADS : thrStr.toInt();
+
+                basisLen = info.exists() ? info.size() : 0;
+                block    = syncBlockSize(basisLen, blkStr.toInt());
+                ssMode   = argExists("-single_step", args);
+                progMax  = lenStr.toLongLong();
+                sigJob   = new SignatureJob(path, basisLen, block, threads);
+                retCode  = NO_ERRORS;
+                flags   |= MORE_INPUT | LOOPING;
+
+                emit mainTxt("sync_file: " + path + "\n");
+                emit mainTxt("bytes:     " + QString::number(progMax) + "\n");
+
+                startProgPulse();
+            }
+        }
+    }
+}
+
+void SyncDownload::onTerminate()
+{
+    delete scanner;
+
+    scanner = nullptr;
+
+    sigs.clear();
+    path.clear();
+
+    basisLen = 0;
+    sigsLen  = 0;
+    block    = 0;
+    ssMode   = false;
+    flags    = 0;
+}
+
+void SyncDownload::startScan()
+{
+    scanner = new DeltaScanner(path, sigs, basisLen, block);
+
+    sigs.clear();
+
+    if (!scanner->isOpen())
+    {
+        retCode = EXECUTION_FAIL;
+
+        errTxt("err: Unable to open the remote file for reading. reason: " + scanner->errorString() + "\n");
+        onTerminate();
+    }
+    else
+    {
+        flags |= LOOPING;
+    }
+}
+
+void SyncDownload::scanStep()
+{
+    QByteArray frame;
+
+    auto got = scanner->step(&frame);
+
+    stepIo(scanner->scanned() - progCurrent);
+
+    progCurrent = scanner->scanned();
+
+    if (scanner->hasFailed())
+    {
+        retCode = EXECUTION_FAIL;
+
+        errTxt("err: File IO failure: " + scanner->errorString() + ".\n");
+        onTerminate();
+    }
+    else
+    {
+        if (got)
+        {
+            emit procOut(frame, GEN_FILE);
+
+            if (ssMode) flags &= ~LOOPING;
+        }
+
+        if (scanner->isDone())
+        {
+            mainTxt("matched: " + QString::number(scanner->copiedBytes()) + " bytes\n");
+            mainTxt("sent:    " + QString::number(scanner->literalBytes()) + " bytes\n");
+            onTerminate();
+        }
+    }
+}
+
+void SyncDownload::procIn(const QByteArray &binIn, quint8 dType)
+{
+    if ((dType == TEXT) && (flags & LOOPING) && binIn.isEmpty())
+    {
+        scanStep();
+    }
+    else if ((dType == GEN_FILE) && (flags & MORE_INPUT) && (scanner != nullptr))
+    {
+        // single step mode; the client is ready for the next frame.
+
+        flags |= LOOPING;
+    }
+    else if ((dType == GEN_FILE) && (flags & MORE_INPUT))
+    {
+        sigs.append(binIn);
+
+        if (sigs.size() > sigsLen)
+        {
+            retCode = INVALID_PARAMS;
+
+            errTxt("err: The client sent more signature data than -len and -block call for.\n");
+            onTerminate();
+        }
+        else if (sigs.size() == sigsLen)
+        {
+            startScan();
+        }
+    }
+    else if (dType == GEN_FILE)
+    {
+        auto args   = parseArgs(binIn, 11);
+        auto lenStr = getParam("-len", args);
+        auto blkStr = getParam("-block", args);
+
+        path = getParam("-remote_file", args);
+
+        QFileInfo info(path);
+
+        retCode = INVALID_PARAMS;
+
+        if (path.isEmpty())
+        {
+            errTxt("err: The remote file path argument (-remote_file) was not found or is empty.\n");
+        }
+        else if (!isInt(lenStr) || (lenStr.toLongLong() < 0))
+        {
+            errTxt("err: The client file len argument (-len) was not found or is not a valid integer.\n");
+        }
+        else if ((lenStr.toLongLong() > 0) && !isInt(blkStr))
+        {
+            errTxt("err: The block size argument (-block) was not found or is not a valid integer.\n");
+        }
+        else if ((lenStr.toLongLong() > 0) && (syncBlockSize(lenStr.toLongLong(), blkStr.toInt()) != blkStr.toInt()))
+        {
+            errTxt("err: Block size '" + blkStr + "' is out of range for a file of this size. try " + QString::number(syncBlockSize(lenStr.toLongLong(), blkStr.toInt())) + ".\n");
+        }
+        else if ((lenStr.toLongLong() > 0) && (syncBlockCount(lenStr.toLongLong(), blkStr.toInt()) > SYNC_MAX_BLOCKS))
+        {
+            // even the largest block size can't keep a file this big under the
+            // signature limit; the signatures wouldn't fit in memory anyway.
+
+            errTxt("err: The client file is too large to sync, it would need more than " + QString::number(SYNC_MAX_BLOCKS) + " blocks.\n");
+        }
+        else if (!info.isFile())
+        {
+            errTxt("err: The remote file is not a file or does not exists.\n");
+        }
+        else
+        {
+            basisLen = lenStr.toLongLong();
+            block    = (basisLen > 0) ? blkStr.toInt() : SYNC_MIN_BLOCK;
+            sigsLen  = syncBlockCount(basisLen, block) * SYNC_SIG_LEN;
+            ssMode   = argExists("-single_step", args);
+            progMax  = info.size();
+            retCode  = NO_ERRORS;
+            flags   |= MORE_INPUT;
+
+            emit mainTxt("sync_file: " + path + "\n");
+            emit mainTxt("bytes:     " + QString::number(progMax) + "\n");
+            emit procOut(QString("-len " + QString::number(progMax)).toUtf8(), GEN_FILE);
+
+            startProgPulse();
+
+            if (sigsLen == 0)
+            {
+                startScan();
+            }
+        }
+    }
+}
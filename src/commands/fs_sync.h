@@ -0,0 +1,238 @@
+#ifndef FS_SYNC_H
+#define FS_SYNC_H
+
+//    This file is part of MRCI.
+
+//    MRCI is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+
+//    MRCI is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+
+//    You should have received a copy of the GNU General Public License
+//    along with MRCI under the LICENSE.md file. If not, see
+//    <http://www.gnu.org/licenses/>.
+
+#include "fs.h"
+
+#include <QMultiHash>
+
+#ifdef __SSE2__
+
+#include <emmintrin.h>
+
+#endif
+
+#define SYNC_MIN_BLOCK   2048
+#define SYNC_MAX_BLOCK   1048576
+#define SYNC_MAX_BLOCKS  4194304  // the block size is raised if a file would need more signatures than this.
+#define SYNC_STRONG_LEN  16       // bytes of the sha256 of each block kept in its signature.
+#define SYNC_SIG_LEN     20       // [4bytes(weak)][16bytes(strong)]
+#define SYNC_SIG_FRAME   1048560  // signature bytes per GEN_FILE frame, a multiple of SYNC_SIG_LEN.
+#define SYNC_THREADS     4
+#define SYNC_MAX_THREADS 32
+#define SYNC_READ_SIZE   4194304
+#define SYNC_SCAN_BYTES  4194304  // input scanned by a single DeltaScanner::step().
+#define SYNC_OUT_FRAME   1048576  // delta ops are sent once they add up to about this much.
+#define SYNC_MAX_LITERAL 1048576
+#define SYNC_COPY_CHUNK  4194304
+#define SYNC_OP_END      0x00     // [1byte(op)][8bytes(new_len)][32bytes(sha256 of the new file)]
+#define SYNC_OP_COPY     0x01     // [1byte(op)][8bytes(block_index)][4bytes(block_count)]
+#define SYNC_OP_DATA     0x02     // [1byte(op)][4bytes(len)][len bytes(literal data)]
+
+int    syncBlockSize(qint64 len, int requested = 0);
+qint64 syncBlockCount(qint64 len, int block);
+
+class RollingSum
+{
+    // the rsync style weak checksum. s1 is the plain sum of the bytes in the
+    // window and s2 the sum of s1 after each byte so the window can slide a
+    // byte at a time without going over the whole block again.
+
+private:
+
+    quint32 s1;
+    quint32 s2;
+    quint32 len;
+
+public:
+
+    static void    sums(const char *data, int dataLen, quint32 *sum1, quint32 *sum2);
+    static quint32 checksum(const char *data, int dataLen);
+
+    void    reset(const char *data, int blockLen);
+    void    roll(quint8 out, quint8 in);
+    quint32 value() const;
+};
+
+//-----------------------
+
+class SignatureJob
+{
+    // computes the block signatures of a file on a set of worker threads, each
+    // taking its own contiguous run of blocks and writing straight into its
+    // part of the result so nothing has to be merged afterwards.
+
+private:
+
+    QMutex          mutex;
+    QList<QThread*> workers;
+    QByteArray      sigs;
+    QString         path;
+    QString         errMsg;
+    qint64          len;
+    int             block;
+    bool            stopping;
+    bool            failed;
+
+    bool isStopping();
+    void fail(const QString &msg);
+    void work(qint64 first, qint64 last, char *dst);
+
+public:
+
+    explicit SignatureJob(const QString &filePath, qint64 fileLen, int blockLen, int threads);
+    ~SignatureJob();
+
+    bool       wait(unsigned long msec);
+    bool       isOk();
+    QString    errorString();
+    QByteArray result();
+};
+
+//-----------------------
+
+class DeltaScanner
+{
+    // slides a block sized window over a file looking for blocks the other
+    // side already has, going by the signatures it sent. the output is a
+    // stream of COPY ops for the blocks it has and DATA ops for everything
+    // else, ending with an END op that carries a hash of the whole file.
+
+private:
+
+    QFile                    file;
+    StreamHash               fileHash;
+    StreamHash               blockHash;
+    QMultiHash<quint32, int> table;
+    QByteArray               sigs;
+    QByteArray               buff;
+    QByteArray               out;
+    QString                  errMsg;
+    RollingSum               sum;
+    qint64                   basisLen;
+    qint64                   readLen;
+    qint64                   scanLen;
+    qint64                   copyStart;
+    qint64                   copyCount;
+    qint64                   copied;
+    qint64                   literal;
+    int                      block;
+    int                      blockCount;
+    int                      tailLen;
+    int                      pos;
+    int                      litStart;
+    bool                     sumValid;
+    bool                     eof;
+    bool                     ended;
+    bool                     failed;
+
+    QByteArray strong(const char *data, int dataLen);
+    int        match(const char *data, quint32 weak);
+    void       refill();
+    void       addCopy(qint64 idx);
+    void       flushCopy();
+    void       flushLiteral();
+    void       finishScan();
+
+public:
+
+    explicit DeltaScanner(const QString &path, const QByteArray &signatures, qint64 basisSize, int blockLen);
+
+    bool    isOpen();
+    bool    isDone();
+    bool    hasFailed();
+    bool    step(QByteArray *frame);
+    qint64  scanned();
+    qint64  copiedBytes();
+    qint64  literalBytes();
+    QString errorString();
+};
+
+//-----------------------
+
+class SyncUpload : public CmdObject
+{
+    Q_OBJECT
+
+private:
+
+    StreamHash         outHash;
+    SignatureJob      *sigJob;
+    QSaveFile         *out;
+    QFile             *basis;
+    QList<QByteArray>  opsIn;
+    QByteArray         sigs;
+    qint64             basisLen;
+    qint64             opsQueued;
+    qint64             sigsSent;
+    qint64             copyPos;
+    qint64             copyLeft;
+    qint64             written;
+    qint64             copied;
+    qint64             literal;
+    int                block;
+    int                opPos;
+    bool               ssMode;
+
+    void fail(const QString &msg, quint16 code);
+    void sigStep();
+    void applyStep();
+    bool applyOp(const QByteArray &frame);
+    bool writeOut(const QByteArray &data);
+    void finish(const QByteArray &endOp);
+    void onTerminate();
+
+public:
+
+    static QString cmdName();
+
+    void procIn(const QByteArray &binIn, quint8 dType);
+
+    explicit SyncUpload(QObject *parent = nullptr);
+};
+
+//-----------------------
+
+class SyncDownload : public CmdObject
+{
+    Q_OBJECT
+
+private:
+
+    DeltaScanner *scanner;
+    QByteArray    sigs;
+    QString       path;
+    qint64        basisLen;
+    qint64        sigsLen;
+    int           block;
+    bool          ssMode;
+
+    void scanStep();
+    void startScan();
+    void onTerminate();
+
+public:
+
+    static QString cmdName();
+
+    void procIn(const QByteArray &binIn, quint8 dType);
+
+    explicit SyncDownload(QObject *parent = nullptr);
+};
+
+#endif // FS_SYNC_H
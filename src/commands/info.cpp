@@ -1,4 +1,5 @@
 #include "info.h"
+#include "cmd_docs_index.h"
 
 //    This file is part of MRCI.
 
@@ -26,7 +27,7 @@ IPHist::IPHist(QObject *parent) : TableViewer(parent)
     addTableColumn(TABLE_IPHIST, COLUMN_LOGENTRY);
 }
 
-ListCommands::ListCommands(const QStringList &cmdList, QObject *parent) : CmdObject(parent)
+ListCommands::ListCommands(const QList<const InternCmd*> &cmdList, QObject *parent) : CmdObject(parent)
 {
     list = cmdList;
 }
@@ -55,28 +56,35 @@ QString ListCommands::longText(const QString &cmdName)
 
 void ListCommands::onIPCConnected()
 {
-    for (auto&& cmdName : list)
-    {
-        auto genType = QByteArray(1, 0x00);
+    auto lib = toFixedTEXT(libName(), 64);
 
-        if (cmdName == DownloadFile::cmdName())
-        {
-            genType = QByteArray(1, GEN_DOWNLOAD);
-        }
-        else if (cmdName == UploadFile::cmdName())
-        {
-            genType = QByteArray(1, GEN_UPLOAD);
-        }
+    for (auto&& cmd : list)
+    {
+        auto  cmdName = QString(cmd->name);
+        auto *doc     = findCmdDoc(cmdDocs, cmd->name);
 
         QByteArray frame;
 
         frame.append(QByteArray(2, 0x00));
-        frame.append(genType);
+        frame.append(static_cast<char>(cmd->genType));
         frame.append(toFixedTEXT(cmdName, 64));
-        frame.append(toFixedTEXT(libName(), 64));
-        frame.append(nullTermTEXT(shortText(cmdName)));
-        frame.append(nullTermTEXT(ioText(cmdName)));
-        frame.append(nullTermTEXT(longText(cmdName)));
+        frame.append(lib);
+
+        if (doc != nullptr)
+        {
+            // the doc text was extracted at build time by gen_cmd_docs.py so
+            // the null terminated strings can be copied into the frame as is.
+
+            frame.append(doc->shortTxt, static_cast<int>(qstrlen(doc->shortTxt)) + 1);
+            frame.append(doc->ioTxt, static_cast<int>(qstrlen(doc->ioTxt)) + 1);
+            frame.append(doc->longTxt, static_cast<int>(qstrlen(doc->longTxt)) + 1);
+        }
+        else
+        {
+            frame.append(nullTermTEXT(shortText(cmdName)));
+            frame.append(nullTermTEXT(ioText(cmdName)));
+            frame.append(nullTermTEXT(longText(cmdName)));
+        }
 
         emit procOut(frame, NEW_CMD);
     }
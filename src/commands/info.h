@@ -19,6 +19,7 @@
 
 #include "../common.h"
 #include "../cmd_object.h"
+#include "../cmd_registry.h"
 #include "../shell.h"
 #include "table_viewer.h"
 #include "fs.h"
@@ -30,7 +31,7 @@ class ListCommands : public CmdObject
 
 private:
 
-    QStringList list;
+    QList<const InternCmd*> list;
 
     QString shortText(const QString &cmdName);
     QString ioText(const QString &cmdName);
@@ -42,7 +43,7 @@ private slots:
 
 public:
 
-    explicit ListCommands(const QStringList &cmdList, QObject *parent = nullptr);
+    explicit ListCommands(const QList<const InternCmd*> &cmdList, QObject *parent = nullptr);
 };
 
 //--------------------------------------
@@ -95,6 +95,15 @@ QJsonObject confObject()
         obj.insert(CONF_EVERIFY_SUBJECT, DEFAULT_CONFIRM_SUBJECT);
         obj.insert(CONF_PW_RES_EMAIL_TEMP, getLocalFilePath(DEFAULT_RES_PW_FILENAME));
         obj.insert(CONF_EVERIFY_TEMP, getLocalFilePath(DEFAULT_EVERIFY_FILENAME));
+        obj.insert(CONF_MAX_CMD_PROCS, DEFAULT_MAX_CMD_PROCS);
+        obj.insert(CONF_MAX_SES_CMD_PROCS, DEFAULT_MAX_SES_PROCS);
+        obj.insert(CONF_RLIMIT_CPU, 0);
+        obj.insert(CONF_RLIMIT_MEM, 0);
+        obj.insert(CONF_RLIMIT_FILES, 0);
+        obj.insert(CONF_WARM_PROC_MAX_SECS, DEFAULT_WARM_MAX_SECS);
+        obj.insert(CONF_WARM_PROC_MIN_MEM, DEFAULT_WARM_MIN_MEM);
+        obj.insert(CONF_FS_CACHE_SLOTS, DEFAULT_FS_CACHE_SLOTS);
+        obj.insert(CONF_CHUNK_STORE_SHARED, false);
 
         wrDefaultMailTemplates(obj);
 
@@ -270,6 +279,83 @@ quint16 toCmdId16(quint32 id)
     return ret;
 }
 
+bool compressibleType(quint8 typeId)
+{
+    return (typeId == TEXT) || (typeId == BIG_TEXT) || (typeId == INFO_BATCH) || (typeId == GEN_FILE);
+}
+
+bool lowEntropy(const QByteArray &data)
+{
+    // shannon entropy of a sample from the start of the data. archives,
+    // media and anything else that is already compressed comes out close to
+    // 8 bits per byte and wouldn't shrink enough to be worth the cpu.
+
+    auto len = qMin(data.size(), COMPRESS_SAMPLE);
+
+    qint64 counts[256] = {};
+    double bits        = 0;
+
+    for (int i = 0; i < len; ++i)
+    {
+        counts[static_cast<quint8>(data[i])] += 1;
+    }
+
+    for (auto count : counts)
+    {
+        if (count > 0)
+        {
+            auto prob = static_cast<double>(count) / len;
+
+            bits -= prob * std::log2(prob);
+        }
+    }
+
+    return bits < COMPRESS_ENTROPY;
+}
+
+QByteArray compressFrame(const QByteArray &data, quint8 *typeId)
+{
+    // the payload is left as is if compressing it doesn't make it smaller
+    // so FRAME_COMPRESSED is only ever set when it saved something.
+
+    auto ret = data;
+
+    if (compressibleType(*typeId) && (data.size() >= COMPRESS_MIN) && ((*typeId != GEN_FILE) || lowEntropy(data)))
+    {
+        auto packed = qCompress(data, COMPRESS_LEVEL);
+
+        if (packed.size() < data.size())
+        {
+            ret      = packed;
+            *typeId |= FRAME_COMPRESSED;
+        }
+    }
+
+    return ret;
+}
+
+QByteArray expandFrame(const QByteArray &data, quint8 *typeId)
+{
+    // qCompress() leads with the 32bit big endian size of the original data.
+    // anything claiming to be bigger than a frame can hold is dropped instead
+    // of letting qUncompress() allocate whatever it asks for.
+
+    QByteArray ret;
+
+    if (!(*typeId & FRAME_COMPRESSED))
+    {
+        ret = data;
+    }
+    else if ((data.size() >= 4) && (qFromBigEndian<quint32>(data.data()) <= LOCAL_BUFFSIZE))
+    {
+        ret = qUncompress(data);
+    }
+
+    *typeId &= ~FRAME_COMPRESSED;
+
+    return ret;
+}
+
 QByteArray toFixedTEXT(const QString &txt, int len)
 {
     return txt.toUtf8().leftJustified(len, 0, true);
@@ -1092,22 +1178,21 @@ SessionCarrier::SessionCarrier(Session *session) : QObject()
     sessionObj = session;
 }
 
-IdleTimer::IdleTimer(QObject *parent) : QTimer(parent)
+IdleTimer::IdleTimer(QObject *parent) : WheelTimer(parent)
 {
     setSingleShot(true);
 }
 
-void IdleTimer::detectWrite(qint64)
-{
-    start();
-}
-
 void IdleTimer::attach(QIODevice *dev, int msec)
 {
-    setInterval(msec);
+    // io on the device only refreshes the activity time stamp; the timer
+    // itself is armed once here instead of being restarted on every read
+    // and write.
+
+    connect(dev, &QIODevice::readyRead, this, &IdleTimer::touch);
+    connect(dev, &QIODevice::bytesWritten, this, &IdleTimer::touch);
 
-    connect(dev, SIGNAL(readyRead()), this, SLOT(start()));
-    connect(dev, SIGNAL(bytesWritten(qint64)), this, SLOT(detectWrite(qint64)));
+    start(msec);
 }
 
 ShellIPC::ShellIPC(const QStringList &args, bool supressErr, QObject *parent) : QLocalSocket(parent)
@@ -55,6 +55,7 @@
 #include <QNetworkRequest>
 #include <QUrl>
 #include <QReadWriteLock>
+#include <QSet>
 #include <QTextStream>
 #include <QSqlDatabase>
 #include <QTcpServer>
@@ -78,9 +79,11 @@
 
 #include "shell.h"
 #include "mem_share.h"
+#include "host_metrics.h"
+#include "timing_wheel.h"
 
 #define APP_NAME          "MRCI"
-#define APP_VER           "5.1.2.1"
+#define APP_VER           "5.1.3.1"
 #define APP_TARGET        "mrci"
 #define SERVER_HEADER_TAG "MRCI"
 #define HOST_CONTROL_PIPE "MRCI_HOST_CONTROL"
@@ -88,8 +91,20 @@
 #define MAX_FRAME_BITS    24
 #define LOCAL_BUFFSIZE    16777215
 #define CLIENT_HEADER_LEN 292
+#define CLIENT_CAPS_OFFS  164
+#define CATALOG_HASH_LEN  32
+#define MAX_CMD_CATALOGS  64
 #define MAX_LS_ENTRIES    50
 #define MAX_LOG_SIZE      100000000
+#define FLOW_WINDOW       4194304  // output bytes a command process can have in flight before its LOOPING steps pause.
+#define FLOW_RETURN_MIN   1048576  // spent credit is handed back to a command process in batches of at least this.
+#define FLOW_HIGH_WATER   4194304  // credit is only handed back while the session socket has less than this queued.
+#define FLOW_INBOUND_MAX  16777216 // client input queued for a single command before the client is told to pause it.
+#define FRAME_COMPRESSED  0x80     // set in the type id of a frame when its payload is compressed with qCompress().
+#define COMPRESS_MIN      1024     // payloads smaller than this are never compressed.
+#define COMPRESS_LEVEL    1        // zlib level; frames are compressed on the fly so speed wins over ratio.
+#define COMPRESS_SAMPLE   4096     // bytes from the start of a GEN_FILE payload checked by lowEntropy().
+#define COMPRESS_ENTROPY  7.5      // GEN_FILE payloads sampled above this many bits per byte are sent as is.
 
 #define SUBJECT_SUB      "%subject%"
 #define MSG_SUB          "%message_body%"
@@ -123,6 +138,11 @@
 #define DEFAULT_MAXSESSIONS      100
 #define DEFAULT_MAX_SUBS         50
 #define DEFAULT_INIT_RANK        2
+#define DEFAULT_MAX_CMD_PROCS    256
+#define DEFAULT_MAX_SES_PROCS    16
+#define DEFAULT_WARM_MAX_SECS    900
+#define DEFAULT_WARM_MIN_MEM     10
+#define DEFAULT_FS_CACHE_SLOTS   256
 
 #define CONF_FILENAME             "conf.json"
 #define CONF_LISTEN_ADDR          "listening_addr"
@@ -146,6 +166,15 @@
 #define CONF_EVERIFY_SUBJECT      "email_verify_subject"
 #define CONF_PW_RES_EMAIL_TEMP    "reset_pw_mail_template"
 #define CONF_EVERIFY_TEMP         "email_verify_template"
+#define CONF_MAX_CMD_PROCS        "max_cmd_procs"
+#define CONF_MAX_SES_CMD_PROCS    "max_session_cmd_procs"
+#define CONF_RLIMIT_CPU           "cmd_rlimit_cpu_secs"
+#define CONF_RLIMIT_MEM           "cmd_rlimit_mem_mb"
+#define CONF_RLIMIT_FILES         "cmd_rlimit_open_files"
+#define CONF_WARM_PROC_MAX_SECS   "warm_proc_max_secs"
+#define CONF_WARM_PROC_MIN_MEM    "warm_proc_min_mem_pct"
+#define CONF_FS_CACHE_SLOTS       "fs_cache_slots"
+#define CONF_CHUNK_STORE_SHARED   "chunk_store_shared"
 
 #define TABLE_IPHIST       "ip_history"
 #define TABLE_USERS        "users"
@@ -245,7 +274,8 @@ enum AsyncCommands : quint16
     ASYNC_SET_DIR           = 43,  // internal | private
     ASYNC_DEBUG_TEXT        = 44,  // internal | private
     ASYNC_HOOK_INPUT        = 45,  // internal | private
-    ASYNC_UNHOOK            = 46   // internal | private
+    ASYNC_UNHOOK            = 46,  // internal | private
+    ASYNC_PROC_USAGE        = 47   // internal | private
 };
 
 enum Flags : quint32
@@ -266,7 +296,33 @@ enum Flags : quint32
     MORE_INPUT                 = 1 << 13,
     LOOPING                    = 1 << 14,
     SINGLE_STEP_MODE           = 1 << 15,
-    YIELD_STATE                = 1 << 16
+    YIELD_STATE                = 1 << 16,
+    CATALOG_MODE               = 1 << 17,
+    CATALOG_SENT               = 1 << 18,
+    FLOW_CTRL_MODE             = 1 << 20,
+    COMPRESS_MODE              = 1 << 21,
+    FRAGMENT_MODE              = 1 << 22
+};
+
+enum ClientCaps : quint8
+{
+    CAP_CMD_CATALOG = 1,
+    CAP_FLOW_CTRL   = 1 << 1,
+    CAP_COMPRESS    = 1 << 2,
+    CAP_FRAGMENT    = 1 << 3
+};
+
+enum CatalogMode : quint8
+{
+    CATALOG_CONFIRM = 0,
+    CATALOG_FULL    = 1,
+    CATALOG_BASE    = 2
+};
+
+enum FlowCtrlMode : quint8
+{
+    FLOW_PAUSE  = 0,
+    FLOW_RESUME = 1
 };
 
 enum FileInfoFlags : quint8
@@ -311,7 +367,13 @@ enum TypeID : quint8
     PROMPT_TEXT    = 27,
     PROG           = 28,
     PROG_LAST      = 29,
-    ASYNC_PAYLOAD  = 30
+    ASYNC_PAYLOAD  = 30,
+    CMD_CATALOG    = 31,
+    QUEUED         = 32,
+    INFO_BATCH     = 33,
+    CREDIT         = 34,
+    FLOW_CTRL      = 35,
+    FRAGMENT       = 36
 };
 
 enum RetCode : quint16
@@ -327,8 +389,11 @@ enum RetCode : quint16
 
 enum GenFileType : quint8
 {
-    GEN_UPLOAD   = 2,
-    GEN_DOWNLOAD = 3
+    GEN_UPLOAD    = 2,
+    GEN_DOWNLOAD  = 3,
+    GEN_SYNC_UP   = 4,
+    GEN_SYNC_DOWN = 5,
+    GEN_DEDUP_UP  = 6
 };
 
 enum ChannelMemberLevel : quint8
@@ -346,6 +411,10 @@ class Query;
 QByteArray  toFixedTEXT(const QString &txt, int len);
 QByteArray  nullTermTEXT(const QString &txt);
 QByteArray  rdFileContents(const QString &path, QTextStream &msg);
+QByteArray  compressFrame(const QByteArray &data, quint8 *typeId);
+QByteArray  expandFrame(const QByteArray &data, quint8 *typeId);
+bool        compressibleType(quint8 typeId);
+bool        lowEntropy(const QByteArray &data);
 quint32     toCmdId32(quint16 cmdId, quint16 branchId);
 quint16     toCmdId16(quint32 id);
 void        printDatabaseInfo(QTextStream &txt);
@@ -418,14 +487,10 @@ public:
 
 //----------------------------
 
-class IdleTimer : public QTimer
+class IdleTimer : public WheelTimer
 {
     Q_OBJECT
 
-private slots:
-
-    void detectWrite(qint64);
-
 public:
 
     explicit IdleTimer(QObject *parent = nullptr);
@@ -0,0 +1,593 @@
+#include "fs_cache.h"
+
+//    This file is part of MRCI.
+
+//    MRCI is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+
+//    MRCI is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+
+//    You should have received a copy of the GNU General Public License
+//    along with MRCI under the LICENSE.md file. If not, see
+//    <http://www.gnu.org/licenses/>.
+
+static bool isListing(quint8 kind)
+{
+    return (kind == FS_CACHE_DIR) || (kind == FS_CACHE_DIR_NO_HIDDEN);
+}
+
+char *FsCache::slotAt(FsCacheHeader *hdr, quint32 index)
+{
+    return reinterpret_cast<char*>(hdr) + sizeof(FsCacheHeader) + (static_cast<size_t>(index) * (sizeof(FsCacheSlot) + hdr->slotData));
+}
+
+quint64 FsCache::keyHash(quint8 kind, const QByteArray &path)
+{
+    // FNV-1a; qHash() is seeded per process so it can't be shared.
+
+    quint64 ret = 14695981039346656037ULL;
+
+    ret = (ret ^ kind) * 1099511628211ULL;
+
+    for (auto byte : path)
+    {
+        ret = (ret ^ static_cast<quint8>(byte)) * 1099511628211ULL;
+    }
+
+    return ret;
+}
+
+bool FsCache::attach()
+{
+    // the block is made by the host when it starts. if it isn't there the
+    // cache is turned off in the host conf and this process won't look
+    // for it again.
+
+    if (!tried)
+    {
+        tried = true;
+        mem   = new QSharedMemory();
+
+        mem->setKey(FS_CACHE_MEM_KEY);
+
+        if (!mem->attach() || (static_cast<FsCacheHeader*>(mem->data())->magic != FS_CACHE_MAGIC))
+        {
+            delete mem;
+
+            mem = nullptr;
+        }
+    }
+
+    return mem != nullptr;
+}
+
+bool FsCache::entriesCurrent(const QString &dir, const QByteArray &entries, bool dirsOnly)
+{
+    // checks the size and modification time of the objects in a listing
+    // against what they are now. see toFILE_INFO() for the entry format.
+
+#ifdef Q_OS_LINUX
+
+    auto prefix = QFile::encodeName(dir.endsWith('/') ? dir : dir + "/");
+
+    for (int pos = 0; (pos + 2) <= entries.size();)
+    {
+        auto len   = static_cast<int>(rdInt(entries.mid(pos, 2)));
+        auto entry = entries.mid(pos + 2, len);
+
+        pos += 2 + len;
+
+        if (entry.size() < 26)
+        {
+            return false;
+        }
+
+        auto flags = static_cast<quint8>(entry[0]);
+
+        if (dirsOnly && !(flags & IS_DIR))
+        {
+            continue;
+        }
+
+        struct stat st;
+
+        auto name = entry.mid(25, entry.indexOf('\0', 25) - 25);
+
+        if (stat((prefix + name).constData(), &st) != 0)
+        {
+            // a dangling symlink is listed as not existing.
+
+            if (flags & EXISTS) return false;
+            else                continue;
+        }
+
+        auto mtime = (static_cast<qint64>(st.st_mtim.tv_sec) * 1000) + (st.st_mtim.tv_nsec / 1000000);
+
+        if (!(flags & EXISTS) || (static_cast<qint64>(rdInt(entry.mid(9, 8))) != mtime) ||
+            (!(flags & IS_DIR) && (static_cast<qint64>(rdInt(entry.mid(17, 8))) != static_cast<qint64>(st.st_size))))
+        {
+            return false;
+        }
+    }
+
+    return true;
+
+#else
+
+    Q_UNUSED(dir)
+    Q_UNUSED(entries)
+    Q_UNUSED(dirsOnly)
+
+    return false;
+
+#endif
+
+}
+
+bool FsCache::stamp(const QString &path, FsCacheStamp *out)
+{
+
+#ifdef Q_OS_LINUX
+
+    struct stat st;
+
+    if (stat(QFile::encodeName(path).constData(), &st) != 0)
+    {
+        return false;
+    }
+
+    out->dev     = static_cast<quint64>(st.st_dev);
+    out->ino     = static_cast<quint64>(st.st_ino);
+    out->size    = static_cast<qint64>(st.st_size);
+    out->mtimeNs = (static_cast<qint64>(st.st_mtim.tv_sec) * 1000000000) + st.st_mtim.tv_nsec;
+    out->ctimeNs = (static_cast<qint64>(st.st_ctim.tv_sec) * 1000000000) + st.st_ctim.tv_nsec;
+
+    return true;
+
+#else
+
+    Q_UNUSED(path)
+    Q_UNUSED(out)
+
+    return false;
+
+#endif
+
+}
+
+bool FsCache::find(quint8 kind, const QString &path, QByteArray *data)
+{
+    FsCacheStamp now;
+
+    if (!attach() || !stamp(path, &now))
+    {
+        return false;
+    }
+
+    auto key   = path.toUtf8();
+    auto hash  = keyHash(kind, key);
+    auto ret   = false;
+    auto stale = false;
+
+    mem->lock();
+
+    auto *hdr = static_cast<FsCacheHeader*>(mem->data());
+
+    for (quint32 i = 0; i < hdr->slots; ++i)
+    {
+        auto *blk  = slotAt(hdr, i);
+        auto *slot = reinterpret_cast<FsCacheSlot*>(blk);
+
+        if ((slot->kind == kind) && (slot->keyHash == hash) && (slot->pathLen == key.size()) &&
+            (memcmp(blk + sizeof(FsCacheSlot), key.constData(), static_cast<size_t>(key.size())) == 0))
+        {
+            if (memcmp(&slot->stamp, &now, sizeof(FsCacheStamp)) != 0)
+            {
+                slot->kind = 0;
+
+                hdr->invalidations++;
+            }
+            else if (slot->watched)
+            {
+                *data = QByteArray(blk + sizeof(FsCacheSlot) + slot->pathLen, static_cast<int>(slot->dataLen));
+
+                slot->lastUsed = ++hdr->tick;
+
+                ret = true;
+            }
+
+            break;
+        }
+    }
+
+    mem->unlock();
+
+    // the child directories of a listing are checked with the block
+    // unlocked; a stale listing is simply replaced by the store() that
+    // follows the miss.
+
+    if (ret && isListing(kind) && !entriesCurrent(path, *data, true))
+    {
+        data->clear();
+
+        ret   = false;
+        stale = true;
+    }
+
+    mem->lock();
+
+    if (ret)   hdr->hits++;
+    else       hdr->misses++;
+    if (stale) hdr->invalidations++;
+
+    mem->unlock();
+
+    return ret;
+}
+
+void FsCache::store(quint8 kind, const QString &path, const FsCacheStamp &before, const QByteArray &data)
+{
+    FsCacheStamp now;
+
+    auto key = path.toUtf8();
+
+    if (!attach() || ((key.size() + data.size()) > FS_CACHE_SLOT_DATA))
+    {
+        return;
+    }
+
+    // the data could be of either version of the path if it changed while
+    // it was being read.
+
+    if (!stamp(path, &now) || (memcmp(&now, &before, sizeof(FsCacheStamp)) != 0))
+    {
+        return;
+    }
+
+    auto hash = keyHash(kind, key);
+
+    mem->lock();
+
+    auto *hdr    = static_cast<FsCacheHeader*>(mem->data());
+    auto *target = static_cast<char*>(nullptr);
+    auto *oldest = static_cast<char*>(nullptr);
+
+    for (quint32 i = 0; i < hdr->slots; ++i)
+    {
+        auto *blk  = slotAt(hdr, i);
+        auto *slot = reinterpret_cast<FsCacheSlot*>(blk);
+
+        if ((slot->kind == kind) && (slot->keyHash == hash) && (slot->pathLen == key.size()) &&
+            (memcmp(blk + sizeof(FsCacheSlot), key.constData(), static_cast<size_t>(key.size())) == 0))
+        {
+            target = blk; break;
+        }
+        else if ((slot->kind == 0) && (target == nullptr))
+        {
+            target = blk;
+        }
+        else if ((oldest == nullptr) || (slot->lastUsed < reinterpret_cast<FsCacheSlot*>(oldest)->lastUsed))
+        {
+            oldest = blk;
+        }
+    }
+
+    if (target == nullptr)
+    {
+        target = oldest;
+
+        hdr->evictions++;
+    }
+
+    if (target != nullptr)
+    {
+        auto *slot = reinterpret_cast<FsCacheSlot*>(target);
+
+        slot->keyHash    = hash;
+        slot->lastUsed   = ++hdr->tick;
+        slot->stamp      = before;
+        slot->storedMsec = QDateTime::currentMSecsSinceEpoch();
+        slot->wd         = -1;
+        slot->dataLen    = static_cast<quint32>(data.size());
+        slot->pathLen    = static_cast<quint16>(key.size());
+        slot->kind       = kind;
+        slot->watched    = isListing(kind) ? 0 : 1;
+
+        memcpy(target + sizeof(FsCacheSlot), key.constData(), static_cast<size_t>(key.size()));
+        memcpy(target + sizeof(FsCacheSlot) + key.size(), data.constData(), static_cast<size_t>(data.size()));
+
+        hdr->stores++;
+    }
+
+    mem->unlock();
+}
+
+FsCacheWatcher::FsCacheWatcher(QObject *parent) : QObject(parent)
+{
+    mem       = new QSharedMemory(this);
+    scanTimer = new QTimer(this);
+    notifier  = nullptr;
+    fd        = -1;
+
+    connect(scanTimer, &QTimer::timeout, this, &FsCacheWatcher::scan);
+}
+
+FsCacheWatcher *FsCacheWatcher::instance()
+{
+    static FsCacheWatcher inst;
+
+    return &inst;
+}
+
+void FsCacheWatcher::start(const QJsonObject &conf)
+{
+
+#ifdef Q_OS_LINUX
+
+    auto slots = conf[CONF_FS_CACHE_SLOTS].toInt(DEFAULT_FS_CACHE_SLOTS);
+    auto len   = static_cast<int>(sizeof(FsCacheHeader) + (static_cast<size_t>(qMax(slots, 0)) * (sizeof(FsCacheSlot) + FS_CACHE_SLOT_DATA)));
+
+    mem->setKey(FS_CACHE_MEM_KEY);
+
+    // a block left behind by a host that didn't shut down cleanly is taken
+    // over and cleared if it's big enough.
+
+    if ((slots > 0) && !mem->isAttached() && (mem->create(len) || (mem->attach() && (mem->size() >= len))))
+    {
+        mem->lock();
+
+        auto *hdr = static_cast<FsCacheHeader*>(mem->data());
+
+        memset(mem->data(), 0, static_cast<size_t>(len));
+
+        hdr->magic    = FS_CACHE_MAGIC;
+        hdr->slots    = static_cast<quint32>(slots);
+        hdr->slotData = FS_CACHE_SLOT_DATA;
+
+        mem->unlock();
+
+        fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+        if (fd != -1)
+        {
+            notifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+
+            connect(notifier, &QSocketNotifier::activated, this, &FsCacheWatcher::readEvents);
+        }
+
+        scanTimer->start(FS_CACHE_SCAN_MSEC);
+    }
+
+#else
+
+    Q_UNUSED(conf)
+
+#endif
+
+}
+
+void FsCacheWatcher::invalidate(const QSet<int> &wds, bool all)
+{
+    mem->lock();
+
+    auto *hdr = static_cast<FsCacheHeader*>(mem->data());
+
+    for (quint32 i = 0; i < hdr->slots; ++i)
+    {
+        auto *slot = reinterpret_cast<FsCacheSlot*>(FsCache::slotAt(hdr, i));
+
+        if (isListing(slot->kind) && slot->watched && (all || wds.contains(slot->wd)))
+        {
+            slot->kind = 0;
+
+            hdr->invalidations++;
+        }
+    }
+
+    mem->unlock();
+}
+
+void FsCacheWatcher::readEvents()
+{
+
+#ifdef Q_OS_LINUX
+
+    alignas(inotify_event) char buff[8192];
+
+    QSet<int> changed;
+
+    auto overflow = false;
+    auto len      = read(fd, buff, sizeof(buff));
+
+    while (len > 0)
+    {
+        for (auto *ptr = buff; ptr < (buff + len);)
+        {
+            auto *event = reinterpret_cast<const inotify_event*>(ptr);
+
+            if (event->mask & IN_Q_OVERFLOW)
+            {
+                // events were lost so there's no telling what changed.
+
+                overflow = true;
+            }
+            else
+            {
+                changed.insert(event->wd);
+            }
+
+            if (event->mask & IN_IGNORED)
+            {
+                // the kernel already dropped the watch, the directory is gone.
+
+                watches.remove(event->wd);
+            }
+
+            ptr += sizeof(inotify_event) + event->len;
+        }
+
+        len = read(fd, buff, sizeof(buff));
+    }
+
+    if (overflow || !changed.isEmpty())
+    {
+        invalidate(changed, overflow);
+    }
+
+#endif
+
+}
+
+void FsCacheWatcher::scan()
+{
+
+#ifdef Q_OS_LINUX
+
+    QSet<int>           inUse;
+    QList<FsCacheCheck> checks;
+
+    auto now     = QDateTime::currentMSecsSinceEpoch();
+    auto entries = 0;
+
+    // the listings that still need a watch are copied out so the watch and
+    // the stat() calls below are done without holding up every command
+    // process that uses the cache.
+
+    mem->lock();
+
+    auto *hdr = static_cast<FsCacheHeader*>(mem->data());
+
+    for (quint32 i = 0; (i < hdr->slots) && (fd != -1); ++i)
+    {
+        auto *blk  = FsCache::slotAt(hdr, i);
+        auto *slot = reinterpret_cast<FsCacheSlot*>(blk);
+
+        if (isListing(slot->kind) && !slot->watched)
+        {
+            FsCacheCheck check;
+
+            check.index      = i;
+            check.keyHash    = slot->keyHash;
+            check.storedMsec = slot->storedMsec;
+            check.stamp      = slot->stamp;
+            check.path       = QString::fromUtf8(blk + sizeof(FsCacheSlot), slot->pathLen);
+            check.entries    = QByteArray(blk + sizeof(FsCacheSlot) + slot->pathLen, static_cast<int>(slot->dataLen));
+            check.wd         = -1;
+            check.current    = false;
+
+            checks.append(check);
+        }
+    }
+
+    mem->unlock();
+
+    for (auto &check : checks)
+    {
+        // the stamp and the objects in the listing are checked again once
+        // the watch is on so anything that changed between the listing
+        // being read and the watch being added is caught. it's one stat()
+        // per entry, once per listing, and a slot can't hold more than a
+        // few thousand entries.
+
+        FsCacheStamp stamp;
+
+        check.wd = inotify_add_watch(fd, QFile::encodeName(check.path).constData(), IN_ATTRIB | IN_CREATE | IN_DELETE | IN_DELETE_SELF |
+                                                                                    IN_MODIFY | IN_MOVE_SELF | IN_MOVED_FROM | IN_MOVED_TO |
+                                                                                    IN_ONLYDIR);
+        if (check.wd != -1)
+        {
+            watches.insert(check.wd);
+
+            check.current = FsCache::stamp(check.path, &stamp) && (memcmp(&stamp, &check.stamp, sizeof(FsCacheStamp)) == 0) &&
+                            FsCache::entriesCurrent(check.path, check.entries, false);
+        }
+    }
+
+    mem->lock();
+
+    for (auto &check : checks)
+    {
+        // the slot could have been evicted or stored again while the lock
+        // was released so the result only applies if it still holds the
+        // same listing. a watch that ends up unused is dropped below.
+
+        auto *slot = reinterpret_cast<FsCacheSlot*>(FsCache::slotAt(hdr, check.index));
+
+        if (isListing(slot->kind) && !slot->watched && (slot->keyHash == check.keyHash) && (slot->storedMsec == check.storedMsec) &&
+            (memcmp(&slot->stamp, &check.stamp, sizeof(FsCacheStamp)) == 0))
+        {
+            if (check.current)
+            {
+                slot->wd      = check.wd;
+                slot->watched = 1;
+            }
+            else
+            {
+                slot->kind = 0;
+
+                hdr->invalidations++;
+            }
+        }
+    }
+
+    for (quint32 i = 0; i < hdr->slots; ++i)
+    {
+        auto *slot = reinterpret_cast<FsCacheSlot*>(FsCache::slotAt(hdr, i));
+
+        // the age cap covers what no stamp or watch sees, like the mount an
+        // FS_CACHE_INFO_TEXT record names as its device being changed.
+
+        if ((slot->kind != 0) && ((now - slot->storedMsec) > FS_CACHE_MAX_AGE))
+        {
+            slot->kind = 0;
+        }
+
+        if (slot->kind != 0)
+        {
+            entries++;
+
+            if (slot->watched && isListing(slot->kind))
+            {
+                inUse.insert(slot->wd);
+            }
+        }
+    }
+
+    // watches on directories that are no longer cached are dropped so the
+    // number of watches never goes past the number of slots.
+
+    auto unused = watches - inUse;
+
+    watches = inUse;
+
+    hdr->watches = static_cast<quint32>(watches.size());
+
+    auto hits   = static_cast<qint64>(hdr->hits);
+    auto misses = static_cast<qint64>(hdr->misses);
+
+    HostMetrics::set("fs_cache.hits", hits);
+    HostMetrics::set("fs_cache.misses", misses);
+    HostMetrics::set("fs_cache.hit_rate_pct", ((hits + misses) > 0) ? ((hits * 100) / (hits + misses)) : 0);
+    HostMetrics::set("fs_cache.entries", entries);
+    HostMetrics::set("fs_cache.watches", watches.size());
+    HostMetrics::set("fs_cache.invalidations", static_cast<qint64>(hdr->invalidations));
+    HostMetrics::set("fs_cache.evictions", static_cast<qint64>(hdr->evictions));
+
+    mem->unlock();
+
+    for (auto wd : unused)
+    {
+        inotify_rm_watch(fd, wd);
+    }
+
+#endif
+
+}
+
+QSharedMemory *FsCache::mem   = nullptr;
+bool           FsCache::tried = false;
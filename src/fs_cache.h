@@ -0,0 +1,161 @@
+#ifndef FS_CACHE_H
+#define FS_CACHE_H
+
+//    This file is part of MRCI.
+
+//    MRCI is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+
+//    MRCI is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+
+//    You should have received a copy of the GNU General Public License
+//    along with MRCI under the LICENSE.md file. If not, see
+//    <http://www.gnu.org/licenses/>.
+
+#include "common.h"
+
+#include <QSocketNotifier>
+
+#ifdef Q_OS_LINUX
+
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#endif
+
+#define FS_CACHE_MEM_KEY   "MRCI_Fs_Cache_Mem_Key"
+#define FS_CACHE_MAGIC     0x4d524643
+#define FS_CACHE_SLOT_DATA 65536 // path and payload bytes a single slot can hold.
+#define FS_CACHE_SCAN_MSEC 200   // how often the host puts watches on newly cached directories.
+#define FS_CACHE_MAX_AGE   60000 // msec any entry is served for at most, see FsCacheWatcher::scan().
+
+enum FsCacheKind : quint8
+{
+    FS_CACHE_DIR           = 1, // INFO_BATCH formatted listing, hidden entries included.
+    FS_CACHE_DIR_NO_HIDDEN = 2, // same, hidden entries left out.
+    FS_CACHE_INFO          = 3, // FILE_INFO of a single object.
+    FS_CACHE_INFO_TEXT     = 4  // fs_info's text output for a single object.
+};
+
+struct FsCacheStamp
+{
+    quint64 dev;
+    quint64 ino;
+    qint64  size;
+    qint64  mtimeNs;
+    qint64  ctimeNs;
+};
+
+struct FsCacheHeader
+{
+    quint32 magic;
+    quint32 slots;
+    quint32 slotData;
+    quint32 watches;
+    quint64 tick;
+    quint64 hits;
+    quint64 misses;
+    quint64 stores;
+    quint64 invalidations;
+    quint64 evictions;
+};
+
+struct FsCacheSlot
+{
+    quint64      keyHash;
+    quint64      lastUsed;
+    FsCacheStamp stamp;
+    qint64       storedMsec;
+    qint32       wd;      // inotify watch on the listed directory, -1 until the host adds it.
+    quint32      dataLen;
+    quint16      pathLen;
+    quint8       kind;    // 0 means the slot is empty.
+    quint8       watched; // listings are only served once the host watches them.
+};
+
+struct FsCacheCheck
+{
+    quint32      index;
+    quint64      keyHash;
+    qint64       storedMsec;
+    FsCacheStamp stamp;
+    QString      path;
+    QByteArray   entries;
+    qint32       wd;
+    bool         current;
+};
+
+class FsCache
+{
+    // host wide LRU of directory listings and FILE_INFO records in a shared
+    // memory block so every command process sees what the others cached.
+    // each entry carries a stamp of the stat() of its path when it was read
+    // and is dropped if the path no longer matches it; that covers the path
+    // itself being changed, replaced or removed. changes to the objects
+    // inside of a listed directory don't show in its stamp so listings are
+    // only served while the host holds an inotify watch on the directory,
+    // see FsCacheWatcher. the watch doesn't see the contents of a child
+    // directory change either so those are stat()'d again on every hit.
+    // Linux only; elsewhere nothing is ever cached.
+
+    friend class FsCacheWatcher;
+
+private:
+
+    static QSharedMemory *mem;
+    static bool           tried;
+
+    static char   *slotAt(FsCacheHeader *hdr, quint32 index);
+    static quint64 keyHash(quint8 kind, const QByteArray &path);
+    static bool    attach();
+    static bool    entriesCurrent(const QString &dir, const QByteArray &entries, bool dirsOnly);
+
+public:
+
+    static bool stamp(const QString &path, FsCacheStamp *out);
+    static bool find(quint8 kind, const QString &path, QByteArray *data);
+    static void store(quint8 kind, const QString &path, const FsCacheStamp &before, const QByteArray &data);
+};
+
+//-----------------------
+
+class FsCacheWatcher : public QObject
+{
+    Q_OBJECT
+
+    // host side of FsCache. creates the shared block, puts inotify watches
+    // on the directories that were cached since the last scan, drops the
+    // listings of directories that report a change and copies the cache
+    // counters into HostMetrics.
+
+private:
+
+    QSharedMemory   *mem;
+    QSocketNotifier *notifier;
+    QTimer          *scanTimer;
+    QSet<int>        watches;
+    int              fd;
+
+    explicit FsCacheWatcher(QObject *parent = nullptr);
+
+    void invalidate(const QSet<int> &wds, bool all);
+
+private slots:
+
+    void readEvents();
+    void scan();
+
+public:
+
+    static FsCacheWatcher *instance();
+
+    void start(const QJsonObject &conf);
+};
+
+#endif // FS_CACHE_H
@@ -0,0 +1,114 @@
+#include "host_metrics.h"
+
+//    This file is part of MRCI.
+
+//    MRCI is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+
+//    MRCI is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+
+//    You should have received a copy of the GNU General Public License
+//    along with MRCI under the LICENSE.md file. If not, see
+//    <http://www.gnu.org/licenses/>.
+
+void HostMetrics::add(const QString &key, qint64 delta)
+{
+    QWriteLocker locker(&lock);
+
+    values[key] += delta;
+}
+
+void HostMetrics::set(const QString &key, qint64 value)
+{
+    QWriteLocker locker(&lock);
+
+    values[key] = value;
+}
+
+void HostMetrics::setMax(const QString &key, qint64 value)
+{
+    QWriteLocker locker(&lock);
+
+    if (value > values.value(key))
+    {
+        values[key] = value;
+    }
+}
+
+qint64 HostMetrics::value(const QString &key)
+{
+    QReadLocker locker(&lock);
+
+    return values.value(key);
+}
+
+void HostMetrics::print(QTextStream &txtOut)
+{
+    QReadLocker locker(&lock);
+
+    txtOut << "Metrics:" << Qt::endl << Qt::endl;
+
+    for (auto it = values.constBegin(); it != values.constEnd(); ++it)
+    {
+        txtOut << "  " << it.key() << ": " << it.value() << Qt::endl;
+    }
+
+    txtOut << Qt::endl;
+}
+
+QString HostMetrics::boundedKey(const QString &group, const QString &name, int max)
+{
+    // keys named after something there is no limit to, like user names, are
+    // kept to the max most recently used names of the group. the counters of
+    // the name that is pushed out are folded into {group}.(other) so the
+    // totals still add up; peak values are kept as the highest of the two.
+
+    QWriteLocker locker(&lock);
+
+    auto &names = groups[group];
+
+    if (!names.removeOne(name) && (names.size() >= max))
+    {
+        auto prefix = group + "." + names.takeFirst() + ".";
+        auto other  = group + ".(other).";
+
+        QMap<QString, qint64> folded;
+
+        for (auto it = values.constBegin(); it != values.constEnd(); ++it)
+        {
+            if (it.key().startsWith(prefix))
+            {
+                folded.insert(it.key(), it.value());
+            }
+        }
+
+        for (auto it = folded.constBegin(); it != folded.constEnd(); ++it)
+        {
+            auto otherKey = other + it.key().mid(prefix.size());
+
+            if (otherKey.contains(".peak_"))
+            {
+                values[otherKey] = qMax(values.value(otherKey), it.value());
+            }
+            else
+            {
+                values[otherKey] += it.value();
+            }
+
+            values.remove(it.key());
+        }
+    }
+
+    names.append(name);
+
+    return group + "." + name;
+}
+
+QReadWriteLock              HostMetrics::lock;
+QMap<QString, qint64>       HostMetrics::values;
+QHash<QString, QStringList> HostMetrics::groups;
@@ -0,0 +1,48 @@
+#ifndef HOST_METRICS_H
+#define HOST_METRICS_H
+
+//    This file is part of MRCI.
+
+//    MRCI is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+
+//    MRCI is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+
+//    You should have received a copy of the GNU General Public License
+//    along with MRCI under the LICENSE.md file. If not, see
+//    <http://www.gnu.org/licenses/>.
+
+#include <QMap>
+#include <QHash>
+#include <QString>
+#include <QStringList>
+#include <QTextStream>
+#include <QReadWriteLock>
+
+class HostMetrics
+{
+    // host wide counters that any session thread can update. these are
+    // displayed by the -status host control option.
+
+private:
+
+    static QReadWriteLock              lock;
+    static QMap<QString, qint64>       values;
+    static QHash<QString, QStringList> groups;
+
+public:
+
+    static void    add(const QString &key, qint64 delta);
+    static void    set(const QString &key, qint64 value);
+    static void    setMax(const QString &key, qint64 value);
+    static qint64  value(const QString &key);
+    static void    print(QTextStream &txtOut);
+    static QString boundedKey(const QString &group, const QString &name, int max);
+};
+
+#endif // HOST_METRICS_H
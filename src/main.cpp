@@ -177,6 +177,7 @@ int main(int argc, char *argv[])
     qRegisterMetaType<QAbstractSocket::SocketState>("QAbstractSocket::SocketState");
     qRegisterMetaType<QSharedPointer<QByteArray> >("QSharedPointer<QByteArray>");
     qRegisterMetaType<QSharedPointer<SessionCarrier> >("QSharedPointer<SessionCarrier>");
+    qRegisterMetaType<QSharedPointer<CastFrame> >("QSharedPointer<CastFrame>");
 
     serializeThread(app.thread());
 
@@ -23,6 +23,7 @@ QString createHostSharedMem(QSharedMemory *mem)
     QString ret;
 
     len += BLKSIZE_HOST_LOAD; // hostLoad
+    len += BLKSIZE_COMP_SES;  // compressSes
 
     mem->setKey(HOST_NON_NATIVE_KEY);
 
@@ -358,6 +359,7 @@ bool MemShare::createSharedMem(const QByteArray &sesId, const QString &hostKey)
     len += (BLKSIZE_SUB_CHANNEL * MAX_OPEN_SUB_CHANNELS); // openWritableSubChs
     len += (BLKSIZE_SESSION_ID * MAX_P2P_LINKS);          // p2pPending
     len += (BLKSIZE_SESSION_ID * MAX_P2P_LINKS);          // p2pAccepted
+    len += BLKSIZE_CLIENT_CAPS;                           // clientCaps
 
     if (!sharedMem->create(len))
     {
@@ -424,7 +426,9 @@ void MemShare::setupDataBlocks()
         openWritableSubChs = sesMasterBlock + sesOffs; sesOffs += (BLKSIZE_SUB_CHANNEL * MAX_OPEN_SUB_CHANNELS);
         p2pPending         = sesMasterBlock + sesOffs; sesOffs += (BLKSIZE_SESSION_ID * MAX_P2P_LINKS);
         p2pAccepted        = sesMasterBlock + sesOffs; sesOffs += (BLKSIZE_SESSION_ID * MAX_P2P_LINKS);
+        clientCaps         = sesMasterBlock + sesOffs; sesOffs += BLKSIZE_CLIENT_CAPS;
         hostLoad           = hosMasterBlock + hosOffs; hosOffs += BLKSIZE_HOST_LOAD;
+        compressSes        = hosMasterBlock + hosOffs; hosOffs += BLKSIZE_COMP_SES;
         sesMemKey          = sharedMem->nativeKey();
         hostMemKey         = hostSharedMem->nativeKey();
     }
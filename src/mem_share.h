@@ -39,6 +39,8 @@
 #define BLKSIZE_CH_OVERRIDE 1
 #define BLKSIZE_HOST_LOAD   4
 #define BLKSIZE_EMAIL_ADDR  64
+#define BLKSIZE_CLIENT_CAPS 1
+#define BLKSIZE_COMP_SES    4
 
 #define HOST_NON_NATIVE_KEY "MRCI_Host_Shared_Mem_Key"
 
@@ -95,6 +97,8 @@ protected:
     char          *activeUpdate;
     char          *chOwnerOverride;
     char          *hostLoad;
+    char          *clientCaps;
+    char          *compressSes;
 
     bool       createSharedMem(const QByteArray &sesId, const QString &hostKey);
     bool       attachSharedMem(const QString &sKey, const QString &hKey);
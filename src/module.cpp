@@ -16,116 +16,172 @@
 //    along with MRCI under the LICENSE.md file. If not, see
 //    <http://www.gnu.org/licenses/>.
 
-Module::Module(QObject *parent) : QObject(parent) {}
-
-QStringList Module::userCmdList()
+// the internal module's command registry. every internal command is defined
+// once here; the public, exempt and user listings, the gen file types sent
+// with NEW_CMD and the -run_cmd dispatcher are all generated from this table.
+// the name column must match the command's cmdName() and the base name of
+// its doc file in docs/intern_commands; debug builds check the former when
+// the module starts.
+
+static constexpr InternCmd internCmds[] =
+{
+    {"auth",                  &makeCmd<Auth>,                  &Auth::cmdName,                  CMD_PUBLIC | CMD_EXEMPT,              0},
+    {"my_info",               &makeCmd<MyInfo>,                &MyInfo::cmdName,                CMD_PUBLIC | CMD_EXEMPT,              0},
+    {"set_disp_name",         &makeCmd<ChangeDispName>,        &ChangeDispName::cmdName,        CMD_EXEMPT,                           0},
+    {"set_user_name",         &makeCmd<ChangeUsername>,        &ChangeUsername::cmdName,        CMD_EXEMPT,                           0},
+    {"set_pw",                &makeCmd<ChangePassword>,        &ChangePassword::cmdName,        CMD_EXEMPT,                           0},
+    {"set_email",             &makeCmd<ChangeEmail>,           &ChangeEmail::cmdName,           CMD_EXEMPT,                           0},
+    {"is_email_verified",     &makeCmd<IsEmailVerified>,       &IsEmailVerified::cmdName,       CMD_EXEMPT,                           0},
+    {"verify_email",          &makeCmd<VerifyEmail>,           &VerifyEmail::cmdName,           CMD_EXEMPT | GATE_EVERIFY,            0},
+    {"add_acct",              &makeCmd<CreateUser>,            &CreateUser::cmdName,            CMD_USER | CMD_PUBLIC | GATE_PUB_REG, 0},
+    {"request_pw_reset",      &makeCmd<ResetPwRequest>,        &ResetPwRequest::cmdName,        CMD_USER | CMD_PUBLIC | GATE_PW_RES,  0},
+    {"recover_acct",          &makeCmd<RecoverAcct>,           &RecoverAcct::cmdName,           CMD_USER | CMD_PUBLIC | GATE_PW_RES,  0},
+    {"cast",                  &makeCmd<Cast>,                  &Cast::cmdName,                  CMD_USER,                             0},
+    {"open_sub_ch",           &makeCmd<OpenSubChannel>,        &OpenSubChannel::cmdName,        CMD_USER,                             0},
+    {"close_sub_ch",          &makeCmd<CloseSubChannel>,       &CloseSubChannel::cmdName,       CMD_USER,                             0},
+    {"ls_open_chs",           &makeCmd<LsOpenChannels>,        &LsOpenChannels::cmdName,        CMD_USER,                             0},
+    {"host_info",             &makeCmd<HostInfo>,              &HostInfo::cmdName,              CMD_USER,                             0},
+    {"ls_act_log",            &makeCmd<IPHist>,                &IPHist::cmdName,                CMD_USER,                             0},
+    {"ls_mods",               &makeCmd<ListMods>,              &ListMods::cmdName,              CMD_USER,                             0},
+    {"rm_mod",                &makeCmd<DelMod>,                &DelMod::cmdName,                CMD_USER,                             0},
+    {"add_mod",               &makeCmd<AddMod>,                &AddMod::cmdName,                CMD_USER,                             0},
+    {"ls_users",              &makeCmd<ListUsers>,             &ListUsers::cmdName,             CMD_USER,                             0},
+    {"ls_auth_log",           &makeCmd<AuthLog>,               &AuthLog::cmdName,               CMD_USER,                             0},
+    {"ls_ranked_cmds",        &makeCmd<LsCmdRanks>,            &LsCmdRanks::cmdName,            CMD_USER,                             0},
+    {"rm_ranked_cmd",         &makeCmd<RemoveCmdRank>,         &RemoveCmdRank::cmdName,         CMD_USER,                             0},
+    {"add_ranked_cmd",        &makeCmd<AssignCmdRank>,         &AssignCmdRank::cmdName,         CMD_USER,                             0},
+    {"lock_acct",             &makeCmd<LockUser>,              &LockUser::cmdName,              CMD_USER,                             0},
+    {"request_new_user_name", &makeCmd<NameChangeRequest>,     &NameChangeRequest::cmdName,     CMD_USER,                             0},
+    {"request_new_pw",        &makeCmd<PasswordChangeRequest>, &PasswordChangeRequest::cmdName, CMD_USER,                             0},
+    {"force_set_email",       &makeCmd<OverWriteEmail>,        &OverWriteEmail::cmdName,        CMD_USER,                             0},
+    {"rm_acct",               &makeCmd<RemoveUser>,            &RemoveUser::cmdName,            CMD_USER,                             0},
+    {"set_user_rank",         &makeCmd<ChangeUserRank>,        &ChangeUserRank::cmdName,        CMD_USER,                             0},
+    {"fs_download",           &makeCmd<DownloadFile>,          &DownloadFile::cmdName,          CMD_USER,                             GEN_DOWNLOAD},
+    {"fs_upload",             &makeCmd<UploadFile>,            &UploadFile::cmdName,            CMD_USER,                             GEN_UPLOAD},
+    {"fs_delete",             &makeCmd<Delete>,                &Delete::cmdName,                CMD_USER,                             0},
+    {"fs_copy",               &makeCmd<Copy>,                  &Copy::cmdName,                  CMD_USER,                             0},
+    {"fs_move",               &makeCmd<Move>,                  &Move::cmdName,                  CMD_USER,                             0},
+    {"fs_list",               &makeCmd<ListFiles>,             &ListFiles::cmdName,             CMD_USER,                             0},
+    {"fs_info",               &makeCmd<FileInfo>,              &FileInfo::cmdName,              CMD_USER,                             0},
+    {"fs_mkpath",             &makeCmd<MakePath>,              &MakePath::cmdName,              CMD_USER,                             0},
+    {"fs_cd",                 &makeCmd<ChangeDir>,             &ChangeDir::cmdName,             CMD_USER,                             0},
+    {"fs_tree",               &makeCmd<Tree>,                  &Tree::cmdName,                  CMD_USER,                             0},
+    {"fs_transfer",           &makeCmd<TransferStatus>,        &TransferStatus::cmdName,        CMD_USER,                             0},
+    {"fs_sync_up",            &makeCmd<SyncUpload>,            &SyncUpload::cmdName,            CMD_USER,                             GEN_SYNC_UP},
+    {"fs_sync_down",          &makeCmd<SyncDownload>,          &SyncDownload::cmdName,          CMD_USER,                             GEN_SYNC_DOWN},
+    {"fs_dedup_up",           &makeCmd<DedupUpload>,           &DedupUpload::cmdName,           CMD_USER,                             GEN_DEDUP_UP},
+    {"to_peer",               &makeCmd<ToPeer>,                &ToPeer::cmdName,                CMD_USER,                             0},
+    {"ls_p2p",                &makeCmd<LsP2P>,                 &LsP2P::cmdName,                 CMD_USER,                             0},
+    {"p2p_open",              &makeCmd<P2POpen>,               &P2POpen::cmdName,               CMD_USER,                             0},
+    {"p2p_close",             &makeCmd<P2PClose>,              &P2PClose::cmdName,              CMD_USER,                             0},
+    {"p2p_request",           &makeCmd<P2PRequest>,            &P2PRequest::cmdName,            CMD_USER,                             0},
+    {"ping_peers",            &makeCmd<PingPeers>,             &PingPeers::cmdName,             CMD_USER,                             0},
+    {"add_ch",                &makeCmd<CreateChannel>,         &CreateChannel::cmdName,         CMD_USER,                             0},
+    {"rm_ch",                 &makeCmd<RemoveChannel>,         &RemoveChannel::cmdName,         CMD_USER,                             0},
+    {"rename_ch",             &makeCmd<RenameChannel>,         &RenameChannel::cmdName,         CMD_USER,                             0},
+    {"set_active_flag",       &makeCmd<SetActiveState>,        &SetActiveState::cmdName,        CMD_USER,                             0},
+    {"add_sub_ch",            &makeCmd<CreateSubCh>,           &CreateSubCh::cmdName,           CMD_USER,                             0},
+    {"rm_sub_ch",             &makeCmd<RemoveSubCh>,           &RemoveSubCh::cmdName,           CMD_USER,                             0},
+    {"rename_sub_ch",         &makeCmd<RenameSubCh>,           &RenameSubCh::cmdName,           CMD_USER,                             0},
+    {"ls_chs",                &makeCmd<ListChannels>,          &ListChannels::cmdName,          CMD_USER,                             0},
+    {"ls_sub_chs",            &makeCmd<ListSubCh>,             &ListSubCh::cmdName,             CMD_USER,                             0},
+    {"find_ch",               &makeCmd<SearchChannels>,        &SearchChannels::cmdName,        CMD_USER,                             0},
+    {"invite_to_ch",          &makeCmd<InviteToCh>,            &InviteToCh::cmdName,            CMD_USER,                             0},
+    {"decline_ch",            &makeCmd<DeclineChInvite>,       &DeclineChInvite::cmdName,       CMD_USER,                             0},
+    {"accept_ch",             &makeCmd<AcceptChInvite>,        &AcceptChInvite::cmdName,        CMD_USER,                             0},
+    {"remove_ch_member",      &makeCmd<RemoveChMember>,        &RemoveChMember::cmdName,        CMD_USER,                             0},
+    {"set_member_level",      &makeCmd<SetMemberLevel>,        &SetMemberLevel::cmdName,        CMD_USER,                             0},
+    {"set_sub_ch_level",      &makeCmd<SetSubAcessLevel>,      &SetSubAcessLevel::cmdName,      CMD_USER,                             0},
+    {"ls_ch_members",         &makeCmd<ListMembers>,           &ListMembers::cmdName,           CMD_USER,                             0},
+    {"add_rdonly_flag",       &makeCmd<AddRDOnlyFlag>,         &AddRDOnlyFlag::cmdName,         CMD_USER,                             0},
+    {"rm_rdonly_flag",        &makeCmd<RemoveRDOnlyFlag>,      &RemoveRDOnlyFlag::cmdName,      CMD_USER,                             0},
+    {"ls_rdonly_flags",       &makeCmd<ListRDonlyFlags>,       &ListRDonlyFlags::cmdName,       CMD_USER,                             0},
+    {"ch_owner_override",     &makeCmd<OwnerOverride>,         &OwnerOverride::cmdName,         CMD_USER,                             0}
+};
+
+static constexpr int      internCmdCount = sizeof(internCmds) / sizeof(InternCmd);
+static constexpr quint32  internCmdSeed  = findCmdSeed(internCmds);
+static constexpr CmdSlots internCmdSlots = buildCmdSlots(internCmds, internCmdSeed);
+
+static_assert(uniqueCmdNames(internCmds), "duplicate command name found in the internal command registry.");
+
+Module::Module(QObject *parent) : QObject(parent)
 {
-    QStringList ret;
-
-    ret << Cast::cmdName();
-    ret << OpenSubChannel::cmdName();
-    ret << CloseSubChannel::cmdName();
-    ret << LsOpenChannels::cmdName();
-    ret << HostInfo::cmdName();
-    ret << IPHist::cmdName();
-    ret << ListMods::cmdName();
-    ret << DelMod::cmdName();
-    ret << AddMod::cmdName();
-    ret << ListUsers::cmdName();
-    ret << CreateUser::cmdName();
-    ret << RecoverAcct::cmdName();
-    ret << ResetPwRequest::cmdName();
-    ret << AuthLog::cmdName();
-    ret << LsCmdRanks::cmdName();
-    ret << RemoveCmdRank::cmdName();
-    ret << AssignCmdRank::cmdName();
-    ret << LockUser::cmdName();
-    ret << NameChangeRequest::cmdName();
-    ret << PasswordChangeRequest::cmdName();
-    ret << OverWriteEmail::cmdName();
-    ret << RemoveUser::cmdName();
-    ret << ChangeUserRank::cmdName();
-    ret << DownloadFile::cmdName();
-    ret << UploadFile::cmdName();
-    ret << Delete::cmdName();
-    ret << Copy::cmdName();
-    ret << Move::cmdName();
-    ret << ListFiles::cmdName();
-    ret << FileInfo::cmdName();
-    ret << MakePath::cmdName();
-    ret << ChangeDir::cmdName();
-    ret << ToPeer::cmdName();
-    ret << LsP2P::cmdName();
-    ret << P2POpen::cmdName();
-    ret << P2PClose::cmdName();
-    ret << P2PRequest::cmdName();
-    ret << PingPeers::cmdName();
-    ret << CreateChannel::cmdName();
-    ret << RemoveChannel::cmdName();
-    ret << RenameChannel::cmdName();
-    ret << SetActiveState::cmdName();
-    ret << CreateSubCh::cmdName();
-    ret << RemoveSubCh::cmdName();
-    ret << RenameSubCh::cmdName();
-    ret << ListChannels::cmdName();
-    ret << ListSubCh::cmdName();
-    ret << SearchChannels::cmdName();
-    ret << InviteToCh::cmdName();
-    ret << DeclineChInvite::cmdName();
-    ret << AcceptChInvite::cmdName();
-    ret << RemoveChMember::cmdName();
-    ret << SetMemberLevel::cmdName();
-    ret << SetSubAcessLevel::cmdName();
-    ret << ListMembers::cmdName();
-    ret << AddRDOnlyFlag::cmdName();
-    ret << RemoveRDOnlyFlag::cmdName();
-    ret << ListRDonlyFlags::cmdName();
-    ret << OwnerOverride::cmdName();
-    ret << Tree::cmdName();
-
-    return ret + rankExemptList();
+    confLoaded = false;
+
+#ifndef QT_NO_DEBUG
+
+    // cmdName() isn't constexpr so this can't be a static_assert. a mismatch
+    // would route -run_cmd and the command's own messages to different names
+    // and the table never changes at run time, so only debug builds check.
+
+    for (int i = 0; i < internCmdCount; ++i)
+    {
+        Q_ASSERT_X(internCmds[i].cmdName() == QLatin1String(internCmds[i].name), "Module::Module()", "an internCmds name does not match the command's cmdName().");
+    }
+
+#endif
+
 }
 
-QStringList Module::pubCmdList()
+bool Module::confFlag(const char *key)
 {
-    QStringList ret;
+    // the conf file is only read if a gated command is actually looked at and
+    // then only once for the lifetime of this process.
 
-    ret << Auth::cmdName();
-    ret << MyInfo::cmdName();
+    if (!confLoaded)
+    {
+        confObj    = confObject();
+        confLoaded = true;
+    }
 
-    auto confObj = confObject();
+    return confObj[key].toBool();
+}
+
+bool Module::cmdVisible(const InternCmd &cmd, quint8 visClass)
+{
+    auto ret = (cmd.visibility & visClass) != 0;
 
-    if (confObj[CONF_ENABLE_PUB_REG].toBool())
+    if (ret && (visClass == CMD_PUBLIC))
     {
-        ret << CreateUser::cmdName();
+        if      (cmd.visibility & GATE_PUB_REG) ret = confFlag(CONF_ENABLE_PUB_REG);
+        else if (cmd.visibility & GATE_PW_RES)  ret = confFlag(CONF_ENABLE_PWRES);
     }
 
-    if (confObj[CONF_ENABLE_PWRES].toBool())
+    if (ret && (cmd.visibility & GATE_EVERIFY))
     {
-        ret << ResetPwRequest::cmdName();
-        ret << RecoverAcct::cmdName();
+        ret = confFlag(CONF_ENABLE_EVERIFY);
     }
 
     return ret;
 }
 
-QStringList Module::rankExemptList()
+QList<const InternCmd*> Module::cmdList(quint8 visClass)
 {
-    QStringList ret;
+    QList<const InternCmd*> ret;
 
-    ret << Auth::cmdName();
-    ret << MyInfo::cmdName();
-    ret << ChangeDispName::cmdName();
-    ret << ChangeUsername::cmdName();
-    ret << ChangePassword::cmdName();
-    ret << ChangeEmail::cmdName();
-    ret << IsEmailVerified::cmdName();
+    for (int i = 0; i < internCmdCount; ++i)
+    {
+        if (cmdVisible(internCmds[i], visClass))
+        {
+            ret.append(&internCmds[i]);
+        }
+    }
+
+    return ret;
+}
 
-    auto confObj = confObject();
+const InternCmd *Module::findCmd(const QString &name)
+{
+    const InternCmd *ret = nullptr;
+
+    auto utf8 = name.toUtf8();
+    auto slot = cmdHash(utf8.constData(), utf8.size(), internCmdSeed) % CMD_HASH_SLOTS;
+    auto idx  = internCmdSlots.index[slot];
 
-    if (confObj[CONF_ENABLE_EVERIFY].toBool())
+    if ((idx != CMD_HASH_EMPTY) && noCaseMatch(name, internCmds[idx].name))
     {
-        ret << VerifyEmail::cmdName();
+        ret = &internCmds[idx];
     }
 
     return ret;
@@ -133,84 +189,15 @@ QStringList Module::rankExemptList()
 
 bool Module::runCmd(const QString &name)
 {
-    auto ret = true;
+    auto  ret = true;
+    auto *cmd = findCmd(name);
 
-    if (userCmdList().contains(name, Qt::CaseInsensitive))
-    {
-        if      (noCaseMatch(name, Auth::cmdName()))                  new Auth(this);
-        else if (noCaseMatch(name, Cast::cmdName()))                  new Cast(this);
-        else if (noCaseMatch(name, OpenSubChannel::cmdName()))        new OpenSubChannel(this);
-        else if (noCaseMatch(name, CloseSubChannel::cmdName()))       new CloseSubChannel(this);
-        else if (noCaseMatch(name, LsOpenChannels::cmdName()))        new LsOpenChannels(this);
-        else if (noCaseMatch(name, HostInfo::cmdName()))              new HostInfo(this);
-        else if (noCaseMatch(name, IPHist::cmdName()))                new IPHist(this);
-        else if (noCaseMatch(name, ListMods::cmdName()))              new ListMods(this);
-        else if (noCaseMatch(name, DelMod::cmdName()))                new DelMod(this);
-        else if (noCaseMatch(name, AddMod::cmdName()))                new AddMod(this);
-        else if (noCaseMatch(name, ListUsers::cmdName()))             new ListUsers(this);
-        else if (noCaseMatch(name, CreateUser::cmdName()))            new CreateUser(this);
-        else if (noCaseMatch(name, RecoverAcct::cmdName()))           new RecoverAcct(this);
-        else if (noCaseMatch(name, ResetPwRequest::cmdName()))        new ResetPwRequest(this);
-        else if (noCaseMatch(name, VerifyEmail::cmdName()))           new VerifyEmail(this);
-        else if (noCaseMatch(name, AuthLog::cmdName()))               new AuthLog(this);
-        else if (noCaseMatch(name, LsCmdRanks::cmdName()))            new LsCmdRanks(this);
-        else if (noCaseMatch(name, RemoveCmdRank::cmdName()))         new RemoveCmdRank(this);
-        else if (noCaseMatch(name, AssignCmdRank::cmdName()))         new AssignCmdRank(this);
-        else if (noCaseMatch(name, LockUser::cmdName()))              new LockUser(this);
-        else if (noCaseMatch(name, NameChangeRequest::cmdName()))     new NameChangeRequest(this);
-        else if (noCaseMatch(name, PasswordChangeRequest::cmdName())) new PasswordChangeRequest(this);
-        else if (noCaseMatch(name, ChangeEmail::cmdName()))           new ChangeEmail(this);
-        else if (noCaseMatch(name, OverWriteEmail::cmdName()))        new OverWriteEmail(this);
-        else if (noCaseMatch(name, ChangeDispName::cmdName()))        new ChangeDispName(this);
-        else if (noCaseMatch(name, ChangeUsername::cmdName()))        new ChangeUsername(this);
-        else if (noCaseMatch(name, ChangePassword::cmdName()))        new ChangePassword(this);
-        else if (noCaseMatch(name, RemoveUser::cmdName()))            new RemoveUser(this);
-        else if (noCaseMatch(name, ChangeUserRank::cmdName()))        new ChangeUserRank(this);
-        else if (noCaseMatch(name, IsEmailVerified::cmdName()))       new IsEmailVerified(this);
-        else if (noCaseMatch(name, MyInfo::cmdName()))                new MyInfo(this);
-        else if (noCaseMatch(name, DownloadFile::cmdName()))          new DownloadFile(this);
-        else if (noCaseMatch(name, UploadFile::cmdName()))            new UploadFile(this);
-        else if (noCaseMatch(name, Delete::cmdName()))                new Delete(this);
-        else if (noCaseMatch(name, Copy::cmdName()))                  new Copy(this);
-        else if (noCaseMatch(name, Move::cmdName()))                  new Move(this);
-        else if (noCaseMatch(name, ListFiles::cmdName()))             new ListFiles(this);
-        else if (noCaseMatch(name, FileInfo::cmdName()))              new FileInfo(this);
-        else if (noCaseMatch(name, MakePath::cmdName()))              new MakePath(this);
-        else if (noCaseMatch(name, ChangeDir::cmdName()))             new ChangeDir(this);
-        else if (noCaseMatch(name, ToPeer::cmdName()))                new ToPeer(this);
-        else if (noCaseMatch(name, LsP2P::cmdName()))                 new LsP2P(this);
-        else if (noCaseMatch(name, P2POpen::cmdName()))               new P2POpen(this);
-        else if (noCaseMatch(name, P2PClose::cmdName()))              new P2PClose(this);
-        else if (noCaseMatch(name, P2PRequest::cmdName()))            new P2PRequest(this);
-        else if (noCaseMatch(name, PingPeers::cmdName()))             new PingPeers(this);
-        else if (noCaseMatch(name, CreateChannel::cmdName()))         new CreateChannel(this);
-        else if (noCaseMatch(name, RemoveChannel::cmdName()))         new RemoveChannel(this);
-        else if (noCaseMatch(name, RenameChannel::cmdName()))         new RenameChannel(this);
-        else if (noCaseMatch(name, SetActiveState::cmdName()))        new SetActiveState(this);
-        else if (noCaseMatch(name, CreateSubCh::cmdName()))           new CreateSubCh(this);
-        else if (noCaseMatch(name, RemoveSubCh::cmdName()))           new RemoveSubCh(this);
-        else if (noCaseMatch(name, RenameSubCh::cmdName()))           new RenameSubCh(this);
-        else if (noCaseMatch(name, ListChannels::cmdName()))          new ListChannels(this);
-        else if (noCaseMatch(name, ListSubCh::cmdName()))             new ListSubCh(this);
-        else if (noCaseMatch(name, SearchChannels::cmdName()))        new SearchChannels(this);
-        else if (noCaseMatch(name, InviteToCh::cmdName()))            new InviteToCh(this);
-        else if (noCaseMatch(name, DeclineChInvite::cmdName()))       new DeclineChInvite(this);
-        else if (noCaseMatch(name, AcceptChInvite::cmdName()))        new AcceptChInvite(this);
-        else if (noCaseMatch(name, RemoveChMember::cmdName()))        new RemoveChMember(this);
-        else if (noCaseMatch(name, SetMemberLevel::cmdName()))        new SetMemberLevel(this);
-        else if (noCaseMatch(name, SetSubAcessLevel::cmdName()))      new SetSubAcessLevel(this);
-        else if (noCaseMatch(name, ListMembers::cmdName()))           new ListMembers(this);
-        else if (noCaseMatch(name, AddRDOnlyFlag::cmdName()))         new AddRDOnlyFlag(this);
-        else if (noCaseMatch(name, RemoveRDOnlyFlag::cmdName()))      new RemoveRDOnlyFlag(this);
-        else if (noCaseMatch(name, ListRDonlyFlags::cmdName()))       new ListRDonlyFlags(this);
-        else if (noCaseMatch(name, OwnerOverride::cmdName()))         new OwnerOverride(this);
-        else if (noCaseMatch(name, Tree::cmdName()))                  new Tree(this);
-        else
-        {
-            qCritical() << "Internal module - the module claim command name '" << name << "' exists but no command object was actually matched/built.";
+    // the user class includes the rank exempt commands so this matches the full
+    // set of commands a logged in session could possibly have loaded.
 
-            ret = false;
-        }
+    if ((cmd != nullptr) && cmdVisible(*cmd, CMD_USER | CMD_EXEMPT))
+    {
+        cmd->factory(this);
     }
     else
     {
@@ -222,9 +209,9 @@ bool Module::runCmd(const QString &name)
     return ret;
 }
 
-void Module::listCmds(const QStringList &list)
+void Module::listCmds(quint8 visClass)
 {
-    new ListCommands(list, this);
+    new ListCommands(cmdList(visClass), this);
 }
 
 bool Module::start(const QStringList &args)
@@ -237,15 +224,15 @@ bool Module::start(const QStringList &args)
     }
     else if (args.contains("-public_cmds"))
     {
-        listCmds(pubCmdList());
+        listCmds(CMD_PUBLIC);
     }
     else if (args.contains("-exempt_cmds"))
     {
-        listCmds(rankExemptList());
+        listCmds(CMD_EXEMPT);
     }
     else if (args.contains("-user_cmds"))
     {
-        listCmds(userCmdList());
+        listCmds(CMD_USER | CMD_EXEMPT);
     }
     else
     {
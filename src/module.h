@@ -19,6 +19,7 @@
 
 #include "common.h"
 #include "cmd_object.h"
+#include "cmd_registry.h"
 #include "commands/cast.h"
 #include "commands/info.h"
 #include "commands/mods.h"
@@ -27,6 +28,8 @@
 #include "commands/cmd_ranks.h"
 #include "commands/acct_recovery.h"
 #include "commands/fs.h"
+#include "commands/fs_sync.h"
+#include "commands/fs_dedup.h"
 #include "commands/p2p.h"
 #include "commands/channels.h"
 
@@ -36,12 +39,15 @@ class Module : public QObject
 
 private:
 
-    bool        runCmd(const QString &name);
-    void        listCmds(const QStringList &list);
-    void        loadSettings();
-    QStringList userCmdList();
-    QStringList pubCmdList();
-    QStringList rankExemptList();
+    QJsonObject confObj;
+    bool        confLoaded;
+
+    bool                    runCmd(const QString &name);
+    bool                    confFlag(const char *key);
+    bool                    cmdVisible(const InternCmd &cmd, quint8 visClass);
+    void                    listCmds(quint8 visClass);
+    const InternCmd        *findCmd(const QString &name);
+    QList<const InternCmd*> cmdList(quint8 visClass);
 
 public:
 
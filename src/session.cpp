@@ -25,11 +25,92 @@ QByteArray wrFrame(quint32 cmdId, const QByteArray &data, uchar dType)
     return typeBa + cmdBa + sizeBa + data;
 }
 
+QByteArray CatalogCache::hashOf(const CmdCatalog &catalog)
+{
+    // the catalog map is ordered by command id so the same set of commands
+    // always produces the same hash no matter what order the listing
+    // processes finished in.
+
+    QCryptographicHash hasher(QCryptographicHash::Sha3_256);
+
+    for (auto&& frame : catalog)
+    {
+        hasher.addData(wrInt(frame.size(), MAX_FRAME_BITS) + frame);
+    }
+
+    return hasher.result();
+}
+
+CastFrame::CastFrame(const QByteArray &data)
+{
+    // format: [54bytes(chIds)][1byte(typeId)][rest-of-bytes(payload)]
+
+    auto payloadOffs = (MAX_OPEN_SUB_CHANNELS * BLKSIZE_SUB_CHANNEL) + 1;
+    auto len         = data.size() - payloadOffs;
+
+    chIds  = data.left(payloadOffs - 1);
+    typeId = static_cast<quint8>(data[payloadOffs - 1]);
+
+    // the payload is copied straight into the frame buffer, once.
+
+    wire.reserve(FRAME_HEADER_SIZE + len);
+    wire.append(wrInt(typeId, 8));
+    wire.append(wrInt(toCmdId32(ASYNC_CAST, 0), 32));
+    wire.append(wrInt(len, MAX_FRAME_BITS));
+    wire.append(data.constData() + payloadOffs, len);
+}
+
+bool CatalogCache::lookup(const QByteArray &scope, const QByteArray &hash, CmdCatalog *catalog)
+{
+    QReadLocker locker(&lock);
+
+    auto key = scope + hash;
+
+    if (catalogs.contains(key))
+    {
+        *catalog = catalogs[key];
+
+        return true;
+    }
+    else
+    {
+        return false;
+    }
+}
+
+void CatalogCache::store(const QByteArray &scope, const QByteArray &hash, const CmdCatalog &catalog)
+{
+    QWriteLocker locker(&lock);
+
+    auto key = scope + hash;
+
+    if (catalogs.contains(key))
+    {
+        order.removeOne(key);
+    }
+    else
+    {
+        catalogs.insert(key, catalog);
+    }
+
+    order.append(key);
+
+    while (order.size() > MAX_CMD_CATALOGS)
+    {
+        catalogs.remove(order.takeFirst());
+    }
+}
+
+QReadWriteLock                CatalogCache::lock;
+QHash<QByteArray, CmdCatalog> CatalogCache::catalogs;
+QList<QByteArray>             CatalogCache::order;
+
 Session::Session(const QString &hostKey, QSslSocket *tcp, QSslKey *privKey, QList<QSslCertificate> *chain, QObject *parent) : MemShare(parent)
 {
     currentDir     = QDir::currentPath();
     hostMemKey     = hostKey;
     tcpSocket      = tcp;
+    handshakeTimer = new WheelTimer(this);
     sslKey         = privKey;
     sslChain       = chain;
     hookCmdId32    = 0;
@@ -38,6 +119,15 @@ Session::Session(const QString &hostKey, QSslSocket *tcp, QSslKey *privKey, QLis
     tcpFrameType   = 0;
     flags          = 0;
     activeMods     = 0;
+    maxSesProcs    = DEFAULT_MAX_SES_PROCS;
+    procLimits     = ProcLimits();
+    outQueued      = 0;
+    outLane        = LANE_CONTROL;
+
+    for (int i = 0; i < LANE_COUNT; ++i)
+    {
+        outDeficit[i] = 0;
+    }
 }
 
 void Session::init()
@@ -50,6 +140,30 @@ void Session::init()
         connect(tcpSocket, &QSslSocket::disconnected, this, &Session::endSession);
         connect(tcpSocket, &QSslSocket::readyRead, this, &Session::dataFromClient);
         connect(tcpSocket, &QSslSocket::encrypted, this, &Session::sesRdy);
+        connect(tcpSocket, &QSslSocket::bytesWritten, this, &Session::pumpOut);
+        connect(tcpSocket, &QSslSocket::encryptedBytesWritten, this, &Session::pumpOut);
+        connect(handshakeTimer, &WheelTimer::timeout, this, &Session::handshakeExpired);
+
+        connect(CmdListing::instance(), &CmdListing::listingStored, this, &Session::listingStored);
+        connect(CmdListing::instance(), &CmdListing::listingFailed, this, &Session::listingFailed);
+        connect(CmdScheduler::instance(), &CmdScheduler::slotGranted, this, &Session::cmdSlotGranted);
+        connect(CmdScheduler::instance(), &CmdScheduler::reclaimIdle, this, &Session::reclaimIdle);
+
+        auto conf = confObject();
+
+        maxSesProcs          = static_cast<quint32>(conf[CONF_MAX_SES_CMD_PROCS].toInt(DEFAULT_MAX_SES_PROCS));
+        procLimits.cpuSecs   = static_cast<quint64>(conf[CONF_RLIMIT_CPU].toInt(0));
+        procLimits.memBytes  = static_cast<quint64>(conf[CONF_RLIMIT_MEM].toInt(0)) * 1048576;
+        procLimits.openFiles = static_cast<quint64>(conf[CONF_RLIMIT_FILES].toInt(0));
+
+        // big enough for the largest frame. past that, the socket stops
+        // reading while input is paused so the client is held back by TCP
+        // instead of the host buffering whatever it sends.
+
+        tcpSocket->setReadBufferSize(LOCAL_BUFFSIZE + FRAME_HEADER_SIZE);
+
+        handshakeTimer->setSingleShot(true);
+        handshakeTimer->start(HANDSHAKE_MSEC);
     }
     else
     {
@@ -89,6 +203,17 @@ void Session::connectToPeer(const QSharedPointer<SessionCarrier> &peer)
     {
         connect(peer->sessionObj, &Session::asyncToPeers, this, &Session::pubAsyncDataIn);
         connect(this, &Session::asyncToPeers, peer->sessionObj, &Session::pubAsyncDataIn);
+        connect(peer->sessionObj, &Session::castToPeers, this, &Session::castFrameIn);
+        connect(this, &Session::castToPeers, peer->sessionObj, &Session::castFrameIn);
+    }
+}
+
+void Session::handshakeExpired()
+{
+    if (!(flags & SESSION_RDY))
+    {
+        addIpAction("Handshake Timeout");
+        endSession();
     }
 }
 
@@ -96,6 +221,8 @@ void Session::sesRdy()
 {
     flags |= SESSION_RDY;
 
+    handshakeTimer->stop();
+
     auto *payload = new SessionCarrier(this);
 
     connect(payload, &SessionCarrier::destroyed, this, &Session::payloadDeleted);
@@ -124,8 +251,29 @@ void Session::addIpAction(const QString &action)
 
 void Session::cmdProcFinished(quint32 cmdId)
 {
+    // input that came in for an idle process while it was being evicted is
+    // held in frameQueue and the command goes back in line for a new one.
+
+    auto *proc    = cmdProcesses.value(cmdId);
+    auto  requeue = (proc != nullptr) && proc->isEvicting() && frameQueue.contains(cmdId);
+
     cmdProcesses.remove(cmdId);
-    frameQueue.remove(cmdId);
+
+    if (!requeue)
+    {
+        frameQueue.remove(cmdId);
+    }
+
+    CmdScheduler::release();
+
+    if (requeue)
+    {
+        queueCmdProc(cmdId);
+    }
+
+    resumeInput();
+
+    startPendingCmds();
 
     if (hookCmdId32 == cmdId)
     {
@@ -142,6 +290,11 @@ void Session::modProcFinished()
 {
     activeMods--;
 
+    if (activeMods == 0)
+    {
+        syncCatalog();
+    }
+
     if (flags & END_SESSION_EMPTY_PROC)
     {
         endSession();
@@ -159,12 +312,30 @@ void Session::cmdProcStarted(quint32 cmdId)
 
         frameQueue.remove(cmdId);
     }
+
+    resumeInput();
 }
 
 void Session::endSession()
 {
     logout("", false);
 
+    if (flags & COMPRESS_MODE)
+    {
+        hostSharedMem->lock();
+
+        wr32BitToBlock(rd32BitFromBlock(compressSes) - 1, compressSes);
+
+        hostSharedMem->unlock();
+
+        flags &= ~COMPRESS_MODE;
+    }
+
+    while (!pendingCmds.isEmpty())
+    {
+        dropPendingCmd(pendingCmds.first());
+    }
+
     if (flags & ACTIVE_PAYLOAD)
     {
         flags |= END_SESSION_ON_PAYLOAD_DEL;
@@ -173,6 +344,9 @@ void Session::endSession()
     {   
         if (cmdProcesses.isEmpty() && (activeMods == 0))
         {
+            CmdScheduler::leave(reinterpret_cast<quintptr>(this));
+
+            drainOut();
             addIpAction("Session Ended");
             cleanupDbConnection();
 
@@ -197,9 +371,19 @@ void Session::startCmdProc(quint32 cmdId)
     proc->setWorkingDirectory(currentDir);
     proc->setSessionParams(sharedMem, sessionId, openWritableSubChs, &hookCmdId32);
 
+    if (flags & LOGGED_IN)
+    {
+        proc->setUsageParams(rdStringFromBlock(userName, BLKSIZE_USER_NAME), procLimits);
+    }
+    else
+    {
+        proc->setUsageParams("(public)", procLimits);
+    }
+
     connect(proc, &CmdProcess::cmdProcFinished, this, &Session::cmdProcFinished);
     connect(proc, &CmdProcess::cmdProcReady, this, &Session::cmdProcStarted);
-    connect(proc, &CmdProcess::pubIPC, this, &Session::asyncToPeers);
+    connect(proc, &CmdProcess::inboundDrained, this, &Session::resumeInput);
+    connect(proc, &CmdProcess::pubIPC, this, &Session::pubIPCOut);
     connect(proc, &CmdProcess::privIPC, this, &Session::privAsyncDataIn);
     connect(proc, &CmdProcess::pubIPCWithFeedBack, this, &Session::asyncToPeers);
     connect(proc, &CmdProcess::pubIPCWithFeedBack, this, &Session::pubAsyncDataIn);
@@ -214,18 +398,186 @@ void Session::startCmdProc(quint32 cmdId)
     proc->startCmdProc();
 }
 
+void Session::queueCmdProc(quint32 cmdId)
+{
+    // command processes are not started directly. they go through the host
+    // wide CmdScheduler and the max_session_cmd_procs limit; whatever can't
+    // start right away waits here and the client is sent a QUEUED frame.
+
+    pendingCmds.append(cmdId);
+    queuedAt.insert(cmdId, QDateTime::currentMSecsSinceEpoch());
+
+    HostMetrics::add("cmd_sched.queue_depth", 1);
+
+    startPendingCmds();
+
+    if (pendingCmds.contains(cmdId))
+    {
+        HostMetrics::add("cmd_sched.queued_total", 1);
+
+        sendQueuePositions();
+    }
+}
+
+void Session::startQueuedCmd(quint32 cmdId)
+{
+    auto waited = QDateTime::currentMSecsSinceEpoch() - queuedAt.take(cmdId);
+
+    queuePos.remove(cmdId);
+
+    HostMetrics::add("cmd_sched.queue_depth", -1);
+    HostMetrics::add("cmd_sched.starts", 1);
+    HostMetrics::add("cmd_sched.wait_msec_total", waited);
+    HostMetrics::setMax("cmd_sched.wait_msec_max", waited);
+
+    if (cmdIds.contains(toCmdId16(cmdId)))
+    {
+        startCmdProc(cmdId);
+    }
+    else
+    {
+        // the command was unloaded while it was waiting.
+
+        frameQueue.remove(cmdId);
+
+        dataToClient(cmdId, wrInt(ABORTED, 16), IDLE);
+
+        CmdScheduler::release();
+    }
+}
+
+void Session::startPendingCmds()
+{
+    auto started = false;
+
+    while (!pendingCmds.isEmpty() && (static_cast<quint32>(cmdProcesses.size()) < maxSesProcs) &&
+           !(flags & END_SESSION_EMPTY_PROC) && CmdScheduler::acquire(reinterpret_cast<quintptr>(this)))
+    {
+        startQueuedCmd(pendingCmds.takeFirst());
+
+        started = true;
+    }
+
+    if (started)
+    {
+        sendQueuePositions();
+    }
+
+    evictIdleProcs();
+}
+
+void Session::cmdSlotGranted(quintptr ses)
+{
+    if ((ses == reinterpret_cast<quintptr>(this)) && CmdScheduler::accept(ses))
+    {
+        if (!pendingCmds.isEmpty() && (static_cast<quint32>(cmdProcesses.size()) < maxSesProcs))
+        {
+            startQueuedCmd(pendingCmds.takeFirst());
+
+            // back in line for the rest of the pending commands.
+
+            startPendingCmds();
+            sendQueuePositions();
+        }
+        else
+        {
+            CmdScheduler::release();
+
+            evictIdleProcs();
+        }
+    }
+}
+
+void Session::reclaimIdle(quintptr ses)
+{
+    // the scheduler picked this session to give up one of its idle warm
+    // processes for a session that is waiting on the host wide limit.
+
+    if (ses == reinterpret_cast<quintptr>(this))
+    {
+        CmdProcess *idle = nullptr;
+
+        for (auto *proc : cmdProcesses)
+        {
+            if (proc->isIdle())
+            {
+                idle = proc; break;
+            }
+        }
+
+        if (idle == nullptr)
+        {
+            CmdScheduler::reclaimMissed();
+        }
+        else if (CmdScheduler::claimReclaim())
+        {
+            idle->evict();
+        }
+    }
+}
+
+void Session::dropPendingCmd(quint32 cmdId)
+{
+    pendingCmds.removeOne(cmdId);
+    queuedAt.remove(cmdId);
+    queuePos.remove(cmdId);
+    frameQueue.remove(cmdId);
+
+    HostMetrics::add("cmd_sched.queue_depth", -1);
+
+    dataToClient(cmdId, wrInt(ABORTED, 16), IDLE);
+    resumeInput();
+}
+
+void Session::sendQueuePositions()
+{
+    // only the commands that actually moved in line are told about it.
+
+    for (int i = 0; i < pendingCmds.size(); ++i)
+    {
+        if (queuePos.value(pendingCmds[i]) != (i + 1))
+        {
+            queuePos.insert(pendingCmds[i], i + 1);
+
+            dataToClient(pendingCmds[i], wrInt(i + 1, 32), QUEUED);
+        }
+    }
+}
+
+void Session::evictIdleProcs()
+{
+    // idle warm processes count against max_session_cmd_procs just like
+    // busy ones so while commands are waiting on that limit, enough of the
+    // idle ones are shut down to let them start.
+
+    if (!pendingCmds.isEmpty() && (static_cast<quint32>(cmdProcesses.size()) >= maxSesProcs))
+    {
+        auto wanted = pendingCmds.size();
+
+        for (auto *proc : cmdProcesses)
+        {
+            if (proc->isEvicting()) wanted--;
+        }
+
+        for (auto *proc : cmdProcesses)
+        {
+            if (wanted <= 0) break;
+
+            if (proc->evict()) wanted--;
+        }
+    }
+}
+
 ModProcess *Session::initModProc(const QString &modApp)
 {
     auto  pipe = rdFromBlock(sessionId, BLKSIZE_USER_ID).toHex() + "-mod-" + genSerialNumber();
-    auto  rnk  = rd32BitFromBlock(hostRank);
     auto *proc = new ModProcess(modApp, sesMemKey, hostMemKey, pipe, this);
 
     proc->setWorkingDirectory(currentDir);
     proc->addArgs(modInst);
-    proc->setSessionParams(&cmdUniqueNames, &cmdRealNames, &cmdAppById, &modCmdNames, &cmdIds, rnk);
 
     connect(proc, &ModProcess::dataToClient, this, &Session::dataToClient);
-    connect(proc, &ModProcess::cmdUnloaded, this, &Session::killCmd16);
+    connect(proc, &ModProcess::newCmd, this, &Session::newCmd);
     connect(proc, &ModProcess::modProcFinished, this, &Session::modProcFinished);
 
     connect(this, &Session::killMods, proc, &ModProcess::killProc);
@@ -239,17 +591,183 @@ void Session::startModProc(const QString &modApp)
 {
     if (flags & LOGGED_IN)
     {
-        initModProc(modApp)->loadExemptCmds();
-        initModProc(modApp)->loadUserCmds();
+        listCmds(modApp, LOADING_EXEMPT_CMDS);
+        listCmds(modApp, LOADING_USER_CMDS);
     }
     else
     {
-        initModProc(modApp)->loadPublicCmds();
+        listCmds(modApp, LOADING_PUB_CMDS);
+    }
+}
+
+void Session::listCmds(const QString &modApp, quint32 mode)
+{
+    // commands are loaded straight from the host wide listing cache when
+    // possible. otherwise, only the first session to miss the cache starts
+    // a listing process for it and the rest wait for listingStored().
+
+    auto key = CmdListing::listingKey(modApp, mode, modInst);
+
+    if (!loadListing(key, modApp, mode))
+    {
+        if (CmdListing::claim(key))
+        {
+            auto *proc = initModProc(modApp);
+
+            proc->setListingKey(key);
+
+            if      (mode == LOADING_PUB_CMDS)    proc->loadPublicCmds();
+            else if (mode == LOADING_EXEMPT_CMDS) proc->loadExemptCmds();
+            else                                  proc->loadUserCmds();
+        }
+        else if (!loadListing(key, modApp, mode) && !awaitedListings.contains(key))
+        {
+            // counted as an active mod so the session doesn't end or send
+            // out the command catalog until the listing arrives.
+
+            awaitedListings.insert(key, ModListing(modApp, mode));
+
+            activeMods++;
+        }
+    }
+}
+
+bool Session::loadListing(const QString &key, const QString &modApp, quint32 mode)
+{
+    QList<ListedCmd> cmds;
+
+    auto ret = CmdListing::view(key, modApp, mode, rd32BitFromBlock(hostRank), &cmds, this);
+
+    for (auto&& cmd : cmds)
+    {
+        applyCmd(modApp, cmd.name, cmd.frame, cmd.allowed);
+    }
+
+    return ret;
+}
+
+void Session::listingStored(const QString &key)
+{
+    if (awaitedListings.contains(key))
+    {
+        auto req = awaitedListings.take(key);
+
+        loadListing(key, req.first, req.second);
+        modProcFinished();
+    }
+}
+
+void Session::listingFailed(const QString &key)
+{
+    if (awaitedListings.contains(key))
+    {
+        auto req = awaitedListings.take(key);
+
+        // the session that was running the listing process ended or the
+        // module crashed so this session tries to run it instead.
+
+        if (!(flags & END_SESSION_EMPTY_PROC))
+        {
+            listCmds(req.first, req.second);
+        }
+
+        modProcFinished();
+    }
+}
+
+void Session::newCmd(const QString &modApp, quint32 mode, const QByteArray &data)
+{
+    auto cmdName = QString::fromUtf8(data.mid(3, 64)).trimmed().toLower();
+
+    applyCmd(modApp, cmdName, data, CmdListing::allowCmdLoad(modApp, cmdName, mode, rd32BitFromBlock(hostRank), this));
+}
+
+quint16 Session::genCmdId(const QByteArray &frameTail)
+{
+    // a command the client already has in its cached catalog keeps the id
+    // it had there, so the ids (and the catalog hash) don't depend on which
+    // listing process happens to finish first.
+
+    quint16 ret = 0;
+
+    for (auto it = clientCatalog.constBegin(); it != clientCatalog.constEnd(); ++it)
+    {
+        if (!cmdIds.contains(it.key()) && (it.value().mid(2) == frameTail))
+        {
+            ret = it.key(); break;
+        }
+    }
+
+    if (ret == 0)
+    {
+        ret = 256;
+
+        while(cmdIds.contains(ret)) ret++;
+    }
+
+    return ret;
+}
+
+QString Session::makeCmdUnique(const QString &name)
+{
+    QString strNum;
+
+    auto names = cmdUniqueNames.values();
+
+    for (int i = 1; names.contains(name + strNum); ++i)
+    {
+        strNum = "_" + QString::number(i);
+    }
+
+    return QString(name + strNum).toLower();
+}
+
+bool Session::isCmdLoaded(const QString &modApp, const QString &cmdName)
+{
+    return modCmdNames.value(modApp).contains(cmdName);
+}
+
+void Session::applyCmd(const QString &modApp, const QString &cmdName, const QByteArray &data, bool allowed)
+{
+    if (isCmdLoaded(modApp, cmdName))
+    {
+        if (!allowed)
+        {
+            auto cmdId = cmdRealNames.key(cmdName);
+
+            cmdIds.removeOne(cmdId);
+            cmdRealNames.remove(cmdId);
+            cmdUniqueNames.remove(cmdId);
+            cmdAppById.remove(cmdId);
+
+            modCmdNames[modApp].removeOne(cmdName);
+
+            emit killCmd16(cmdId);
+
+            dataToClient(toCmdId32(ASYNC_RM_CMD, 0), wrInt(cmdId, 16), CMD_ID);
+        }
+    }
+    else if (allowed)
+    {
+        auto unique = makeCmdUnique(cmdName);
+        auto tail   = data.mid(2, 1) + toFixedTEXT(unique, 64) + data.mid(67);
+        auto cmdId  = genCmdId(tail);
+
+        cmdIds.append(cmdId);
+        cmdRealNames.insert(cmdId, cmdName);
+        cmdUniqueNames.insert(cmdId, unique);
+        cmdAppById.insert(cmdId, modApp);
+
+        modCmdNames[modApp].append(cmdName);
+
+        dataToClient(toCmdId32(ASYNC_ADD_CMD, 0), wrInt(cmdId, 16) + tail, NEW_CMD);
     }
 }
 
 void Session::loadCmds()
 {
+    rebaseCatalog();
+
     startModProc(QCoreApplication::applicationFilePath());
 
     Query db(this);
@@ -262,6 +780,13 @@ void Session::loadCmds()
     {
         startModProc(db.getData(COLUMN_MOD_MAIN, i).toString());
     }
+
+    if (activeMods == 0)
+    {
+        // every listing came from the cache.
+
+        syncCatalog();
+    }
 }
 
 void Session::dataToCmd(quint32 cmdId, const QByteArray &data, quint8 typeId)
@@ -270,10 +795,18 @@ void Session::dataToCmd(quint32 cmdId, const QByteArray &data, quint8 typeId)
 
     if (cmdIds.contains(cmdId16))
     {
-        if (cmdProcesses.contains(cmdId))
+        if (!admitInput(cmdId, typeId, data.size()))
+        {
+            // dropped, the client was already told.
+        }
+        else if (cmdProcesses.contains(cmdId) && !cmdProcesses[cmdId]->isEvicting())
         {
             cmdProcesses[cmdId]->dataFromSession(cmdId, data, typeId);
         }
+        else if (pendingCmds.contains(cmdId) && (typeId == KILL_CMD))
+        {
+            dropPendingCmd(cmdId);
+        }
         else
         {
             if (frameQueue.contains(cmdId))
@@ -288,7 +821,10 @@ void Session::dataToCmd(quint32 cmdId, const QByteArray &data, quint8 typeId)
                 frameQueue.insert(cmdId, frames);
             }
 
-            startCmdProc(cmdId);
+            if (!pendingCmds.contains(cmdId) && !cmdProcesses.contains(cmdId))
+            {
+                queueCmdProc(cmdId);
+            }
         }
     }
     else
@@ -297,6 +833,98 @@ void Session::dataToCmd(quint32 cmdId, const QByteArray &data, quint8 typeId)
     }
 }
 
+qint64 Session::inboundBacklog(quint32 cmdId)
+{
+    // client input held for a command, either in frameQueue while its
+    // process starts or in the pipe to the process once it runs.
+
+    qint64 ret = 0;
+
+    for (auto&& frame : frameQueue.value(cmdId))
+    {
+        ret += frame.size();
+    }
+
+    if (cmdProcesses.contains(cmdId))
+    {
+        ret += cmdProcesses[cmdId]->inboundBacklog();
+    }
+
+    return ret;
+}
+
+bool Session::admitInput(quint32 cmdId, quint8 typeId, int len)
+{
+    // back pressure is kept to the one command that is behind. the session
+    // never stops reading from the client as a whole, that would also hold
+    // back the input other commands need to finish and any KILL_CMD, which
+    // is how a session at the scheduler limit could deadlock. clients with
+    // the flow control capability are told to pause that command's input;
+    // past the hard limit (or the queue limit of a command that hasn't
+    // started yet) its input is dropped and the client is told why.
+
+    auto ret     = true;
+    auto ctrl    = (typeId == KILL_CMD) || (typeId == TERM_CMD) || (typeId == YIELD_CMD) || (typeId == RESUME_CMD);
+    auto backlog = inboundBacklog(cmdId) + len;
+    auto limit   = cmdProcesses.contains(cmdId) ? (FLOW_INBOUND_MAX * 2) : FLOW_INBOUND_MAX;
+
+    if (ctrl)
+    {
+        // control frames always get through, they are what lets a stuck
+        // command be killed.
+    }
+    else if (backlog > limit)
+    {
+        dataToClient(cmdId, QString("err: Too much input is waiting on this command, " + QString::number(len) + " bytes were dropped.\n").toUtf8(), ERR);
+
+        HostMetrics::add("flow.inbound_dropped_bytes", len);
+
+        ret = false;
+    }
+    else if ((backlog >= FLOW_INBOUND_MAX) && !pausedCmds.contains(cmdId))
+    {
+        pausedCmds.insert(cmdId);
+
+        if (flags & FLOW_CTRL_MODE)
+        {
+            queueOut(cmdId, wrInt(FLOW_PAUSE, 8), FLOW_CTRL);
+        }
+    }
+
+    return ret;
+}
+
+void Session::resumeInput()
+{
+    for (auto cmdId : pausedCmds.values())
+    {
+        if (!cmdIds.contains(toCmdId16(cmdId)) || (inboundBacklog(cmdId) < (FLOW_INBOUND_MAX / 2)))
+        {
+            pausedCmds.remove(cmdId);
+
+            if ((flags & FLOW_CTRL_MODE) && cmdIds.contains(toCmdId16(cmdId)))
+            {
+                queueOut(cmdId, wrInt(FLOW_RESUME, 8), FLOW_CTRL);
+            }
+        }
+    }
+}
+
+void Session::releaseCredits()
+{
+    // command processes get their spent output credit back only while the
+    // socket to the client is keeping up so a slow link holds them back
+    // instead of the output piling up here.
+
+    if ((outQueued + tcpSocket->bytesToWrite() + tcpSocket->encryptedBytesToWrite()) < FLOW_HIGH_WATER)
+    {
+        for (auto *proc : cmdProcesses)
+        {
+            proc->releaseCredit();
+        }
+    }
+}
+
 void Session::dataFromClient()
 {
     if (flags & SESSION_RDY)
@@ -342,7 +970,7 @@ void Session::dataFromClient()
             // tag     = 0x4D, 0x52, 0x43, 0x49 (MRCI)
             // appName = UTF8 string (padded with 0x00)
             // modInst = UTF8 string (padded with 0x00)
-            // padding = 128 bytes of (0x00)
+            // padding = [1byte(capabilities)][32bytes(catalog_hash)][95bytes(0x00)]
 
             if (clientHeader.startsWith(SERVER_HEADER_TAG))
             {
@@ -350,6 +978,8 @@ void Session::dataFromClient()
 
                 modInst = rdStringFromBlock(clientHeader.data() + 36, 64);
 
+                readClientCaps(clientHeader.mid(CLIENT_CAPS_OFFS));
+
                 auto ver = QCoreApplication::applicationVersion().split('.');
 
                 QByteArray servHeader;
@@ -404,7 +1034,356 @@ void Session::dataFromClient()
 
 void Session::dataToClient(quint32 cmdId, const QByteArray &data, quint8 typeId)
 {
-    tcpSocket->write(wrFrame(cmdId, data, typeId));
+    if ((typeId & FRAME_COMPRESSED) && !(flags & COMPRESS_MODE))
+    {
+        // casts are compressed by the command that sent them no matter who
+        // receives them so only clients that can't take it pay to expand.
+
+        auto expType = typeId;
+        auto expData = expandFrame(data, &expType);
+
+        queueOut(cmdId, expData, expType);
+    }
+    else if (!catalogFrame(cmdId, data, typeId))
+    {
+        queueOut(cmdId, data, typeId);
+    }
+}
+
+int Session::laneOf(quint32 cmdId, quint8 typeId, int len)
+{
+    auto type = typeId & ~FRAME_COMPRESSED;
+    auto ret  = static_cast<int>(LANE_INTERACTIVE);
+
+    if (toCmdId16(cmdId) <= 255)
+    {
+        // async command ids. these are kept in the one lane no matter how
+        // big they are so they stay in order with each other.
+
+        ret = LANE_CONTROL;
+    }
+    else if ((type == GEN_FILE) || (type == BYTES) || (len >= OUT_BULK_MIN))
+    {
+        ret = LANE_BULK;
+    }
+    else if ((type == IDLE) || (type == PROMPT_TEXT) || (type == PROG) || (type == PROG_LAST) ||
+             (type == QUEUED) || (type == FLOW_CTRL))
+    {
+        ret = LANE_CONTROL;
+    }
+
+    return ret;
+}
+
+void Session::queueOut(quint32 cmdId, const QByteArray &data, quint8 typeId, bool prebuilt)
+{
+    // frames for a command id that still has frames waiting go in the same
+    // lane as those so nothing a command sends can overtake what it sent
+    // before (an IDLE passing the last of its GEN_FILE data for example).
+
+    auto lane = laneOf(cmdId, typeId, data.size());
+
+    if (outPins.contains(cmdId))
+    {
+        lane                   = outPins[cmdId].first;
+        outPins[cmdId].second += 1;
+    }
+    else
+    {
+        outPins.insert(cmdId, qMakePair(lane, 1));
+    }
+
+    OutFrame frame;
+
+    frame.data     = data;
+    frame.cmdId    = cmdId;
+    frame.typeId   = typeId;
+    frame.offs     = prebuilt ? FRAME_HEADER_SIZE : 0;
+    frame.prebuilt = prebuilt;
+
+    outLanes[lane].append(frame);
+
+    if (prebuilt) outQueued += data.size();
+    else          outQueued += data.size() + FRAME_HEADER_SIZE;
+
+    pumpOut();
+}
+
+qint64 Session::writeOut(QList<OutFrame> &lane)
+{
+    auto  &frame = lane.first();
+    auto   left  = frame.data.size() - frame.offs;
+    qint64 ret   = 0;
+
+    if ((flags & FRAGMENT_MODE) && (left > OUT_FRAG_SIZE))
+    {
+        // the client puts the FRAGMENT payloads back together in front of
+        // the next frame with the same command id that isn't a FRAGMENT.
+        // a prebuilt frame is cut up the same way from past its header, its
+        // tail then goes out re-framed with the original type.
+
+        tcpSocket->write(wrFrame(frame.cmdId, frame.data.mid(frame.offs, OUT_FRAG_SIZE), FRAGMENT));
+
+        frame.offs += OUT_FRAG_SIZE;
+        outQueued  -= OUT_FRAG_SIZE;
+        ret         = FRAME_HEADER_SIZE + OUT_FRAG_SIZE;
+    }
+    else
+    {
+        if (frame.prebuilt && (frame.offs == FRAME_HEADER_SIZE))
+        {
+            tcpSocket->write(frame.data);
+
+            ret = frame.data.size();
+        }
+        else
+        {
+            tcpSocket->write(wrFrame(frame.cmdId, frame.data.mid(frame.offs), frame.typeId));
+
+            ret = FRAME_HEADER_SIZE + left;
+        }
+
+        outQueued -= ret;
+
+        if (--outPins[frame.cmdId].second == 0)
+        {
+            outPins.remove(frame.cmdId);
+        }
+
+        lane.removeFirst();
+    }
+
+    return ret;
+}
+
+bool Session::outPending()
+{
+    // the pump goes by the lanes themselves instead of outQueued so a
+    // miscount in the byte total can't strand a frame or spin on nothing.
+
+    for (auto&& lane : outLanes)
+    {
+        if (!lane.isEmpty()) return true;
+    }
+
+    return false;
+}
+
+void Session::pumpOut()
+{
+    // deficit round robin over the out lanes. a lane gets its weight in
+    // quantums each time its turn comes and keeps sending until that is
+    // spent, so control frames and interactive output get a turn between
+    // the fragments of a bulk transfer. the lanes only feed the socket while
+    // it is close to drained so a frame queued now isn't stuck behind
+    // megabytes already handed to it.
+
+    const qint64 weights[LANE_COUNT] = {OUT_WEIGHT_CONTROL, OUT_WEIGHT_INTERACTIVE, OUT_WEIGHT_BULK};
+
+    while (outPending() && ((tcpSocket->bytesToWrite() + tcpSocket->encryptedBytesToWrite()) < OUT_LOW_WATER))
+    {
+        auto &lane = outLanes[outLane];
+
+        if (!lane.isEmpty() && (outDeficit[outLane] > 0))
+        {
+            outDeficit[outLane] -= writeOut(lane);
+        }
+        else
+        {
+            if (lane.isEmpty()) outDeficit[outLane] = 0;
+
+            outLane              = (outLane + 1) % LANE_COUNT;
+            outDeficit[outLane] += weights[outLane] * OUT_QUANTUM;
+        }
+    }
+
+    releaseCredits();
+}
+
+void Session::drainOut()
+{
+    // the session is ending so whatever is left goes to the socket as is.
+
+    for (auto&& lane : outLanes)
+    {
+        while (!lane.isEmpty())
+        {
+            writeOut(lane);
+        }
+    }
+}
+
+void Session::readClientCaps(const QByteArray &padding)
+{
+    // older clients send all 0x00 for the padding so they get no capabilities
+    // and continue to receive the command list as ASYNC_ADD_CMD/ASYNC_RM_CMD
+    // frames as they come in from the listing processes.
+
+    auto caps = static_cast<quint8>(padding[0]);
+
+    // command processes check the capabilities in shared memory to decide
+    // if they can compress their output.
+
+    wr8BitToBlock(caps, clientCaps);
+
+    if (caps & CAP_FLOW_CTRL)
+    {
+        flags |= FLOW_CTRL_MODE;
+    }
+
+    if (caps & CAP_COMPRESS)
+    {
+        flags |= COMPRESS_MODE;
+
+        // host wide count of the sessions that can take compressed frames,
+        // Cast::procIn() only compresses a cast if any of them could get it.
+
+        hostSharedMem->lock();
+
+        wr32BitToBlock(rd32BitFromBlock(compressSes) + 1, compressSes);
+
+        hostSharedMem->unlock();
+    }
+
+    if (caps & CAP_FRAGMENT)
+    {
+        flags |= FRAGMENT_MODE;
+    }
+
+    if (caps & CAP_CMD_CATALOG)
+    {
+        auto hash = padding.mid(1, CATALOG_HASH_LEN);
+
+        flags                |= CATALOG_MODE;
+        presentedCatalogHash  = hash;
+
+        if (CatalogCache::lookup(catalogScope(), hash, &clientCatalog))
+        {
+            clientCatalogHash = hash;
+        }
+    }
+}
+
+QByteArray Session::catalogScope()
+{
+    // a presented hash is only ever matched against catalogs sent to
+    // sessions with the same user and host rank, the header is matched
+    // against the not logged in scope and rebaseCatalog() tries again for
+    // the user once logged in.
+
+    return rdFromBlock(userId, BLKSIZE_USER_ID) + rdFromBlock(hostRank, BLKSIZE_HOST_RANK);
+}
+
+void Session::rebaseCatalog()
+{
+    // the hash the client presented in its header is most likely the one
+    // it had at the end of its last session, when it was logged in. once
+    // the session logs in as that user again, the client is told to go back
+    // to that cached catalog so syncCatalog() only has to send the
+    // differences from it instead of from the not logged in catalog. this
+    // is done before the listing processes start so genCmdId() keeps the
+    // ids from it.
+
+    if ((flags & CATALOG_MODE) && (flags & LOGGED_IN) && !presentedCatalogHash.isEmpty())
+    {
+        CmdCatalog cached;
+
+        if ((presentedCatalogHash != clientCatalogHash) && CatalogCache::lookup(catalogScope(), presentedCatalogHash, &cached))
+        {
+            queueOut(toCmdId32(ASYNC_ADD_CMD, 0), wrInt(CATALOG_BASE, 8) + presentedCatalogHash, CMD_CATALOG);
+
+            clientCatalog     = cached;
+            clientCatalogHash = presentedCatalogHash;
+        }
+
+        // only the first login can use it, the client's cache is replaced
+        // by whatever the session sends from here on.
+
+        presentedCatalogHash.clear();
+    }
+}
+
+bool Session::catalogFrame(quint32 cmdId, const QByteArray &data, quint8 typeId)
+{
+    // in catalog mode, command list changes are collected here instead of
+    // being sent to the client right away. syncCatalog() sends them out once
+    // all of the listing processes are done.
+
+    auto ret = false;
+
+    if (flags & CATALOG_MODE)
+    {
+        if ((cmdId == toCmdId32(ASYNC_ADD_CMD, 0)) && (typeId == NEW_CMD))
+        {
+            cmdCatalog.insert(static_cast<quint16>(rdInt(data.mid(0, 2))), data);
+
+            ret = true;
+        }
+        else if ((cmdId == toCmdId32(ASYNC_RM_CMD, 0)) && (typeId == CMD_ID))
+        {
+            cmdCatalog.remove(static_cast<quint16>(rdInt(data.mid(0, 2))));
+
+            ret = true;
+        }
+    }
+
+    return ret;
+}
+
+void Session::syncCatalog()
+{
+    if (flags & CATALOG_MODE)
+    {
+        auto hash = CatalogCache::hashOf(cmdCatalog);
+
+        if ((hash != clientCatalogHash) || !(flags & CATALOG_SENT))
+        {
+            if (clientCatalogHash.isEmpty())
+            {
+                // the client has no usable cached catalog so the whole thing is
+                // sent as a single compressed frame.
+
+                QByteArray cmds;
+
+                for (auto&& frame : cmdCatalog)
+                {
+                    cmds.append(wrInt(frame.size(), MAX_FRAME_BITS) + frame);
+                }
+
+                queueOut(toCmdId32(ASYNC_ADD_CMD, 0), wrInt(CATALOG_FULL, 8) + hash + qCompress(cmds), CMD_CATALOG);
+            }
+            else
+            {
+                // the client already has a catalog the host knows about so
+                // only the differences need to be sent, followed by the new
+                // hash to confirm the client's catalog is now up to date.
+
+                for (auto it = clientCatalog.constBegin(); it != clientCatalog.constEnd(); ++it)
+                {
+                    if (cmdCatalog.value(it.key()) != it.value())
+                    {
+                        queueOut(toCmdId32(ASYNC_RM_CMD, 0), wrInt(it.key(), 16), CMD_ID);
+                    }
+                }
+
+                for (auto it = cmdCatalog.constBegin(); it != cmdCatalog.constEnd(); ++it)
+                {
+                    if (clientCatalog.value(it.key()) != it.value())
+                    {
+                        queueOut(toCmdId32(ASYNC_ADD_CMD, 0), it.value(), NEW_CMD);
+                    }
+                }
+
+                queueOut(toCmdId32(ASYNC_ADD_CMD, 0), wrInt(CATALOG_CONFIRM, 8) + hash, CMD_CATALOG);
+            }
+
+            CatalogCache::store(catalogScope(), hash, cmdCatalog);
+
+            clientCatalog     = cmdCatalog;
+            clientCatalogHash = hash;
+            flags            |= CATALOG_SENT;
+        }
+    }
 }
 
 void Session::asyncToClient(quint16 cmdId, const QByteArray &data, quint8 typeId)
@@ -618,6 +1597,60 @@ void Session::privAsyncDataIn(quint16 cmdId, const QByteArray &data)
     sharedMem->unlock();
 }
 
+void Session::pubIPCOut(quint16 cmdId, const QByteArray &data)
+{
+    if (cmdId == ASYNC_CAST)
+    {
+        emit castToPeers(QSharedPointer<CastFrame>(new CastFrame(data)));
+    }
+    else
+    {
+        emit asyncToPeers(cmdId, data);
+    }
+}
+
+void Session::castFrameIn(const QSharedPointer<CastFrame> &frame)
+{
+    sharedMem->lock();
+
+    if (matchAnyCh(openSubChs, frame->chIds.constData()))
+    {
+        auto typeId = frame->typeId;
+
+        if ((typeId & FRAME_COMPRESSED) && !(flags & COMPRESS_MODE))
+        {
+            // only a client that can't take the frame as is gets its own
+            // copy, expanded by dataToClient().
+
+            asyncToClient(ASYNC_CAST, frame->wire.mid(FRAME_HEADER_SIZE), typeId);
+        }
+        else if (!(typeId & FRAME_COMPRESSED) && (flags & COMPRESS_MODE))
+        {
+            // the cast was sent raw because no receiver could take it
+            // compressed at the time (see Cast::procIn()) so this link
+            // compresses its own copy. compressFrame() leaves small and
+            // incompressible payloads alone.
+
+            auto payload = compressFrame(frame->wire.mid(FRAME_HEADER_SIZE), &typeId);
+
+            if (typeId & FRAME_COMPRESSED)
+            {
+                asyncToClient(ASYNC_CAST, payload, typeId);
+            }
+            else
+            {
+                queueOut(toCmdId32(ASYNC_CAST, 0), frame->wire, frame->typeId, true);
+            }
+        }
+        else
+        {
+            queueOut(toCmdId32(ASYNC_CAST, 0), frame->wire, frame->typeId, true);
+        }
+    }
+
+    sharedMem->unlock();
+}
+
 void Session::pubAsyncDataIn(quint16 cmdId, const QByteArray &data)
 {
     sharedMem->lock();
@@ -626,10 +1659,6 @@ void Session::pubAsyncDataIn(quint16 cmdId, const QByteArray &data)
     {
         acctDeleted(data);
     }
-    else if (cmdId == ASYNC_CAST)
-    {
-        castCatch(data);
-    }
     else if (cmdId == ASYNC_TO_PEER)
     {
         directDataFromPeer(data);
@@ -22,8 +22,79 @@
 #include "make_cert.h"
 #include "cmd_proc.h"
 
+#define HANDSHAKE_MSEC         30000  // the client has this long to send its header and finish the tls handshake.
+#define OUT_LOW_WATER          262144 // the out lanes only feed the socket while it has less than this queued.
+#define OUT_QUANTUM            65536  // bytes a lane can send per unit of weight each time its turn comes.
+#define OUT_FRAG_SIZE          65536  // larger payloads go out as FRAGMENT frames of this size to clients that take them.
+#define OUT_BULK_MIN           65536  // command output at least this big goes in the bulk lane no matter the type.
+#define OUT_WEIGHT_CONTROL     8
+#define OUT_WEIGHT_INTERACTIVE 4
+#define OUT_WEIGHT_BULK        1
+
 QByteArray wrFrame(quint32 cmdId, const QByteArray &data, uchar dType);
 
+enum OutLane : int
+{
+    LANE_CONTROL,
+    LANE_INTERACTIVE,
+    LANE_BULK,
+    LANE_COUNT
+};
+
+struct OutFrame
+{
+    QByteArray data;     // the payload, or the whole frame if prebuilt.
+    quint32    cmdId;
+    quint8     typeId;
+    int        offs;     // where the unsent payload starts in data, past the header if prebuilt.
+    bool       prebuilt;
+};
+
+typedef QMap<quint16, QByteArray> CmdCatalog;
+typedef QPair<QString, quint32>   ModListing; // module path and listing mode.
+
+class CatalogCache
+{
+    // host wide cache of recently sent command catalogs keyed by content hash
+    // and the user id and host rank they were sent to. a client that presents
+    // one of these hashes in its header only needs the ASYNC_ADD_CMD/
+    // ASYNC_RM_CMD differences instead of the full catalog. the scope keeps a
+    // session from learning another user's command ids by presenting the
+    // hash of a catalog it could never have been sent.
+
+private:
+
+    static QReadWriteLock                lock;
+    static QHash<QByteArray, CmdCatalog> catalogs;
+    static QList<QByteArray>             order;
+
+public:
+
+    static QByteArray hashOf(const CmdCatalog &catalog);
+    static bool       lookup(const QByteArray &scope, const QByteArray &hash, CmdCatalog *catalog);
+    static void       store(const QByteArray &scope, const QByteArray &hash, const CmdCatalog &catalog);
+};
+
+//--------------------------
+
+class CastFrame
+{
+    // an ASYNC_CAST as it goes out on the wire. it is built once by the
+    // session whose command sent the cast and the same read only buffer is
+    // handed to every peer session's socket instead of each one taking its
+    // own copy of the payload to frame it.
+
+public:
+
+    QByteArray chIds;
+    QByteArray wire;
+    quint8     typeId;
+
+    explicit CastFrame(const QByteArray &data);
+};
+
+//--------------------------
+
 class Session : public MemShare
 {
     Q_OBJECT
@@ -31,6 +102,7 @@ class Session : public MemShare
 private:
 
     QSslSocket                        *tcpSocket;
+    WheelTimer                        *handshakeTimer;
     QList<QSslCertificate>            *sslChain;
     QSslKey                           *sslKey;
     QString                            modInst;
@@ -41,10 +113,26 @@ private:
     QHash<quint16, QString>            cmdUniqueNames;
     QHash<quint16, QString>            cmdRealNames;
     QHash<quint16, QString>            cmdAppById;
+    QHash<QString, ModListing>         awaitedListings;
     QList<quint16>                     cmdIds;
+    QList<quint32>                     pendingCmds;
+    QHash<quint32, qint64>             queuedAt;
+    QHash<quint32, int>                queuePos;
+    QHash<quint32, QPair<int, int> >   outPins;
+    QList<OutFrame>                    outLanes[LANE_COUNT];
+    qint64                             outDeficit[LANE_COUNT];
+    qint64                             outQueued;
+    int                                outLane;
+    CmdCatalog                         cmdCatalog;
+    CmdCatalog                         clientCatalog;
+    QByteArray                         clientCatalogHash;
+    QByteArray                         presentedCatalogHash;
     quint32                            activeMods;
+    quint32                            maxSesProcs;
+    ProcLimits                         procLimits;
     quint32                            flags;
     quint32                            hookCmdId32;
+    QSet<quint32>                      pausedCmds;
     quint32                            tcpPayloadSize;
     quint32                            tcpFrameCmdId;
     quint8                             tcpFrameType;
@@ -57,9 +145,33 @@ private:
     void        login(const QByteArray &uId);
     void        logout(const QByteArray &uId, bool reload);
     void        startCmdProc(quint32 cmdId);
+    void        queueCmdProc(quint32 cmdId);
+    void        startQueuedCmd(quint32 cmdId);
+    void        startPendingCmds();
+    void        dropPendingCmd(quint32 cmdId);
+    void        sendQueuePositions();
+    void        evictIdleProcs();
     void        startModProc(const QString &modApp);
+    void        listCmds(const QString &modApp, quint32 mode);
+    void        applyCmd(const QString &modApp, const QString &cmdName, const QByteArray &data, bool allowed);
+    bool        loadListing(const QString &key, const QString &modApp, quint32 mode);
+    bool        isCmdLoaded(const QString &modApp, const QString &cmdName);
+    quint16     genCmdId(const QByteArray &frameTail);
+    QString     makeCmdUnique(const QString &name);
     void        addIpAction(const QString &action);
     void        castPeerStat(const QByteArray &targets, bool isDisconnecting);
+    void        readClientCaps(const QByteArray &padding);
+    void        syncCatalog();
+    bool        catalogFrame(quint32 cmdId, const QByteArray &data, quint8 typeId);
+    QByteArray  catalogScope();
+    void        rebaseCatalog();
+    bool        admitInput(quint32 cmdId, quint8 typeId, int len);
+    qint64      inboundBacklog(quint32 cmdId);
+    void        queueOut(quint32 cmdId, const QByteArray &data, quint8 typeId, bool prebuilt = false);
+    qint64      writeOut(QList<OutFrame> &lane);
+    void        drainOut();
+    bool        outPending();
+    int         laneOf(quint32 cmdId, quint8 typeId, int len);
     ModProcess *initModProc(const QString &modApp);
     QByteArray  genSessionId();
 
@@ -71,7 +183,6 @@ private:
     void acctEdited(const QByteArray &data);
     void acctRenamed(const QByteArray &data);
     void acctDispChanged(const QByteArray &data);
-    void castCatch(const QByteArray &data);
     void directDataFromPeer(const QByteArray &data);
     void p2p(const QByteArray &data);
     void closeP2P(const QByteArray &data);
@@ -93,13 +204,23 @@ private:
 private slots:
 
     void dataFromClient();
+    void handshakeExpired();
     void payloadDeleted();
     void modProcFinished();
+    void newCmd(const QString &modApp, quint32 mode, const QByteArray &data);
+    void listingStored(const QString &key);
+    void listingFailed(const QString &key);
     void cmdProcFinished(quint32 cmdId);
     void cmdProcStarted(quint32 cmdId);
+    void cmdSlotGranted(quintptr ses);
+    void reclaimIdle(quintptr ses);
     void asyncToClient(quint16 cmdId, const QByteArray &data, quint8 typeId);
     void dataToClient(quint32 cmdId, const QByteArray &data, quint8 typeId);
     void dataToCmd(quint32 cmdId, const QByteArray &data, quint8 typeId);
+    void releaseCredits();
+    void pumpOut();
+    void resumeInput();
+    void pubIPCOut(quint16 cmdId, const QByteArray &data);
 
 public:
 
@@ -109,6 +230,7 @@ public slots:
 
     void pubAsyncDataIn(quint16 cmdId, const QByteArray &data);
     void privAsyncDataIn(quint16 cmdId, const QByteArray &data);
+    void castFrameIn(const QSharedPointer<CastFrame> &frame);
     void connectToPeer(const QSharedPointer<SessionCarrier> &peer);
     void endSession();
     void sesRdy();
@@ -119,6 +241,7 @@ signals:
     void killCmd16(quint16 cmdId);
     void killCmd32(quint32 cmdId);
     void asyncToPeers(quint16 cmdId, const QByteArray data);
+    void castToPeers(const QSharedPointer<CastFrame> &frame);
     void connectPeers(QSharedPointer<SessionCarrier> peer);
     void ended();
     void killMods();
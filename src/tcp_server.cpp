@@ -119,6 +119,10 @@ bool TCPServer::start()
     {
         qNam->get(QNetworkRequest(QUrl("https://api.ipify.org")));
 
+        CmdScheduler::setLimit(static_cast<quint32>(conf[CONF_MAX_CMD_PROCS].toInt(DEFAULT_MAX_CMD_PROCS)));
+        RetentionManager::instance()->start(conf);
+        FsCacheWatcher::instance()->start(conf);
+
         ret    = true;
         flags |= ACCEPTING;
     }
@@ -232,6 +236,9 @@ void TCPServer::procPipeIn()
 
         printDatabaseInfo(txtOut);
 
+        ChunkStore::publishMetrics();
+        HostMetrics::print(txtOut);
+
         hostSharedMem->unlock();
         controlSocket->write(text.toUtf8());
     }
@@ -20,6 +20,8 @@
 #include "db.h"
 #include "common.h"
 #include "session.h"
+#include "fs_cache.h"
+#include "chunk_store.h"
 #include "make_cert.h"
 #include "openssl/ssl.h"
 #include "unix_signal.h"
@@ -0,0 +1,275 @@
+#include "timing_wheel.h"
+
+//    This file is part of MRCI.
+
+//    MRCI is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+
+//    MRCI is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+
+//    You should have received a copy of the GNU General Public License
+//    along with MRCI under the LICENSE.md file. If not, see
+//    <http://www.gnu.org/licenses/>.
+
+
+WheelTimer::WheelTimer(QObject *parent) : QObject(parent)
+{
+    slot       = nullptr;
+    lastActive = 0;
+    interval   = 0;
+    single     = false;
+    active     = false;
+}
+
+WheelTimer::~WheelTimer()
+{
+    stop();
+}
+
+void WheelTimer::setInterval(int msec)
+{
+    interval = msec;
+
+    if (active)
+    {
+        start();
+    }
+}
+
+void WheelTimer::setSingleShot(bool state)
+{
+    single = state;
+}
+
+bool WheelTimer::isActive() const
+{
+    return active;
+}
+
+void WheelTimer::start()
+{
+    // the timer stays with the wheel of the thread it was first started in.
+
+    if (wheel.isNull())
+    {
+        wheel = TimingWheel::local();
+    }
+
+    wheel->arm(this);
+}
+
+void WheelTimer::start(int msec)
+{
+    interval = msec;
+
+    start();
+}
+
+void WheelTimer::stop()
+{
+    if (!wheel.isNull())
+    {
+        wheel->disarm(this);
+    }
+}
+
+void WheelTimer::touch()
+{
+    if (active && !wheel.isNull())
+    {
+        lastActive = wheel->msecNow();
+    }
+}
+
+TimingWheel *TimingWheel::local()
+{
+    if (!wheels.hasLocalData())
+    {
+        wheels.setLocalData(new TimingWheel());
+    }
+
+    return wheels.localData();
+}
+
+TimingWheel::TimingWheel(QObject *parent) : QObject(parent)
+{
+    tickTimer = new QTimer(this);
+    ticks     = 0;
+    now       = 0;
+    armed     = 0;
+
+    tickTimer->setTimerType(Qt::CoarseTimer);
+    tickTimer->setInterval(WHEEL_TICK_MSEC);
+
+    connect(tickTimer, &QTimer::timeout, this, &TimingWheel::tick);
+
+    clock.start();
+}
+
+qint64 TimingWheel::msecNow() const
+{
+    return now;
+}
+
+void TimingWheel::arm(WheelTimer *timer)
+{
+    now = clock.elapsed();
+
+    if (timer->active)
+    {
+        unplace(timer);
+    }
+    else
+    {
+        armed++;
+    }
+
+    timer->active     = true;
+    timer->lastActive = now;
+
+    place(timer);
+
+    if (!tickTimer->isActive())
+    {
+        tickTimer->start();
+    }
+}
+
+void TimingWheel::disarm(WheelTimer *timer)
+{
+    if (timer->active)
+    {
+        unplace(timer);
+
+        timer->active = false;
+
+        if (--armed == 0)
+        {
+            tickTimer->stop();
+        }
+    }
+}
+
+void TimingWheel::place(WheelTimer *timer)
+{
+    qint64 due = (timer->lastActive + timer->interval - now + WHEEL_TICK_MSEC - 1) / WHEEL_TICK_MSEC;
+
+    if (due < 1) due = 1;
+
+    int level = 0;
+
+    // anything past the top level's range is parked in its furthest slot and
+    // re-filed from there when that slot comes up.
+
+    while ((level < WHEEL_LEVELS - 1) && (due >= (1LL << (WHEEL_SLOT_BITS * (level + 1)))))
+    {
+        level++;
+    }
+
+    auto range = 1LL << (WHEEL_SLOT_BITS * (level + 1));
+
+    if (due >= range) due = range - 1;
+
+    auto at  = ticks + static_cast<quint64>(due);
+    auto idx = (at >> (WHEEL_SLOT_BITS * level)) & (WHEEL_SLOTS - 1);
+
+    timer->slot = &levels[level][idx];
+
+    timer->slot->insert(timer);
+}
+
+void TimingWheel::unplace(WheelTimer *timer)
+{
+    if (timer->slot != nullptr)
+    {
+        timer->slot->remove(timer);
+
+        timer->slot = nullptr;
+    }
+}
+
+void TimingWheel::cascade(int level)
+{
+    auto idx    = (ticks >> (WHEEL_SLOT_BITS * level)) & (WHEEL_SLOTS - 1);
+    auto timers = levels[level][idx];
+
+    levels[level][idx].clear();
+
+    for (auto *timer : timers)
+    {
+        timer->slot = nullptr;
+
+        place(timer);
+    }
+}
+
+void TimingWheel::tick()
+{
+    now = clock.elapsed();
+
+    ticks++;
+
+    // the wider levels are cascaded top down so timers coming out of level 2
+    // into the current level 1 slot are carried straight on down to level 0.
+
+    for (int level = WHEEL_LEVELS - 1; level > 0; --level)
+    {
+        if ((ticks & ((1ULL << (WHEEL_SLOT_BITS * level)) - 1)) == 0)
+        {
+            cascade(level);
+        }
+    }
+
+    auto idx    = ticks & (WHEEL_SLOTS - 1);
+    auto timers = levels[0][idx];
+
+    levels[0][idx].clear();
+
+    QList<QPointer<WheelTimer> > expired;
+
+    for (auto *timer : timers)
+    {
+        timer->slot = nullptr;
+
+        // activity since the timer was filed pushed the deadline out, so it
+        // just gets filed again further along the wheel.
+
+        if ((timer->lastActive + timer->interval) <= (now + WHEEL_TICK_MSEC / 2))
+        {
+            expired.append(timer);
+        }
+        else
+        {
+            place(timer);
+        }
+    }
+
+    for (auto &timer : expired)
+    {
+        // timeout handlers may stop, restart or delete any of the other
+        // expired timers so each one is checked again before it fires.
+
+        if (!timer.isNull() && timer->active && (timer->slot == nullptr))
+        {
+            if (timer->single)
+            {
+                disarm(timer);
+            }
+            else
+            {
+                timer->lastActive = now;
+
+                place(timer);
+            }
+
+            emit timer->timeout();
+        }
+    }
+}
+
+QThreadStorage<TimingWheel*> TimingWheel::wheels;
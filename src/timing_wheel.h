@@ -0,0 +1,119 @@
+#ifndef TIMING_WHEEL_H
+#define TIMING_WHEEL_H
+
+//    This file is part of MRCI.
+
+//    MRCI is free software: you can redistribute it and/or modify
+//    it under the terms of the GNU General Public License as published by
+//    the Free Software Foundation, either version 3 of the License, or
+//    (at your option) any later version.
+
+//    MRCI is distributed in the hope that it will be useful,
+//    but WITHOUT ANY WARRANTY; without even the implied warranty of
+//    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//    GNU General Public License for more details.
+
+//    You should have received a copy of the GNU General Public License
+//    along with MRCI under the LICENSE.md file. If not, see
+//    <http://www.gnu.org/licenses/>.
+
+#include <QObject>
+#include <QTimer>
+#include <QSet>
+#include <QList>
+#include <QPointer>
+#include <QElapsedTimer>
+#include <QThreadStorage>
+
+#define WHEEL_TICK_MSEC 100
+#define WHEEL_SLOT_BITS 6
+#define WHEEL_SLOTS     (1 << WHEEL_SLOT_BITS)
+#define WHEEL_LEVELS    3
+
+class TimingWheel;
+
+class WheelTimer : public QObject
+{
+    Q_OBJECT
+
+    // coarse stand-in for QTimer. every WheelTimer started in a thread shares
+    // that thread's TimingWheel so only one real timer ticks per thread no
+    // matter how many idle, keep alive or deadline timers are armed. touch()
+    // only records the time of the activity; the wheel works out the actual
+    // expiry when the timer's slot comes up.
+
+    friend class TimingWheel;
+
+private:
+
+    QPointer<TimingWheel>  wheel;
+    QSet<WheelTimer*>     *slot;
+    qint64                 lastActive;
+    int                    interval;
+    bool                   single;
+    bool                   active;
+
+public:
+
+    explicit WheelTimer(QObject *parent = nullptr);
+    ~WheelTimer();
+
+    void setInterval(int msec);
+    void setSingleShot(bool state);
+    bool isActive() const;
+
+public slots:
+
+    void start();
+    void start(int msec);
+    void stop();
+    void touch();
+
+signals:
+
+    void timeout();
+};
+
+//----------------------------
+
+class TimingWheel : public QObject
+{
+    Q_OBJECT
+
+    // hierarchical timing wheel. level 0 has one slot per tick and each level
+    // above it has slots WHEEL_SLOTS times wider. timers are filed by how far
+    // off their deadline is and cascade down a level when their wide slot
+    // comes up so a tick only visits one level 0 slot plus the occasional
+    // cascade.
+
+private:
+
+    static QThreadStorage<TimingWheel*> wheels;
+
+    QTimer           *tickTimer;
+    QElapsedTimer     clock;
+    QSet<WheelTimer*> levels[WHEEL_LEVELS][WHEEL_SLOTS];
+    quint64           ticks;
+    qint64            now;
+    int               armed;
+
+    void place(WheelTimer *timer);
+    void unplace(WheelTimer *timer);
+    void cascade(int level);
+
+private slots:
+
+    void tick();
+
+public:
+
+    static TimingWheel *local();
+
+    explicit TimingWheel(QObject *parent = nullptr);
+
+    qint64 msecNow() const;
+    void   arm(WheelTimer *timer);
+    void   disarm(WheelTimer *timer);
+};
+
+#endif // TIMING_WHEEL_H